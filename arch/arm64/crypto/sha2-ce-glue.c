@@ -17,6 +17,7 @@
 #include <linux/cpufeature.h>
 #include <linux/crypto.h>
 #include <linux/module.h>
+#include <linux/sizes.h>
 
 MODULE_DESCRIPTION("SHA-224/SHA-256 secure hash using ARMv8 Crypto Extensions");
 MODULE_AUTHOR("Ard Biesheuvel <ard.biesheuvel@linaro.org>");
@@ -47,6 +48,10 @@ const u32 sha256_ce_offsetof_finalize = offsetof(struct sha256_ce_state,
 
 asmlinkage void sha256_block_data_order(u32 *digest, u8 const *src, int blocks);
 
+asmlinkage void sha2_ce_transform_2x(u32 *state_a, u32 *state_b,
+				     u8 const *src_a, u8 const *src_b,
+				     int blocks);
+
 static int sha256_ce_update(struct shash_desc *desc, const u8 *data,
 			    unsigned int len)
 {
@@ -113,6 +118,87 @@ static int sha256_ce_final(struct shash_desc *desc, u8 *out)
 	return sha256_base_finish(desc, out);
 }
 
+/*
+ * Finish two messages of the same length from the state in @desc, hashing
+ * them together with sha2_ce_transform_2x(). The block completing a partial
+ * block of the common prefix and the final padded blocks are staged on the
+ * stack, so that the asm only ever processes whole blocks.
+ */
+static int sha256_ce_finup_mb(struct shash_desc *desc,
+			      const u8 * const data[], unsigned int len,
+			      u8 * const outs[], unsigned int num_msgs)
+{
+	struct sha256_ce_state *sctx = shash_desc_ctx(desc);
+	unsigned int partial = sctx->sst.count % SHA256_BLOCK_SIZE;
+	unsigned int ds = crypto_shash_digestsize(desc->tfm);
+	u64 bitcount = (sctx->sst.count + len) << 3;
+	u8 buf[2][2 * SHA256_BLOCK_SIZE];
+	u32 state[2][SHA256_DIGEST_SIZE / 4];
+	const u8 *src[2] = { data[0], data[1] };
+	struct sha256_ce_state orig;
+	unsigned int i, j, n;
+	int err = 0;
+
+	if (num_msgs != 2 || len < SHA256_BLOCK_SIZE || !may_use_simd()) {
+		/* Fall back to hashing the messages one after another */
+		orig = *sctx;
+		for (i = 0; !err && i < num_msgs; i++) {
+			*sctx = orig;
+			err = sha256_ce_finup(desc, data[i], len, outs[i]);
+		}
+		return err;
+	}
+
+	memcpy(state[0], sctx->sst.state, sizeof(state[0]));
+	memcpy(state[1], sctx->sst.state, sizeof(state[1]));
+
+	kernel_neon_begin();
+
+	if (partial) {
+		n = SHA256_BLOCK_SIZE - partial;
+		for (i = 0; i < 2; i++) {
+			memcpy(buf[i], sctx->sst.buf, partial);
+			memcpy(buf[i] + partial, src[i], n);
+			src[i] += n;
+		}
+		sha2_ce_transform_2x(state[0], state[1], buf[0], buf[1], 1);
+		len -= n;
+	}
+
+	while (len >= SHA256_BLOCK_SIZE) {
+		/* Bound the time spent with preemption disabled */
+		n = min_t(unsigned int, len, SZ_4K) / SHA256_BLOCK_SIZE;
+		sha2_ce_transform_2x(state[0], state[1], src[0], src[1], n);
+		src[0] += n * SHA256_BLOCK_SIZE;
+		src[1] += n * SHA256_BLOCK_SIZE;
+		len -= n * SHA256_BLOCK_SIZE;
+		if (len >= SHA256_BLOCK_SIZE) {
+			kernel_neon_end();
+			kernel_neon_begin();
+		}
+	}
+
+	/* Pad with 0x80, zeroes and the big endian message length in bits */
+	n = (len < SHA256_BLOCK_SIZE - sizeof(u64) ? 1 : 2) * SHA256_BLOCK_SIZE;
+	for (i = 0; i < 2; i++) {
+		memset(buf[i], 0, n);
+		memcpy(buf[i], src[i], len);
+		buf[i][len] = 0x80;
+		put_unaligned_be64(bitcount, buf[i] + n - sizeof(u64));
+	}
+	sha2_ce_transform_2x(state[0], state[1], buf[0], buf[1],
+			     n / SHA256_BLOCK_SIZE);
+
+	kernel_neon_end();
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < ds / sizeof(u32); j++)
+			put_unaligned_be32(state[i][j], outs[i] + j * 4);
+
+	memzero_explicit(buf, sizeof(buf));
+	return 0;
+}
+
 static struct shash_alg algs[] = { {
 	.init			= sha224_base_init,
 	.update			= sha256_ce_update,
@@ -145,11 +231,25 @@ static struct shash_alg algs[] = { {
 
 static int __init sha2_ce_mod_init(void)
 {
-	return crypto_register_shashes(algs, ARRAY_SIZE(algs));
+	int i, ret;
+
+	ret = crypto_register_shashes(algs, ARRAY_SIZE(algs));
+	if (ret)
+		return ret;
+
+	/* Multi-buffer hashing is an optimization, so failing it is fine */
+	for (i = 0; i < ARRAY_SIZE(algs); i++)
+		crypto_register_shash_finup_mb(&algs[i], sha256_ce_finup_mb, 2);
+
+	return 0;
 }
 
 static void __exit sha2_ce_mod_fini(void)
 {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(algs); i++)
+		crypto_unregister_shash_finup_mb(&algs[i]);
 	crypto_unregister_shashes(algs, ARRAY_SIZE(algs));
 }
 
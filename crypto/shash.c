@@ -25,6 +25,21 @@
 
 static const struct crypto_type crypto_shash_type;
 
+/*
+ * Multi-buffer finup functions of the algorithms which provide one. A tfm
+ * pins the module of its algorithm, so a function looked up for a live tfm
+ * stays valid after leaving the RCU read-side section.
+ */
+struct shash_finup_mb {
+	struct list_head list;
+	struct shash_alg *alg;
+	shash_finup_mb_t finup_mb;
+	unsigned int max_msgs;
+};
+
+static LIST_HEAD(shash_finup_mb_list);
+static DEFINE_MUTEX(shash_finup_mb_mutex);
+
 static int shash_no_setkey(struct crypto_shash *tfm, const u8 *key,
 			   unsigned int keylen)
 {
@@ -224,6 +239,70 @@ int crypto_shash_digest(struct shash_desc *desc, const u8 *data,
 }
 EXPORT_SYMBOL_GPL(crypto_shash_digest);
 
+static struct shash_finup_mb *shash_find_finup_mb(struct crypto_shash *tfm)
+{
+	struct shash_alg *alg = crypto_shash_alg(tfm);
+	struct shash_finup_mb *mb;
+
+	list_for_each_entry_rcu(mb, &shash_finup_mb_list, list)
+		if (mb->alg == alg)
+			return mb;
+
+	return NULL;
+}
+
+unsigned int crypto_shash_mb_max_msgs(struct crypto_shash *tfm)
+{
+	struct shash_finup_mb *mb;
+	unsigned int max_msgs;
+
+	rcu_read_lock();
+	mb = shash_find_finup_mb(tfm);
+	max_msgs = mb ? mb->max_msgs : 1;
+	rcu_read_unlock();
+
+	return max_msgs;
+}
+EXPORT_SYMBOL_GPL(crypto_shash_mb_max_msgs);
+
+int crypto_shash_finup_mb(struct shash_desc *desc, const u8 * const data[],
+			  unsigned int len, u8 * const outs[],
+			  unsigned int num_msgs)
+{
+	shash_finup_mb_t finup_mb = NULL;
+	struct shash_finup_mb *mb;
+	u8 state[HASH_MAX_STATESIZE];
+	unsigned int i;
+	int err;
+
+	if (num_msgs > 1) {
+		rcu_read_lock();
+		mb = shash_find_finup_mb(desc->tfm);
+		if (mb && num_msgs <= mb->max_msgs)
+			finup_mb = mb->finup_mb;
+		rcu_read_unlock();
+	}
+
+	if (finup_mb)
+		return finup_mb(desc, data, len, outs, num_msgs);
+
+	if (num_msgs == 1)
+		return crypto_shash_finup(desc, data[0], len, outs[0]);
+
+	/* Hash the messages one after another from the same state */
+	err = crypto_shash_export(desc, state);
+	for (i = 0; !err && i < num_msgs; i++) {
+		if (i)
+			err = crypto_shash_import(desc, state);
+		if (!err)
+			err = crypto_shash_finup(desc, data[i], len, outs[i]);
+	}
+
+	memzero_explicit(state, sizeof(state));
+	return err;
+}
+EXPORT_SYMBOL_GPL(crypto_shash_finup_mb);
+
 static int shash_default_export(struct shash_desc *desc, void *out)
 {
 	memcpy(out, shash_desc_ctx(desc), crypto_shash_descsize(desc->tfm));
@@ -562,6 +641,57 @@ int crypto_unregister_shashes(struct shash_alg *algs, int count)
 }
 EXPORT_SYMBOL_GPL(crypto_unregister_shashes);
 
+/*
+ * Register a function which finishes up to @max_msgs messages from the same
+ * state together. It must behave like crypto_shash_finup() on each message
+ * and handle any number of messages between 2 and @max_msgs.
+ */
+int crypto_register_shash_finup_mb(struct shash_alg *alg,
+				   shash_finup_mb_t finup_mb,
+				   unsigned int max_msgs)
+{
+	struct shash_finup_mb *mb;
+
+	if (WARN_ON(max_msgs < 2))
+		return -EINVAL;
+
+	mb = kmalloc(sizeof(*mb), GFP_KERNEL);
+	if (!mb)
+		return -ENOMEM;
+
+	mb->alg = alg;
+	mb->finup_mb = finup_mb;
+	mb->max_msgs = max_msgs;
+
+	mutex_lock(&shash_finup_mb_mutex);
+	list_add_rcu(&mb->list, &shash_finup_mb_list);
+	mutex_unlock(&shash_finup_mb_mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(crypto_register_shash_finup_mb);
+
+void crypto_unregister_shash_finup_mb(struct shash_alg *alg)
+{
+	struct shash_finup_mb *mb;
+
+	mutex_lock(&shash_finup_mb_mutex);
+	list_for_each_entry(mb, &shash_finup_mb_list, list) {
+		if (mb->alg == alg) {
+			list_del_rcu(&mb->list);
+			break;
+		}
+	}
+	mutex_unlock(&shash_finup_mb_mutex);
+
+	if (&mb->list == &shash_finup_mb_list)
+		return;
+
+	synchronize_rcu();
+	kfree(mb);
+}
+EXPORT_SYMBOL_GPL(crypto_unregister_shash_finup_mb);
+
 int shash_register_instance(struct crypto_template *tmpl,
 			    struct shash_instance *inst)
 {
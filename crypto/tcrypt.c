@@ -26,6 +26,7 @@
 
 #include <crypto/aead.h>
 #include <crypto/hash.h>
+#include <crypto/hash_mb.h>
 #include <crypto/skcipher.h>
 #include <linux/err.h>
 #include <linux/fips.h>
@@ -38,6 +39,7 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/vmalloc.h>
 #include "tcrypt.h"
 
 /*
@@ -1149,6 +1151,175 @@ static void test_hash_speed(const char *algo, unsigned int secs,
 	return test_ahash_speed_common(algo, secs, speed, CRYPTO_ALG_ASYNC);
 }
 
+/*
+ * Multi-buffer shash speed test: "bios" of 4096-byte blocks are hashed from a
+ * common salted state the way dm-verity hashes data blocks, first one block
+ * at a time and then as many blocks at a time as the algorithm supports.
+ */
+#define SHASH_MB_BLOCK_SIZE	4096
+#define SHASH_MB_MAX_BIO_SIZE	1048576
+#define SHASH_MB_MAX_MSGS	8
+
+static const unsigned int shash_mb_speed_template[] = {
+	4096, 65536, SHASH_MB_MAX_BIO_SIZE, 0
+};
+
+static int do_shash_mb_bio(struct shash_desc *desc, const u8 *state,
+			   const u8 *buf, unsigned int blen,
+			   unsigned int num_msgs)
+{
+	u8 digests[SHASH_MB_MAX_MSGS][HASH_MAX_DIGESTSIZE];
+	const u8 *data[SHASH_MB_MAX_MSGS];
+	u8 *outs[SHASH_MB_MAX_MSGS];
+	unsigned int off, i, n;
+	int ret;
+
+	for (off = 0; off < blen; off += n * SHASH_MB_BLOCK_SIZE) {
+		n = min(num_msgs, (blen - off) / SHASH_MB_BLOCK_SIZE);
+		for (i = 0; i < n; i++) {
+			data[i] = buf + off + i * SHASH_MB_BLOCK_SIZE;
+			outs[i] = digests[i];
+		}
+
+		ret = crypto_shash_import(desc, state);
+		if (!ret)
+			ret = crypto_shash_finup_mb(desc, data,
+						    SHASH_MB_BLOCK_SIZE,
+						    outs, n);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int test_shash_mb_jiffies(struct shash_desc *desc, const u8 *state,
+				 const u8 *buf, unsigned int blen,
+				 unsigned int num_msgs, int secs)
+{
+	unsigned long start, end;
+	int bcount;
+	int ret;
+
+	for (start = jiffies, end = start + secs * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount++) {
+		ret = do_shash_mb_bio(desc, state, buf, blen, num_msgs);
+		if (ret)
+			return ret;
+		cond_resched();
+	}
+
+	pr_cont("%2u at a time: %llu MB/s", num_msgs,
+		div_u64((u64)bcount * blen, secs * 1000000));
+	return 0;
+}
+
+static int test_shash_mb_cycles(struct shash_desc *desc, const u8 *state,
+				const u8 *buf, unsigned int blen,
+				unsigned int num_msgs)
+{
+	unsigned long cycles = 0;
+	int ret, i;
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		ret = do_shash_mb_bio(desc, state, buf, blen, num_msgs);
+		if (ret)
+			return ret;
+	}
+
+	/* The real thing. */
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+		ret = do_shash_mb_bio(desc, state, buf, blen, num_msgs);
+		end = get_cycles();
+		if (ret)
+			return ret;
+
+		cycles += end - start;
+	}
+
+	pr_cont("%2u at a time: %4lu cycles/byte", num_msgs,
+		cycles / (8 * blen));
+	return 0;
+}
+
+static void test_shash_mb_speed(const char *algo, unsigned int secs)
+{
+	struct crypto_shash *tfm;
+	SHASH_DESC_ON_STACK(desc, tfm);
+	unsigned int max_msgs, num_msgs, blen;
+	u8 *buf, *state = NULL;
+	int i, ret;
+
+	tfm = crypto_alloc_shash(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		pr_err("failed to load transform for %s: %ld\n",
+		       algo, PTR_ERR(tfm));
+		return;
+	}
+
+	max_msgs = min_t(unsigned int, crypto_shash_mb_max_msgs(tfm),
+			 SHASH_MB_MAX_MSGS);
+	pr_info("\ntesting speed of multi-buffer %s (%s), %u at a time\n",
+		algo, get_driver_name(crypto_shash, tfm), max_msgs);
+
+	buf = vmalloc(SHASH_MB_MAX_BIO_SIZE);
+	if (!buf)
+		goto out;
+	memset(buf, 0xff, SHASH_MB_MAX_BIO_SIZE);
+
+	state = kmalloc(crypto_shash_statesize(tfm), GFP_KERNEL);
+	if (!state)
+		goto out;
+
+	/* Start from a salted state, like dm-verity */
+	desc->tfm = tfm;
+	desc->flags = 0;
+	ret = crypto_shash_init(desc);
+	if (!ret)
+		ret = crypto_shash_update(desc, buf, 32);
+	if (!ret)
+		ret = crypto_shash_export(desc, state);
+	if (ret) {
+		pr_err("hashing failed ret=%d\n", ret);
+		goto out;
+	}
+
+	for (i = 0; shash_mb_speed_template[i]; i++) {
+		blen = shash_mb_speed_template[i];
+		pr_info("test%3u (%7u byte bios): ", i, blen);
+
+		for (num_msgs = 1; num_msgs <= max_msgs; num_msgs *= 2) {
+			if (num_msgs > 1)
+				pr_cont(", ");
+			if (secs)
+				ret = test_shash_mb_jiffies(desc, state, buf,
+							    blen, num_msgs,
+							    secs);
+			else
+				ret = test_shash_mb_cycles(desc, state, buf,
+							   blen, num_msgs);
+			if (ret)
+				break;
+		}
+		pr_cont("\n");
+
+		if (ret) {
+			pr_err("hashing failed ret=%d\n", ret);
+			break;
+		}
+	}
+
+out:
+	shash_desc_zero(desc);
+	kfree(state);
+	vfree(buf);
+	crypto_free_shash(tfm);
+}
+
 struct test_mb_skcipher_data {
 	struct scatterlist sg[XBUFSIZE];
 	struct skcipher_request *req;
@@ -2516,6 +2687,10 @@ static int do_test(const char *alg, u32 type, u32 mask, int m, u32 num_mb)
 				    num_mb);
 		if (mode > 400 && mode < 500) break;
 		/* fall through */
+	case 426:
+		test_shash_mb_speed("sha256", sec);
+		if (mode > 400 && mode < 500) break;
+		/* fall through */
 	case 499:
 		break;
 
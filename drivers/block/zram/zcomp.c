@@ -11,6 +11,7 @@
 #include <linux/string.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
 #include <linux/cpu.h>
@@ -42,8 +43,10 @@ static void zcomp_strm_free(struct zcomp_strm *zstrm)
 	if (!IS_ERR_OR_NULL(zstrm->tfm))
 		crypto_free_comp(zstrm->tfm);
 	free_pages((unsigned long)zstrm->buffer, 1);
+	vfree(zstrm->batch_buffer);
 	zstrm->tfm = NULL;
 	zstrm->buffer = NULL;
+	zstrm->batch_buffer = NULL;
 }
 
 /*
@@ -62,6 +65,14 @@ static int zcomp_strm_init(struct zcomp_strm *zstrm, struct zcomp *comp)
 		zcomp_strm_free(zstrm);
 		return -ENOMEM;
 	}
+
+	if (comp->batch_pages) {
+		zstrm->batch_buffer = vmalloc(comp->batch_pages * PAGE_SIZE);
+		if (!zstrm->batch_buffer) {
+			zcomp_strm_free(zstrm);
+			return -ENOMEM;
+		}
+	}
 	return 0;
 }
 
@@ -212,8 +223,10 @@ void zcomp_destroy(struct zcomp *comp)
  * if requested algorithm is not supported, ERR_PTR(-ENOMEM) in
  * case of allocation error, or any other error potentially
  * returned by zcomp_init().
+ * With a non-zero @batch_pages every stream also gets a batch buffer
+ * big enough to keep the output of that many compressions.
  */
-struct zcomp *zcomp_create(const char *compress)
+struct zcomp *zcomp_create(const char *compress, unsigned int batch_pages)
 {
 	struct zcomp *comp;
 	int error;
@@ -226,6 +239,7 @@ struct zcomp *zcomp_create(const char *compress)
 		return ERR_PTR(-ENOMEM);
 
 	comp->name = compress;
+	comp->batch_pages = batch_pages;
 	error = zcomp_init(comp);
 	if (error) {
 		kfree(comp);
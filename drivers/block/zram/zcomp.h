@@ -13,6 +13,8 @@
 struct zcomp_strm {
 	/* compression/decompression buffer */
 	void *buffer;
+	/* holds the output of a whole batch of compressions, may be NULL */
+	void *batch_buffer;
 	struct crypto_comp *tfm;
 };
 
@@ -20,6 +22,8 @@ struct zcomp_strm {
 struct zcomp {
 	struct zcomp_strm __percpu *stream;
 	const char *name;
+	/* number of pages each stream's batch_buffer can hold */
+	unsigned int batch_pages;
 	struct hlist_node node;
 };
 
@@ -28,7 +32,7 @@ int zcomp_cpu_dead(unsigned int cpu, struct hlist_node *node);
 ssize_t zcomp_available_show(const char *comp, char *buf);
 bool zcomp_available_algorithm(const char *comp);
 
-struct zcomp *zcomp_create(const char *comp);
+struct zcomp *zcomp_create(const char *comp, unsigned int batch_pages);
 void zcomp_destroy(struct zcomp *comp);
 
 struct zcomp_strm *zcomp_stream_get(struct zcomp *comp);
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Same-content page deduplication for zram
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/highmem.h>
+
+#include "zram_drv.h"
+
+/* One slot will contain 128 pages theoretically */
+#define ZRAM_HASH_SHIFT		7
+#define ZRAM_HASH_SIZE_MIN	(1 << 10)
+#define ZRAM_HASH_SIZE_MAX	(1UL << 31)
+
+static u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_dedup_hash(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum % zram->hash_size];
+}
+
+struct zram_entry *zram_dedup_alloc_entry(struct zram *zram,
+				unsigned long handle, unsigned int len,
+				gfp_t flags)
+{
+	struct zram_entry *entry;
+
+	entry = kzalloc(sizeof(*entry),
+			flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_CMA));
+	if (!entry)
+		return NULL;
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->refcount = 1;
+	entry->handle = handle;
+	entry->len = len;
+	atomic64_add(sizeof(*entry), &zram->stats.meta_data_size);
+
+	return entry;
+}
+
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+				u32 checksum)
+{
+	struct zram_hash *hash;
+	struct rb_root *rb_root;
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	new->checksum = checksum;
+	hash = zram_dedup_hash(zram, checksum);
+	rb_root = &hash->rb_root;
+
+	spin_lock(&hash->lock);
+	rb_node = &rb_root->rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, rb_root);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Compare @mem against the object of @entry. Called with the hash
+ * bucket lock held so the entry can't go away under us. Only objects
+ * made by the primary compressor are ever inserted into the hash.
+ */
+static bool zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+				unsigned char *mem)
+{
+	struct zcomp *comp = zram->comps[ZRAM_PRIMARY_COMP];
+	struct zcomp_strm *zstrm;
+	bool match = false;
+	void *cmem;
+	int ret;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE) {
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+	} else {
+		zstrm = zcomp_stream_get(comp);
+		ret = zcomp_decompress(zstrm, cmem, entry->len, zstrm->buffer);
+		if (!ret)
+			match = !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+		zcomp_stream_put(comp);
+	}
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+static struct zram_entry *zram_dedup_get(struct zram *zram,
+				unsigned char *mem, u32 checksum)
+{
+	struct zram_hash *hash;
+	struct zram_entry *entry;
+	struct rb_node *rb_node;
+
+	hash = zram_dedup_hash(zram, checksum);
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			break;
+
+		if (checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+
+	if (!rb_node)
+		goto miss;
+
+	/* Rewind to the first entry with this checksum */
+	while (rb_prev(rb_node)) {
+		struct zram_entry *prev;
+
+		prev = rb_entry(rb_prev(rb_node), struct zram_entry, rb_node);
+		if (prev->checksum != checksum)
+			break;
+		rb_node = rb_prev(rb_node);
+	}
+
+	/* Walk all the entries with the same checksum */
+	for (; rb_node; rb_node = rb_next(rb_node)) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+
+		if (zram_dedup_match(zram, entry, mem)) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			atomic64_inc(&zram->stats.dedup_hits);
+			atomic64_add(entry->len, &zram->stats.dup_data_size);
+			return entry;
+		}
+	}
+miss:
+	spin_unlock(&hash->lock);
+	atomic64_inc(&zram->stats.dedup_misses);
+
+	return NULL;
+}
+
+/*
+ * Look up an existing object with the same content as @page and take a
+ * reference to it. The content checksum is returned through @checksum so
+ * the caller can insert a new object on a miss.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, struct page *page,
+				u32 *checksum)
+{
+	void *mem;
+	struct zram_entry *entry;
+
+	if (!zram_dedup_enabled(zram))
+		return NULL;
+
+	mem = kmap_atomic(page);
+	*checksum = zram_dedup_checksum(mem);
+	entry = zram_dedup_get(zram, mem, *checksum);
+	kunmap_atomic(mem);
+
+	return entry;
+}
+
+/*
+ * Drop a reference to @entry. Returns true if it was the last one, in
+ * which case the zsmalloc object and the entry are freed.
+ */
+bool zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	unsigned long refcount;
+
+	hash = zram_dedup_hash(zram, entry->checksum);
+
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount && !RB_EMPTY_NODE(&entry->rb_node))
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	if (refcount)
+		return false;
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+	atomic64_sub(sizeof(*entry), &zram->stats.meta_data_size);
+
+	return true;
+}
+
+bool zram_dedup_shared(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	bool shared;
+
+	hash = zram_dedup_hash(zram, entry->checksum);
+
+	spin_lock(&hash->lock);
+	shared = entry->refcount > 1;
+	spin_unlock(&hash->lock);
+
+	return shared;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+	struct zram_hash *hash;
+
+	if (!zram_dedup_enabled(zram))
+		return 0;
+
+	zram->hash_size = num_pages >> ZRAM_HASH_SHIFT;
+	zram->hash_size = min_t(size_t, ZRAM_HASH_SIZE_MAX, zram->hash_size);
+	zram->hash_size = max_t(size_t, ZRAM_HASH_SIZE_MIN, zram->hash_size);
+	zram->hash = vzalloc(array_size(zram->hash_size,
+					sizeof(struct zram_hash)));
+	if (!zram->hash) {
+		pr_err("Error allocating zram entry hash\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		hash = &zram->hash[i];
+		spin_lock_init(&hash->lock);
+		hash->rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
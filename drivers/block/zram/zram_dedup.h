@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+struct page;
+struct zram;
+struct zram_entry;
+
+#ifdef CONFIG_ZRAM_DEDUP
+
+struct zram_entry *zram_dedup_find(struct zram *zram, struct page *page,
+				u32 *checksum);
+struct zram_entry *zram_dedup_alloc_entry(struct zram *zram,
+				unsigned long handle, unsigned int len,
+				gfp_t flags);
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+				u32 checksum);
+bool zram_dedup_put(struct zram *zram, struct zram_entry *entry);
+bool zram_dedup_shared(struct zram *zram, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+#else
+
+static inline struct zram_entry *zram_dedup_find(struct zram *zram,
+				struct page *page, u32 *checksum)
+{
+	return NULL;
+}
+static inline struct zram_entry *zram_dedup_alloc_entry(struct zram *zram,
+				unsigned long handle, unsigned int len,
+				gfp_t flags)
+{
+	return NULL;
+}
+static inline void zram_dedup_insert(struct zram *zram,
+				struct zram_entry *new, u32 checksum) { }
+static inline bool zram_dedup_put(struct zram *zram,
+				struct zram_entry *entry) { return true; }
+static inline bool zram_dedup_shared(struct zram *zram,
+				struct zram_entry *entry) { return false; }
+
+static inline int zram_dedup_init(struct zram *zram,
+				size_t num_pages) { return 0; }
+static inline void zram_dedup_fini(struct zram *zram) { }
+#endif
+
+#endif /* _ZRAM_DEDUP_H_ */
@@ -54,6 +54,8 @@ static size_t huge_class_size;
 static void zram_free_page(struct zram *zram, size_t index);
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 				u32 index, int offset, struct bio *bio);
+static int __zram_read_from_zspool(struct zram *zram, struct page *page,
+				   u32 index);
 
 
 static int zram_slot_trylock(struct zram *zram, u32 index)
@@ -91,6 +93,28 @@ static void zram_set_handle(struct zram *zram, u32 index, unsigned long handle)
 	zram->table[index].handle = handle;
 }
 
+/* Translate table.handle to the zsmalloc handle of the object */
+static unsigned long zram_entry_handle(struct zram *zram, unsigned long handle)
+{
+	if (zram_dedup_enabled(zram))
+		return ((struct zram_entry *)handle)->handle;
+
+	return handle;
+}
+
+/*
+ * Drop a reference to the object behind table.handle. Returns false if
+ * the object is still shared with other slots.
+ */
+static bool zram_put_handle(struct zram *zram, unsigned long handle)
+{
+	if (zram_dedup_enabled(zram))
+		return zram_dedup_put(zram, (struct zram_entry *)handle);
+
+	zs_free(zram->mem_pool, handle);
+	return true;
+}
+
 /* flag operations require table entry bit_spin_lock() being held */
 static bool zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
@@ -134,6 +158,25 @@ static void zram_set_obj_size(struct zram *zram,
 	zram->table[index].flags = (flags << ZRAM_FLAG_SHIFT) | size;
 }
 
+static void zram_set_priority(struct zram *zram, u32 index, u32 prio)
+{
+	prio &= ZRAM_COMP_PRIORITY_MASK;
+	/*
+	 * Clear previous priority value first, in case if we recompress
+	 * further an already recompressed page
+	 */
+	zram->table[index].flags &= ~(ZRAM_COMP_PRIORITY_MASK <<
+				      ZRAM_COMP_PRIORITY_BIT1);
+	zram->table[index].flags |= (prio << ZRAM_COMP_PRIORITY_BIT1);
+}
+
+static inline u32 zram_get_priority(struct zram *zram, u32 index)
+{
+	u32 prio = zram->table[index].flags >> ZRAM_COMP_PRIORITY_BIT1;
+
+	return prio & ZRAM_COMP_PRIORITY_MASK;
+}
+
 static inline bool zram_allocated(struct zram *zram, u32 index)
 {
 	return zram_get_obj_size(zram, index) ||
@@ -391,6 +434,28 @@ static ssize_t writeback_limit_show(struct device *dev,
 	return scnprintf(buf, PAGE_SIZE, "%llu\n", val);
 }
 
+static ssize_t writeback_readahead_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u32 val;
+
+	if (kstrtouint(buf, 10, &val) || val > ZRAM_WB_RA_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(zram->wb_readahead, val);
+	return len;
+}
+
+static ssize_t writeback_readahead_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			READ_ONCE(zram->wb_readahead));
+}
+
 static void reset_bdev(struct zram *zram)
 {
 	struct block_device *bdev;
@@ -411,6 +476,8 @@ static void reset_bdev(struct zram *zram)
 				BDI_CAP_SYNCHRONOUS_IO;
 	kvfree(zram->bitmap);
 	zram->bitmap = NULL;
+	kvfree(zram->blk_refs);
+	zram->blk_refs = NULL;
 }
 
 static ssize_t backing_dev_show(struct device *dev,
@@ -453,6 +520,7 @@ static ssize_t backing_dev_store(struct device *dev,
 	struct address_space *mapping;
 	unsigned int bitmap_sz, old_block_size = 0;
 	unsigned long nr_pages, *bitmap = NULL;
+	u16 *blk_refs = NULL;
 	struct block_device *bdev = NULL;
 	int err;
 	struct zram *zram = dev_to_zram(dev);
@@ -506,6 +574,12 @@ static ssize_t backing_dev_store(struct device *dev,
 		goto out;
 	}
 
+	blk_refs = kvcalloc(nr_pages, sizeof(*blk_refs), GFP_KERNEL);
+	if (!blk_refs) {
+		err = -ENOMEM;
+		goto out;
+	}
+
 	old_block_size = block_size(bdev);
 	err = set_blocksize(bdev, PAGE_SIZE);
 	if (err)
@@ -517,6 +591,7 @@ static ssize_t backing_dev_store(struct device *dev,
 	zram->bdev = bdev;
 	zram->backing_dev = backing_dev;
 	zram->bitmap = bitmap;
+	zram->blk_refs = blk_refs;
 	zram->nr_pages = nr_pages;
 	/*
 	 * With writeback feature, zram does asynchronous IO so it's no longer
@@ -540,6 +615,9 @@ static ssize_t backing_dev_store(struct device *dev,
 	if (bitmap)
 		kvfree(bitmap);
 
+	if (blk_refs)
+		kvfree(blk_refs);
+
 	if (bdev)
 		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
 
@@ -553,312 +631,979 @@ static ssize_t backing_dev_store(struct device *dev,
 	return err;
 }
 
-static unsigned long alloc_block_bdev(struct zram *zram)
-{
-	unsigned long blk_idx = 1;
-retry:
-	/* skip 0 bit to confuse zram.handle = 0 */
-	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
-	if (blk_idx == zram->nr_pages)
-		return 0;
+/*
+ * A writeback request packs as many compressed objects as fit into
+ * ZRAM_WB_BATCH_PAGES and writes them with a single bio to a contiguous
+ * range of the backing device. Up to ZRAM_WB_MAX_INFLIGHT requests are
+ * in flight; slots are only switched to ZRAM_WB once their request has
+ * completed, from the context of writeback_store.
+ */
+struct zram_wb_slot {
+	u32 index;
+	u32 pos;	/* of the object in the request buffer */
+	u32 len;
+	u32 prio;
+};
 
-	if (test_and_set_bit(blk_idx, zram->bitmap))
-		goto retry;
+struct zram_wb_req {
+	struct list_head entry;
+	struct zram_wb_ctl *ctl;
+	void *buf;
+	unsigned int used;
+	unsigned long blk_idx;
+	int error;
+	/* bd_wb_limit units taken for the slots, settled on submission */
+	u64 wb_reserved;
+	unsigned int nr_slots;
+	struct zram_wb_slot slots[ZRAM_WB_BATCH_SLOTS];
+};
 
-	atomic64_inc(&zram->stats.bd_count);
-	return blk_idx;
-}
+struct zram_wb_ctl {
+	struct zram *zram;
+	struct list_head idle;
+	unsigned int nr_reqs;
+	/* completed requests, filled from the bio end_io */
+	struct list_head done;
+	spinlock_t done_lock;
+	wait_queue_head_t wait;
+	atomic_t inflight;
+	int error;
+};
 
-static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+/*
+ * Reserve @nr contiguous blocks on the backing device and take a
+ * reference on each block for every object of @req overlapping it.
+ * Block 0 is never handed out so a zero element stays meaningless.
+ * Returns the first block index or 0 if there is no free range.
+ */
+static unsigned long alloc_block_bdev(struct zram *zram,
+				struct zram_wb_req *req, unsigned int nr)
 {
-	int was_set;
+	unsigned long blk_idx, blk, last;
+	unsigned int i;
 
-	was_set = test_and_clear_bit(blk_idx, zram->bitmap);
-	WARN_ON_ONCE(!was_set);
-	atomic64_dec(&zram->stats.bd_count);
-}
+	spin_lock(&zram->bitmap_lock);
+	blk_idx = bitmap_find_next_zero_area(zram->bitmap, zram->nr_pages,
+					     1, nr, 0);
+	if (blk_idx + nr > zram->nr_pages) {
+		spin_unlock(&zram->bitmap_lock);
+		return 0;
+	}
 
-static void zram_page_end_io(struct bio *bio)
-{
-	struct page *page = bio_first_page_all(bio);
+	bitmap_set(zram->bitmap, blk_idx, nr);
+	for (i = 0; i < req->nr_slots; i++) {
+		blk = blk_idx + (req->slots[i].pos >> PAGE_SHIFT);
+		last = blk_idx +
+			((req->slots[i].pos + req->slots[i].len - 1) >>
+			 PAGE_SHIFT);
+		for (; blk <= last; blk++)
+			zram->blk_refs[blk]++;
+	}
+	spin_unlock(&zram->bitmap_lock);
 
-	page_endio(page, op_is_write(bio_op(bio)),
-			blk_status_to_errno(bio->bi_status));
-	bio_put(bio);
+	atomic64_add(nr, &zram->stats.bd_count);
+	return blk_idx;
 }
 
 /*
- * Returns 1 if the submission is successful.
+ * Drop the references the object at byte @pos of the backing device
+ * holds on its blocks, releasing the blocks no other object overlaps.
  */
-static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
-			unsigned long entry, struct bio *parent)
+static void free_block_bdev(struct zram *zram, unsigned long pos,
+				unsigned int len)
 {
-	struct bio *bio;
-
-	bio = bio_alloc(GFP_ATOMIC, 1);
-	if (!bio)
-		return -ENOMEM;
-
-	bio->bi_iter.bi_sector = entry * (PAGE_SIZE >> 9);
-	bio_set_dev(bio, zram->bdev);
-	if (!bio_add_page(bio, bvec->bv_page, bvec->bv_len, bvec->bv_offset)) {
-		bio_put(bio);
-		return -EIO;
-	}
+	unsigned long blk = pos >> PAGE_SHIFT;
+	unsigned long last = (pos + len - 1) >> PAGE_SHIFT;
 
-	if (!parent) {
-		bio->bi_opf = REQ_OP_READ;
-		bio->bi_end_io = zram_page_end_io;
-	} else {
-		bio->bi_opf = parent->bi_opf;
-		bio_chain(bio, parent);
+	spin_lock(&zram->bitmap_lock);
+	for (; blk <= last; blk++) {
+		if (WARN_ON_ONCE(!zram->blk_refs[blk]))
+			continue;
+		if (--zram->blk_refs[blk])
+			continue;
+		WARN_ON_ONCE(!test_bit(blk, zram->bitmap));
+		__clear_bit(blk, zram->bitmap);
+		atomic64_dec(&zram->stats.bd_count);
 	}
-
-	submit_bio(bio);
-	return 1;
+	spin_unlock(&zram->bitmap_lock);
 }
 
-#define PAGE_WB_SIG "page_index="
-
-#define PAGE_WRITEBACK 0
-#define HUGE_WRITEBACK 1
-#define IDLE_WRITEBACK 2
+/*
+ * Written back objects are kept compressed and packed back to back on
+ * the backing device, so an object may straddle two blocks. Reading one
+ * back fetches the block(s) into bounce pages and decompresses from
+ * there into the destination page in process context.
+ *
+ * Slots written back together sit next to each other on the backing
+ * device and tend to be faulted back together too. With wb_readahead
+ * set, the read is widened to cover the following ZRAM_WB slots that
+ * lie close by, and their objects are put back into zsmalloc as they
+ * are, so faults on them don't go to the backing device again.
+ */
+struct zram_bd_ra {
+	u32 index;
+	u32 len;
+	u32 prio;
+	unsigned long pos;
+};
 
-static ssize_t writeback_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t len)
-{
-	struct zram *zram = dev_to_zram(dev);
-	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
-	unsigned long index = 0;
-	struct bio bio;
-	struct bio_vec bio_vec;
+struct zram_bd_read {
+	struct work_struct work;
+	struct zram *zram;
+	struct bio *parent;
 	struct page *page;
-	ssize_t ret;
-	int mode, err;
-	unsigned long blk_idx = 0;
-
-	if (sysfs_streq(buf, "idle"))
-		mode = IDLE_WRITEBACK;
-	else if (sysfs_streq(buf, "huge"))
-		mode = HUGE_WRITEBACK;
-	else {
-		if (strncmp(buf, PAGE_WB_SIG, sizeof(PAGE_WB_SIG) - 1))
-			return -EINVAL;
-
-		if (kstrtol(buf + sizeof(PAGE_WB_SIG) - 1, 10, &index) ||
-				index >= nr_pages)
-			return -EINVAL;
-
-		nr_pages = 1;
-		mode = PAGE_WRITEBACK;
-	}
-
-	down_read(&zram->init_lock);
-	if (!init_done(zram)) {
-		ret = -EINVAL;
-		goto release_init_lock;
-	}
+	struct page *bounce[ZRAM_WB_BATCH_PAGES];
+	unsigned int nr_pages;
+	unsigned long start;	/* backing device offset of bounce[0] */
+	unsigned long end;
+	unsigned long pos;
+	unsigned int len;
+	u32 prio;
+	int error;
+	unsigned int nr_ra;
+	struct zram_bd_ra ra[ZRAM_WB_RA_MAX];
+};
 
-	if (!zram->backing_dev) {
-		ret = -ENODEV;
-		goto release_init_lock;
-	}
+static void zram_bd_read_free(struct zram_bd_read *rd)
+{
+	unsigned int i;
 
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
-		ret = -ENOMEM;
-		goto release_init_lock;
-	}
+	for (i = 0; i < rd->nr_pages; i++)
+		__free_page(rd->bounce[i]);
+	kfree(rd);
+}
 
-	for (; nr_pages != 0; index++, nr_pages--) {
-		struct bio_vec bvec;
+static struct zram_bd_read *zram_bd_read_alloc(struct zram *zram,
+				struct page *page, unsigned long pos,
+				unsigned int len, u32 prio)
+{
+	struct zram_bd_read *rd;
 
-		bvec.bv_page = page;
-		bvec.bv_len = PAGE_SIZE;
-		bvec.bv_offset = 0;
+	rd = kzalloc(sizeof(*rd), GFP_NOIO);
+	if (!rd)
+		return NULL;
 
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && !zram->bd_wb_limit) {
-			spin_unlock(&zram->wb_limit_lock);
-			ret = -EIO;
-			break;
-		}
-		spin_unlock(&zram->wb_limit_lock);
+	rd->zram = zram;
+	rd->page = page;
+	rd->start = pos & PAGE_MASK;
+	rd->end = pos + len;
+	rd->pos = pos;
+	rd->len = len;
+	rd->prio = prio;
+	return rd;
+}
 
-		if (!blk_idx) {
-			blk_idx = alloc_block_bdev(zram);
-			if (!blk_idx) {
-				ret = -ENOSPC;
-				break;
-			}
-		}
+/* Pick the ZRAM_WB slots following @index whose objects are close by */
+static void zram_bd_readahead_prepare(struct zram_bd_read *rd, u32 index)
+{
+	struct zram *zram = rd->zram;
+	unsigned long nr_slots = zram->disksize >> PAGE_SHIFT;
+	unsigned long last = min_t(unsigned long, nr_slots,
+				   (unsigned long)index + 1 +
+				   READ_ONCE(zram->wb_readahead));
+	unsigned long start, end, pos;
+	struct zram_bd_ra *ra;
+	unsigned int len;
 
+	for (index++; index < last; index++) {
 		zram_slot_lock(zram, index);
-		if (!zram_allocated(zram, index))
-			goto next;
-
-		if (zram_test_flag(zram, index, ZRAM_WB) ||
-				zram_test_flag(zram, index, ZRAM_SAME) ||
-				zram_test_flag(zram, index, ZRAM_UNDER_WB))
-			goto next;
-
-		if (mode == IDLE_WRITEBACK &&
-			  !zram_test_flag(zram, index, ZRAM_IDLE))
-			goto next;
-		if (mode == HUGE_WRITEBACK &&
-			  !zram_test_flag(zram, index, ZRAM_HUGE))
+		if (!zram_test_flag(zram, index, ZRAM_WB) ||
+		    zram_test_flag(zram, index, ZRAM_UNDER_RA))
 			goto next;
-		/*
-		 * Clearing ZRAM_UNDER_WB is duty of caller.
-		 * IOW, zram_free_page never clear it.
-		 */
-		zram_set_flag(zram, index, ZRAM_UNDER_WB);
-		/* Need for hugepage writeback racing */
-		zram_set_flag(zram, index, ZRAM_IDLE);
-		zram_slot_unlock(zram, index);
-		if (zram_bvec_read(zram, &bvec, index, 0, NULL)) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
-			continue;
-		}
-
-		bio_init(&bio, &bio_vec, 1);
-		bio_set_dev(&bio, zram->bdev);
-		bio.bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
-		bio.bi_opf = REQ_OP_WRITE | REQ_SYNC;
-
-		bio_add_page(&bio, bvec.bv_page, bvec.bv_len,
-				bvec.bv_offset);
-		/*
-		 * XXX: A single page IO would be inefficient for write
-		 * but it would be not bad as starter.
-		 */
-		err = submit_bio_wait(&bio);
-		if (err) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
-			/*
-			 * Return last IO error unless every IO were
-			 * not suceeded.
-			 */
-			ret = err;
-			continue;
-		}
 
-		atomic64_inc(&zram->stats.bd_writes);
-		/*
-		 * We released zram_slot_lock so need to check if the slot was
-		 * changed. If there is freeing for the slot, we can catch it
-		 * easily by zram_allocated.
-		 * A subtle case is the slot is freed/reallocated/marked as
-		 * ZRAM_IDLE again. To close the race, idle_store doesn't
-		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
-		 * Thus, we could close the race by checking ZRAM_IDLE bit.
-		 */
-		zram_slot_lock(zram, index);
-		if (!zram_allocated(zram, index) ||
-			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
+		pos = zram_get_element(zram, index);
+		len = zram_get_obj_size(zram, index);
+		start = min(rd->start, pos & PAGE_MASK);
+		end = max(rd->end, pos + len);
+		if (end - start > ZRAM_WB_BATCH_PAGES * PAGE_SIZE)
 			goto next;
-		}
 
-		zram_free_page(zram, index);
-		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-		zram_set_flag(zram, index, ZRAM_WB);
-		zram_set_element(zram, index, blk_idx);
-		blk_idx = 0;
-		atomic64_inc(&zram->stats.pages_stored);
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
-			zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
-		spin_unlock(&zram->wb_limit_lock);
+		/* Cleared by zram_free_page if the slot changes meanwhile */
+		zram_set_flag(zram, index, ZRAM_UNDER_RA);
+		ra = &rd->ra[rd->nr_ra++];
+		ra->index = index;
+		ra->pos = pos;
+		ra->len = len;
+		ra->prio = zram_get_priority(zram, index);
+		rd->start = start;
+		rd->end = end;
 next:
 		zram_slot_unlock(zram, index);
 	}
+}
 
-	if (blk_idx)
-		free_block_bdev(zram, blk_idx);
-	ret = len;
-	__free_page(page);
-release_init_lock:
-	up_read(&zram->init_lock);
-
-	return ret;
+/*
+ * Whether the slot still holds the object @ra was prepared for. A write
+ * clears ZRAM_UNDER_RA through zram_free_page(), but the slot could have
+ * been written back again and picked by another readahead since, so the
+ * location on the backing device is checked too. Called with the slot
+ * lock held.
+ */
+static bool zram_bd_readahead_owned(struct zram *zram, struct zram_bd_ra *ra)
+{
+	return zram_test_flag(zram, ra->index, ZRAM_UNDER_RA) &&
+		zram_test_flag(zram, ra->index, ZRAM_WB) &&
+		zram_get_element(zram, ra->index) == ra->pos &&
+		zram_get_obj_size(zram, ra->index) == ra->len;
 }
 
-struct zram_work {
-	struct work_struct work;
-	struct zram *zram;
-	unsigned long entry;
-	struct bio *bio;
-	struct bio_vec bvec;
-};
+static void zram_bd_readahead_release(struct zram *zram, struct zram_bd_ra *ra)
+{
+	zram_slot_lock(zram, ra->index);
+	if (zram_bd_readahead_owned(zram, ra))
+		zram_clear_flag(zram, ra->index, ZRAM_UNDER_RA);
+	zram_slot_unlock(zram, ra->index);
+}
 
-#if PAGE_SIZE != 4096
-static void zram_sync_read(struct work_struct *work)
+static void zram_bd_readahead_cancel(struct zram_bd_read *rd)
 {
-	struct zram_work *zw = container_of(work, struct zram_work, work);
-	struct zram *zram = zw->zram;
-	unsigned long entry = zw->entry;
-	struct bio *bio = zw->bio;
+	unsigned int i;
 
-	read_from_bdev_async(zram, &zw->bvec, entry, bio);
+	for (i = 0; i < rd->nr_ra; i++)
+		zram_bd_readahead_release(rd->zram, &rd->ra[i]);
+	rd->nr_ra = 0;
 }
 
-/*
- * Block layer want one ->make_request_fn to be active at a time
- * so if we use chained IO with parent IO in same context,
- * it's a deadlock. To avoid, it, it uses worker thread context.
- */
-static int read_from_bdev_sync(struct zram *zram, struct bio_vec *bvec,
-				unsigned long entry, struct bio *bio)
+static int zram_bd_read_alloc_pages(struct zram_bd_read *rd)
 {
-	struct zram_work work;
-
-	work.bvec = *bvec;
-	work.zram = zram;
-	work.entry = entry;
-	work.bio = bio;
+	unsigned int nr_pages = DIV_ROUND_UP(rd->end - rd->start, PAGE_SIZE);
 
-	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
-	queue_work(system_unbound_wq, &work.work);
-	flush_work(&work.work);
-	destroy_work_on_stack(&work.work);
+	for (; rd->nr_pages < nr_pages; rd->nr_pages++) {
+		rd->bounce[rd->nr_pages] = alloc_page(GFP_NOIO);
+		if (!rd->bounce[rd->nr_pages])
+			return -ENOMEM;
+	}
 
-	return 1;
+	return 0;
 }
-#else
-static int read_from_bdev_sync(struct zram *zram, struct bio_vec *bvec,
-				unsigned long entry, struct bio *bio)
+
+static struct bio *zram_bd_read_bio(struct zram_bd_read *rd)
 {
-	WARN_ON(1);
-	return -EIO;
+	struct bio *bio;
+	unsigned int i;
+
+	bio = bio_alloc(GFP_NOIO, rd->nr_pages);
+	bio_set_dev(bio, rd->zram->bdev);
+	bio->bi_iter.bi_sector = (rd->start >> PAGE_SHIFT) * (PAGE_SIZE >> 9);
+	bio->bi_opf = REQ_OP_READ;
+	for (i = 0; i < rd->nr_pages; i++)
+		bio_add_page(bio, rd->bounce[i], PAGE_SIZE, 0);
+
+	return bio;
 }
-#endif
 
-static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
-			unsigned long entry, struct bio *parent, bool sync)
+/* Copy the object at backing device offset @pos out of the bounce pages */
+static void zram_bd_read_copy(struct zram_bd_read *rd, void *dst,
+				unsigned long pos, unsigned int len)
 {
-	atomic64_inc(&zram->stats.bd_reads);
-	if (sync)
-		return read_from_bdev_sync(zram, bvec, entry, parent);
-	else
-		return read_from_bdev_async(zram, bvec, entry, parent);
+	unsigned long off = pos - rd->start;
+	unsigned int i = off >> PAGE_SHIFT;
+	unsigned int offset = offset_in_page(off);
+	unsigned int sz;
+	void *src;
+
+	while (len) {
+		sz = min_t(unsigned int, len, PAGE_SIZE - offset);
+		src = kmap_atomic(rd->bounce[i++]);
+		memcpy(dst, src + offset, sz);
+		kunmap_atomic(src);
+		dst += sz;
+		len -= sz;
+		offset = 0;
+	}
 }
-#else
-static inline void reset_bdev(struct zram *zram) {};
-static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
-			unsigned long entry, struct bio *parent, bool sync)
+
+static int zram_bd_read_decompress(struct zram_bd_read *rd)
 {
-	return -EIO;
-}
+	struct zcomp *comp = rd->zram->comps[rd->prio];
+	struct zcomp_strm *zstrm;
+	void *dst;
+	int ret = 0;
 
-static void free_block_bdev(struct zram *zram, unsigned long blk_idx) {};
+	zstrm = zcomp_stream_get(comp);
+	/* Linearize the object, it may straddle two bounce pages */
+	zram_bd_read_copy(rd, zstrm->buffer, rd->pos, rd->len);
+	dst = kmap_atomic(rd->page);
+	if (rd->len == PAGE_SIZE)
+		memcpy(dst, zstrm->buffer, PAGE_SIZE);
+	else
+		ret = zcomp_decompress(zstrm, zstrm->buffer, rd->len, dst);
+	kunmap_atomic(dst);
+	zcomp_stream_put(comp);
+
+	return ret;
+}
+
+/*
+ * Put a read ahead object back into zsmalloc. No direct reclaim here,
+ * like for recompression: it is only a hint and the slot stays readable
+ * from the backing device. Returns false once memory runs short.
+ */
+static bool zram_bd_readahead_fill(struct zram_bd_read *rd,
+				struct zram_bd_ra *ra)
+{
+	struct zram *zram = rd->zram;
+	unsigned long alloced_pages;
+	unsigned long handle;
+	void *dst;
+
+	handle = zs_malloc(zram->mem_pool, ra->len,
+			   __GFP_KSWAPD_RECLAIM |
+			   __GFP_NOWARN |
+			   __GFP_HIGHMEM |
+			   __GFP_MOVABLE);
+	if (!handle)
+		return false;
+
+	alloced_pages = zs_get_total_pages(zram->mem_pool);
+	update_used_max(zram, alloced_pages);
+	if (zram->limit_pages && alloced_pages > zram->limit_pages) {
+		zs_free(zram->mem_pool, handle);
+		return false;
+	}
+
+	dst = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	zram_bd_read_copy(rd, dst, ra->pos, ra->len);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	/* Not inserted into the dedup hash, like recompressed objects */
+	if (zram_dedup_enabled(zram)) {
+		struct zram_entry *entry;
+
+		entry = zram_dedup_alloc_entry(zram, handle, ra->len,
+				GFP_NOWAIT | __GFP_NOWARN);
+		if (!entry) {
+			zs_free(zram->mem_pool, handle);
+			return false;
+		}
+		handle = (unsigned long)entry;
+	}
+
+	zram_slot_lock(zram, ra->index);
+	if (!zram_bd_readahead_owned(zram, ra)) {
+		zram_slot_unlock(zram, ra->index);
+		zram_put_handle(zram, handle);
+		return true;
+	}
+
+	zram_free_page(zram, ra->index);
+	zram_set_handle(zram, ra->index, handle);
+	zram_set_obj_size(zram, ra->index, ra->len);
+	zram_set_priority(zram, ra->index, ra->prio);
+	if (ra->len == PAGE_SIZE) {
+		zram_set_flag(zram, ra->index, ZRAM_HUGE);
+		atomic64_inc(&zram->stats.huge_pages);
+	}
+	zram_set_flag(zram, ra->index, ZRAM_READAHEAD);
+	zram_slot_unlock(zram, ra->index);
+
+	atomic64_add(ra->len, &zram->stats.compr_data_size);
+	if (ra->prio != ZRAM_PRIMARY_COMP) {
+		atomic64_inc(&zram->stats.recomp_pages[ra->prio]);
+		atomic64_add(ra->len, &zram->stats.recomp_data_size[ra->prio]);
+	}
+	atomic64_inc(&zram->stats.pages_stored);
+	atomic64_inc(&zram->stats.bd_ra_pages);
+	return true;
+}
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct zram_bd_read *rd = container_of(work, struct zram_bd_read,
+					       work);
+	unsigned int i = 0;
+
+	if (!rd->error)
+		rd->error = zram_bd_read_decompress(rd);
+
+	/*
+	 * Fill before completing the read: the device can't be reset while
+	 * I/O on it is pending, so zram->mem_pool stays around until then.
+	 */
+	if (!rd->error) {
+		for (; i < rd->nr_ra; i++) {
+			if (!zram_bd_readahead_fill(rd, &rd->ra[i]))
+				break;
+		}
+	}
+	for (; i < rd->nr_ra; i++)
+		zram_bd_readahead_release(rd->zram, &rd->ra[i]);
+
+	if (rd->parent) {
+		if (rd->error)
+			rd->parent->bi_status = errno_to_blk_status(rd->error);
+		bio_endio(rd->parent);
+	} else {
+		page_endio(rd->page, false, rd->error);
+	}
+	zram_bd_read_free(rd);
+}
+
+static void zram_bd_read_end_io(struct bio *bio)
+{
+	struct zram_bd_read *rd = bio->bi_private;
+
+	rd->error = blk_status_to_errno(bio->bi_status);
+	bio_put(bio);
+	/* Decompression can't run from the completion context */
+	INIT_WORK(&rd->work, zram_bd_read_work);
+	queue_work(system_highpri_wq, &rd->work);
+}
+
+/*
+ * Returns 1 if the submission is successful.
+ */
+static int read_from_bdev_async(struct zram *zram, struct page *page,
+			u32 index, unsigned long pos, unsigned int len,
+			u32 prio, struct bio *parent)
+{
+	struct zram_bd_read *rd;
+	struct bio *bio;
+
+	rd = zram_bd_read_alloc(zram, page, pos, len, prio);
+	if (!rd)
+		return -ENOMEM;
+
+	if (READ_ONCE(zram->wb_readahead))
+		zram_bd_readahead_prepare(rd, index);
+
+	if (zram_bd_read_alloc_pages(rd)) {
+		zram_bd_readahead_cancel(rd);
+		zram_bd_read_free(rd);
+		return -ENOMEM;
+	}
+
+	bio = zram_bd_read_bio(rd);
+	bio->bi_end_io = zram_bd_read_end_io;
+	bio->bi_private = rd;
+	/* @parent completes once the page is decompressed */
+	rd->parent = parent;
+	if (parent)
+		bio_inc_remaining(parent);
+
+	submit_bio(bio);
+	return 1;
+}
+
+static struct zram_wb_req *zram_wb_alloc_req(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL | __GFP_NOWARN);
+	if (!req)
+		return NULL;
+
+	req->buf = vmalloc(ZRAM_WB_BATCH_PAGES * PAGE_SIZE);
+	if (!req->buf) {
+		kfree(req);
+		return NULL;
+	}
+	req->ctl = ctl;
+	return req;
+}
+
+static void zram_wb_end_io(struct bio *bio)
+{
+	struct zram_wb_req *req = bio->bi_private;
+	struct zram_wb_ctl *ctl = req->ctl;
+	unsigned long flags;
+
+	req->error = blk_status_to_errno(bio->bi_status);
+	bio_put(bio);
+	atomic64_dec(&ctl->zram->stats.bd_wb_inflight);
+
+	/*
+	 * writeback_store may return as soon as inflight drops to zero but
+	 * it takes done_lock first, so don't touch ctl after unlocking.
+	 */
+	spin_lock_irqsave(&ctl->done_lock, flags);
+	list_add_tail(&req->entry, &ctl->done);
+	atomic_dec(&ctl->inflight);
+	wake_up(&ctl->wait);
+	spin_unlock_irqrestore(&ctl->done_lock, flags);
+}
+
+/*
+ * bd_wb_limit is a hard budget of backing device writes, so it is taken
+ * a page per slot as slots join a request, before anything is written.
+ * Returns false, taking nothing, once the budget is used up.
+ */
+static bool zram_wb_limit_reserve(struct zram *zram, u64 *units)
+{
+	*units = 0;
+
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable) {
+		if (!zram->bd_wb_limit) {
+			spin_unlock(&zram->wb_limit_lock);
+			return false;
+		}
+		*units = min_t(u64, zram->bd_wb_limit,
+			       1UL << (PAGE_SHIFT - 12));
+		zram->bd_wb_limit -= *units;
+	}
+	spin_unlock(&zram->wb_limit_lock);
+
+	return true;
+}
+
+/* Give back the part of the reservation that won't be written */
+static void zram_wb_limit_refund(struct zram *zram, u64 units)
+{
+	if (!units)
+		return;
+
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable)
+		zram->bd_wb_limit += units;
+	spin_unlock(&zram->wb_limit_lock);
+}
+
+/*
+ * Returns false if the backing device has no room for @req; @req is
+ * completed with -ENOSPC in that case.
+ */
+static bool zram_wb_submit_req(struct zram_wb_ctl *ctl,
+				struct zram_wb_req *req)
+{
+	struct zram *zram = ctl->zram;
+	unsigned int nr = DIV_ROUND_UP(req->used, PAGE_SIZE);
+	u64 charge;
+	struct bio *bio;
+	unsigned int i;
+
+	req->blk_idx = alloc_block_bdev(zram, req, nr);
+	if (!req->blk_idx) {
+		zram_wb_limit_refund(zram, req->wb_reserved);
+		req->wb_reserved = 0;
+		req->error = -ENOSPC;
+		spin_lock_irq(&ctl->done_lock);
+		list_add_tail(&req->entry, &ctl->done);
+		spin_unlock_irq(&ctl->done_lock);
+		return false;
+	}
+
+	/* Packed objects take fewer pages than the slots reserved */
+	charge = min_t(u64, req->wb_reserved, (u64)nr << (PAGE_SHIFT - 12));
+	zram_wb_limit_refund(zram, req->wb_reserved - charge);
+	req->wb_reserved = 0;
+
+	bio = bio_alloc(GFP_NOIO, nr);
+	bio_set_dev(bio, zram->bdev);
+	bio->bi_iter.bi_sector = req->blk_idx * (PAGE_SIZE >> 9);
+	/*
+	 * Not REQ_SYNC: writeback is a background job and should not be
+	 * prioritized over the rest of the I/O to the backing device.
+	 */
+	bio->bi_opf = REQ_OP_WRITE;
+	bio->bi_end_io = zram_wb_end_io;
+	bio->bi_private = req;
+	for (i = 0; i < nr; i++)
+		bio_add_page(bio, vmalloc_to_page(req->buf + i * PAGE_SIZE),
+				PAGE_SIZE, 0);
+	flush_kernel_vmap_range(req->buf, nr * PAGE_SIZE);
+
+	atomic_inc(&ctl->inflight);
+	atomic64_inc(&zram->stats.bd_wb_inflight);
+	submit_bio(bio);
+	return true;
+}
+
+static void zram_wb_finish_req(struct zram_wb_ctl *ctl,
+				struct zram_wb_req *req)
+{
+	struct zram *zram = ctl->zram;
+	unsigned long pos;
+	unsigned int i;
+
+	for (i = 0; i < req->nr_slots; i++) {
+		struct zram_wb_slot *slot = &req->slots[i];
+		u32 index = slot->index;
+
+		pos = (req->blk_idx << PAGE_SHIFT) + slot->pos;
+		/*
+		 * We released zram_slot_lock so need to check if the slot
+		 * was changed. If there is freeing for the slot, we can
+		 * catch it easily by zram_allocated.
+		 * A subtle case is the slot is freed/reallocated/marked as
+		 * ZRAM_IDLE again. To close the race, idle_store doesn't
+		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
+		 * Thus, we could close the race by checking ZRAM_IDLE bit.
+		 */
+		zram_slot_lock(zram, index);
+		if (req->error || !zram_allocated(zram, index) ||
+			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+			if (req->blk_idx)
+				free_block_bdev(zram, pos, slot->len);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_set_element(zram, index, pos);
+		zram_set_obj_size(zram, index, slot->len);
+		zram_set_priority(zram, index, slot->prio);
+		atomic64_inc(&zram->stats.pages_stored);
+		zram_slot_unlock(zram, index);
+		atomic64_inc(&zram->stats.bd_wb_pages);
+	}
+
+	if (req->error) {
+		/*
+		 * Return last IO error unless every IO were
+		 * not suceeded.
+		 */
+		if (req->error != -ENOSPC)
+			ctl->error = req->error;
+		return;
+	}
+
+	atomic64_add(DIV_ROUND_UP(req->used, PAGE_SIZE),
+			&zram->stats.bd_writes);
+	atomic64_add(req->used, &zram->stats.bd_wb_bytes);
+}
+
+/* Move completed requests back to the idle list */
+static void zram_wb_complete(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req, *tmp;
+	LIST_HEAD(done);
+
+	spin_lock_irq(&ctl->done_lock);
+	list_splice_init(&ctl->done, &done);
+	spin_unlock_irq(&ctl->done_lock);
+
+	list_for_each_entry_safe(req, tmp, &done, entry) {
+		zram_wb_finish_req(ctl, req);
+		list_move_tail(&req->entry, &ctl->idle);
+	}
+}
+
+static bool zram_wb_has_done(struct zram_wb_ctl *ctl)
+{
+	bool ret;
+
+	spin_lock_irq(&ctl->done_lock);
+	ret = !list_empty(&ctl->done);
+	spin_unlock_irq(&ctl->done_lock);
+
+	return ret;
+}
+
+static struct zram_wb_req *zram_wb_get_req(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req;
+
+	zram_wb_complete(ctl);
+	if (list_empty(&ctl->idle) && ctl->nr_reqs < ZRAM_WB_MAX_INFLIGHT) {
+		req = zram_wb_alloc_req(ctl);
+		if (req) {
+			ctl->nr_reqs++;
+			goto out;
+		}
+		if (!ctl->nr_reqs)
+			return NULL;
+	}
+
+	/* Every other request is in flight, wait for one to come back */
+	while (list_empty(&ctl->idle)) {
+		wait_event(ctl->wait, zram_wb_has_done(ctl));
+		zram_wb_complete(ctl);
+	}
+	req = list_first_entry(&ctl->idle, struct zram_wb_req, entry);
+	list_del(&req->entry);
+out:
+	req->used = 0;
+	req->nr_slots = 0;
+	req->blk_idx = 0;
+	req->error = 0;
+	req->wb_reserved = 0;
+	return req;
+}
+
+static void zram_wb_drain(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req, *tmp;
+
+	wait_event(ctl->wait, !atomic_read(&ctl->inflight));
+	zram_wb_complete(ctl);
+
+	list_for_each_entry_safe(req, tmp, &ctl->idle, entry) {
+		list_del(&req->entry);
+		vfree(req->buf);
+		kfree(req);
+	}
+}
+
+/*
+ * Copy the compressed object of @index into @req. Caller should hold
+ * the slot lock. Returns false if @req has no room left for it.
+ */
+static bool zram_wb_add_slot(struct zram *zram, struct zram_wb_req *req,
+				u32 index)
+{
+	struct zram_wb_slot *slot;
+	unsigned long handle;
+	unsigned int size;
+	void *src;
+
+	size = zram_get_obj_size(zram, index);
+	if (req->nr_slots == ZRAM_WB_BATCH_SLOTS ||
+	    req->used + size > ZRAM_WB_BATCH_PAGES * PAGE_SIZE)
+		return false;
+
+	handle = zram_entry_handle(zram, zram_get_handle(zram, index));
+	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	memcpy(req->buf + req->used, src, size);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	slot = &req->slots[req->nr_slots++];
+	slot->index = index;
+	slot->pos = req->used;
+	slot->len = size;
+	slot->prio = zram_get_priority(zram, index);
+	req->used += size;
+
+	return true;
+}
+
+#define PAGE_WB_SIG "page_index="
+
+#define PAGE_WRITEBACK 0
+#define HUGE_WRITEBACK 1
+#define IDLE_WRITEBACK 2
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long index = 0;
+	struct zram_wb_req *req = NULL, *full;
+	struct zram_wb_ctl ctl;
+	unsigned long handle;
+	u64 written, elapsed, units;
+	ktime_t start;
+	ssize_t ret;
+	int mode;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = IDLE_WRITEBACK;
+	else if (sysfs_streq(buf, "huge"))
+		mode = HUGE_WRITEBACK;
+	else {
+		if (strncmp(buf, PAGE_WB_SIG, sizeof(PAGE_WB_SIG) - 1))
+			return -EINVAL;
+
+		if (kstrtol(buf + sizeof(PAGE_WB_SIG) - 1, 10, &index) ||
+				index >= nr_pages)
+			return -EINVAL;
+
+		nr_pages = 1;
+		mode = PAGE_WRITEBACK;
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram->backing_dev) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
+
+	ctl.zram = zram;
+	INIT_LIST_HEAD(&ctl.idle);
+	ctl.nr_reqs = 0;
+	INIT_LIST_HEAD(&ctl.done);
+	spin_lock_init(&ctl.done_lock);
+	init_waitqueue_head(&ctl.wait);
+	atomic_set(&ctl.inflight, 0);
+	ctl.error = 0;
+
+	ret = len;
+	start = ktime_get();
+	written = atomic64_read(&zram->stats.bd_writes);
+	atomic64_set(&zram->stats.bd_wb_scanned, 0);
+	for (; nr_pages != 0; index++, nr_pages--) {
+		spin_lock(&zram->wb_limit_lock);
+		if (zram->wb_limit_enable && !zram->bd_wb_limit) {
+			spin_unlock(&zram->wb_limit_lock);
+			ret = -EIO;
+			break;
+		}
+		spin_unlock(&zram->wb_limit_lock);
+
+		atomic64_inc(&zram->stats.bd_wb_scanned);
+retry:
+		if (!req) {
+			req = zram_wb_get_req(&ctl);
+			if (!req) {
+				ret = -ENOMEM;
+				break;
+			}
+		}
+
+		zram_slot_lock(zram, index);
+		if (!zram_allocated(zram, index))
+			goto next;
+
+		if (zram_test_flag(zram, index, ZRAM_WB) ||
+				zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_UNDER_WB))
+			goto next;
+
+		if (mode == IDLE_WRITEBACK &&
+			  !zram_test_flag(zram, index, ZRAM_IDLE))
+			goto next;
+		if (mode == HUGE_WRITEBACK &&
+			  !zram_test_flag(zram, index, ZRAM_HUGE))
+			goto next;
+
+		/* The object would stay in memory for the other slots */
+		handle = zram_get_handle(zram, index);
+		if (zram_dedup_enabled(zram) &&
+		    zram_dedup_shared(zram, (struct zram_entry *)handle))
+			goto next;
+
+		if (!zram_wb_limit_reserve(zram, &units)) {
+			zram_slot_unlock(zram, index);
+			ret = -EIO;
+			break;
+		}
+
+		if (!zram_wb_add_slot(zram, req, index)) {
+			/* req is full, submit it and retry the slot */
+			zram_slot_unlock(zram, index);
+			zram_wb_limit_refund(zram, units);
+			full = req;
+			req = NULL;
+			if (!zram_wb_submit_req(&ctl, full)) {
+				ret = -ENOSPC;
+				break;
+			}
+			goto retry;
+		}
+		/*
+		 * Clearing ZRAM_UNDER_WB is duty of caller.
+		 * IOW, zram_free_page never clear it.
+		 */
+		req->wb_reserved += units;
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		/* Need for hugepage writeback racing */
+		zram_set_flag(zram, index, ZRAM_IDLE);
+next:
+		zram_slot_unlock(zram, index);
+		cond_resched();
+	}
+
+	if (req) {
+		if (!req->nr_slots)
+			list_add(&req->entry, &ctl.idle);
+		else if (!zram_wb_submit_req(&ctl, req))
+			ret = -ENOSPC;
+	}
+	zram_wb_drain(&ctl);
+	if (ctl.error)
+		ret = ctl.error;
+
+	/* Throughput to the backing device, in KB/s */
+	elapsed = max_t(u64, ktime_us_delta(ktime_get(), start), 1);
+	written = atomic64_read(&zram->stats.bd_writes) - written;
+	atomic64_set(&zram->stats.bd_wb_kbps,
+		div64_u64((written << PAGE_SHIFT) * USEC_PER_SEC >> 10,
+			  elapsed));
+release_init_lock:
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+/*
+ * Block layer want one ->make_request_fn to be active at a time
+ * so if we submit IO and wait for it in the same context, it's a
+ * deadlock. To avoid it, it uses worker thread context.
+ */
+#if PAGE_SIZE != 4096
+struct zram_work {
+	struct work_struct work;
+	struct zram_bd_read *rd;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+	struct zram_bd_read *rd = zw->rd;
+	struct bio *bio;
+
+	bio = zram_bd_read_bio(rd);
+	rd->error = submit_bio_wait(bio);
+	bio_put(bio);
+	if (!rd->error)
+		rd->error = zram_bd_read_decompress(rd);
+}
+
+static int read_from_bdev_sync(struct zram *zram, struct page *page,
+			unsigned long pos, unsigned int len, u32 prio)
+{
+	struct zram_work work;
+	int ret;
+
+	work.rd = zram_bd_read_alloc(zram, page, pos, len, prio);
+	if (!work.rd)
+		return -ENOMEM;
+
+	if (zram_bd_read_alloc_pages(work.rd)) {
+		zram_bd_read_free(work.rd);
+		return -ENOMEM;
+	}
+
+	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
+	queue_work(system_unbound_wq, &work.work);
+	flush_work(&work.work);
+	destroy_work_on_stack(&work.work);
+
+	ret = work.rd->error;
+	zram_bd_read_free(work.rd);
+	return ret;
+}
+#else
+static int read_from_bdev_sync(struct zram *zram, struct page *page,
+			unsigned long pos, unsigned int len, u32 prio)
+{
+	WARN_ON(1);
+	return -EIO;
+}
+#endif
+
+static int read_from_bdev(struct zram *zram, struct page *page, u32 index,
+			unsigned long pos, unsigned int len, u32 prio,
+			struct bio *parent, bool sync)
+{
+	atomic64_inc(&zram->stats.bd_reads);
+	if (sync)
+		return read_from_bdev_sync(zram, page, pos, len, prio);
+	else
+		return read_from_bdev_async(zram, page, index, pos, len, prio,
+					    parent);
+}
+#else
+static inline void reset_bdev(struct zram *zram) {};
+static int read_from_bdev(struct zram *zram, struct page *page, u32 index,
+			unsigned long pos, unsigned int len, u32 prio,
+			struct bio *parent, bool sync)
+{
+	return -EIO;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long pos,
+				unsigned int len) {};
 #endif
 
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
@@ -984,52 +1729,471 @@ static ssize_t max_comp_streams_show(struct device *dev,
 	return scnprintf(buf, PAGE_SIZE, "%d\n", num_online_cpus());
 }
 
-static ssize_t max_comp_streams_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t len)
-{
-	return len;
-}
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	return len;
+}
+
+static ssize_t __comp_algorithm_show(struct zram *zram, u32 prio, char *buf)
+{
+	ssize_t sz;
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->comp_algs[prio], buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static int __comp_algorithm_store(struct zram *zram, u32 prio, const char *buf)
+{
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	size_t sz;
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	if (!zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+
+	strcpy(zram->comp_algs[prio], compressor);
+	up_write(&zram->init_lock);
+	return 0;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return __comp_algorithm_show(zram, ZRAM_PRIMARY_COMP, buf);
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	int ret;
+
+	ret = __comp_algorithm_store(zram, ZRAM_PRIMARY_COMP, buf);
+	return ret ? ret : len;
+}
+
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", (int)val);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtoint(buf, 10, &val) || (val != 0 && val != 1))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
+	up_write(&zram->init_lock);
+	return len;
+}
+#endif
+
+#ifdef CONFIG_ZRAM_MULTI_COMP
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t sz = 0;
+	u32 prio;
+
+	for (prio = ZRAM_SECONDARY_COMP; prio < ZRAM_MAX_COMPS; prio++) {
+		if (!zram->comp_algs[prio][0])
+			continue;
+
+		sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2, "#%u: ", prio);
+		sz += __comp_algorithm_show(zram, prio, buf + sz);
+	}
+
+	return sz;
+}
+
+/*
+ * Accepts "algo=NAME [priority=N]". Priority defaults to the first
+ * secondary slot.
+ */
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u32 prio = ZRAM_SECONDARY_COMP;
+	char *args, *param, *val;
+	char *alg = NULL;
+	int ret;
+
+	args = skip_spaces(buf);
+	while (*args) {
+		args = next_arg(args, &param, &val);
+
+		if (!val || !*val)
+			return -EINVAL;
+
+		if (!strcmp(param, "algo")) {
+			alg = val;
+			continue;
+		}
+
+		if (!strcmp(param, "priority")) {
+			ret = kstrtouint(val, 10, &prio);
+			if (ret)
+				return ret;
+			continue;
+		}
+	}
+
+	if (!alg)
+		return -EINVAL;
+
+	if (prio < ZRAM_SECONDARY_COMP || prio >= ZRAM_MAX_COMPS)
+		return -EINVAL;
+
+	ret = __comp_algorithm_store(zram, prio, alg);
+	return ret ? ret : len;
+}
+#endif
+
+#ifdef CONFIG_ZRAM_MULTI_COMP
+#define RECOMPRESS_IDLE		(1 << 0)
+#define RECOMPRESS_HUGE		(1 << 1)
+
+/*
+ * Try to recompress the slot with the secondary algorithms in
+ * [prio, prio_max). Called with the slot lock held.
+ */
+static int zram_recompress(struct zram *zram, u32 index, struct page *page,
+			   u32 threshold, u32 prio, u32 prio_max)
+{
+	struct zcomp_strm *zstrm = NULL;
+	unsigned long handle_old;
+	unsigned long handle_new;
+	unsigned int comp_len_old;
+	unsigned int comp_len_new;
+	unsigned int class_index_old;
+	unsigned int class_index_new;
+	u32 num_recomps = 0;
+	bool idle;
+	void *src, *dst;
+	int ret;
+
+	handle_old = zram_get_handle(zram, index);
+	if (!handle_old)
+		return -EINVAL;
+
+	/*
+	 * A shared object would stay around for the other slots, so
+	 * recompressing it for this one only costs memory.
+	 */
+	if (zram_dedup_enabled(zram) &&
+	    zram_dedup_shared(zram, (struct zram_entry *)handle_old))
+		return 0;
+
+	comp_len_old = zram_get_obj_size(zram, index);
+	/*
+	 * Do not recompress objects that are already "small enough".
+	 */
+	if (comp_len_old < threshold)
+		return 0;
+
+	ret = __zram_read_from_zspool(zram, page, index);
+	if (ret)
+		return ret;
+
+	class_index_old = zs_lookup_class_index(zram->mem_pool, comp_len_old);
+	/*
+	 * Iterate the secondary comp algorithms list (in order of priority)
+	 * and try to recompress the page.
+	 */
+	for (; prio < prio_max; prio++) {
+		if (!zram->comps[prio])
+			continue;
+
+		/*
+		 * Skip if the object is already re-compressed with a higher
+		 * priority algorithm (or same algorithm).
+		 */
+		if (prio <= zram_get_priority(zram, index))
+			continue;
+
+		num_recomps++;
+		atomic64_inc(&zram->stats.num_recompress);
+		zstrm = zcomp_stream_get(zram->comps[prio]);
+		src = kmap_atomic(page);
+		ret = zcomp_compress(zstrm, src, &comp_len_new);
+		kunmap_atomic(src);
+
+		if (ret) {
+			zcomp_stream_put(zram->comps[prio]);
+			return ret;
+		}
+
+		class_index_new = zs_lookup_class_index(zram->mem_pool,
+							comp_len_new);
+
+		/* Continue until we make progress */
+		if (class_index_new >= class_index_old ||
+		    (threshold && comp_len_new >= threshold)) {
+			zcomp_stream_put(zram->comps[prio]);
+			continue;
+		}
+
+		/* Recompression was successful so break out */
+		break;
+	}
+
+	/*
+	 * We did not try to recompress, e.g. when we have only one
+	 * secondary algorithm and the page is already recompressed
+	 * using that algorithm
+	 */
+	if (!zstrm)
+		return 0;
+
+	if (prio == prio_max) {
+		/*
+		 * Secondary algorithms failed to re-compress the page
+		 * in a way that would save memory, mark the object as
+		 * incompressible so that we will not try to compress
+		 * it again.
+		 *
+		 * We need to make sure that all secondary algorithms have
+		 * failed, so we test if the number of recompressions matches
+		 * the number of active secondary algorithms.
+		 */
+		if (num_recomps == zram->num_active_comps - 1)
+			zram_set_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+		return 0;
+	}
+
+	/*
+	 * No direct reclaim (slow path) for handle allocation and no
+	 * re-compression attempt (unlike in __zram_bvec_write()) since
+	 * we already have stored that object in zsmalloc. If we cannot
+	 * alloc memory for recompressed object then we bail out and
+	 * simply keep the old (existing) object in zsmalloc.
+	 */
+	handle_new = zs_malloc(zram->mem_pool, comp_len_new,
+			       __GFP_KSWAPD_RECLAIM |
+			       __GFP_NOWARN |
+			       __GFP_HIGHMEM |
+			       __GFP_MOVABLE);
+	if (!handle_new) {
+		zcomp_stream_put(zram->comps[prio]);
+		return -ENOMEM;
+	}
+
+	dst = zs_map_object(zram->mem_pool, handle_new, ZS_MM_WO);
+	memcpy(dst, zstrm->buffer, comp_len_new);
+	zcomp_stream_put(zram->comps[prio]);
+
+	zs_unmap_object(zram->mem_pool, handle_new);
+
+	/*
+	 * Recompressed objects are not inserted into the dedup hash:
+	 * lookups only know how to decompress primary objects.
+	 */
+	if (zram_dedup_enabled(zram)) {
+		struct zram_entry *entry;
+
+		entry = zram_dedup_alloc_entry(zram, handle_new, comp_len_new,
+				GFP_NOWAIT | __GFP_NOWARN);
+		if (!entry) {
+			zs_free(zram->mem_pool, handle_new);
+			return -ENOMEM;
+		}
+		handle_new = (unsigned long)entry;
+	}
+
+	/* Recompression must not make the slot look recently accessed */
+	idle = zram_test_flag(zram, index, ZRAM_IDLE);
+	zram_free_page(zram, index);
+	zram_set_handle(zram, index, handle_new);
+	zram_set_obj_size(zram, index, comp_len_new);
+	zram_set_priority(zram, index, prio);
+	if (idle)
+		zram_set_flag(zram, index, ZRAM_IDLE);
+
+	atomic64_add(comp_len_new, &zram->stats.compr_data_size);
+	atomic64_inc(&zram->stats.recomp_pages[prio]);
+	atomic64_add(comp_len_new, &zram->stats.recomp_data_size[prio]);
+	atomic64_inc(&zram->stats.pages_stored);
+
+	return 0;
+}
+
+/*
+ * Accepts "[type=idle|huge|huge_idle] [threshold=BYTES] [max_pages=N]
+ * [algo=NAME]". Without type= every compressed slot is a candidate.
+ */
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	u32 prio = ZRAM_SECONDARY_COMP, prio_max = ZRAM_MAX_COMPS;
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	char *args, *param, *val, *algo = NULL;
+	u64 max_pages = ULLONG_MAX;
+	u32 mode = 0, threshold = 0;
+	unsigned long index;
+	struct page *page;
+	ssize_t ret;
+
+	args = skip_spaces(buf);
+	while (*args) {
+		args = next_arg(args, &param, &val);
+
+		if (!val || !*val)
+			return -EINVAL;
+
+		if (!strcmp(param, "type")) {
+			if (!strcmp(val, "idle"))
+				mode = RECOMPRESS_IDLE;
+			else if (!strcmp(val, "huge"))
+				mode = RECOMPRESS_HUGE;
+			else if (!strcmp(val, "huge_idle"))
+				mode = RECOMPRESS_IDLE | RECOMPRESS_HUGE;
+			else
+				return -EINVAL;
+			continue;
+		}
+
+		if (!strcmp(param, "threshold")) {
+			/*
+			 * We will re-compress only objects equal or
+			 * greater in size than watermark.
+			 */
+			ret = kstrtouint(val, 10, &threshold);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		if (!strcmp(param, "max_pages")) {
+			ret = kstrtoull(val, 10, &max_pages);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		if (!strcmp(param, "algo")) {
+			algo = val;
+			continue;
+		}
+	}
 
-static ssize_t comp_algorithm_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
-{
-	size_t sz;
-	struct zram *zram = dev_to_zram(dev);
+	if (threshold >= PAGE_SIZE)
+		return -EINVAL;
 
 	down_read(&zram->init_lock);
-	sz = zcomp_available_show(zram->compressor, buf);
-	up_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
 
-	return sz;
-}
+	if (algo) {
+		bool found = false;
 
-static ssize_t comp_algorithm_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t len)
-{
-	struct zram *zram = dev_to_zram(dev);
-	char compressor[ARRAY_SIZE(zram->compressor)];
-	size_t sz;
+		for (; prio < ZRAM_MAX_COMPS; prio++) {
+			if (!zram->comp_algs[prio][0])
+				continue;
 
-	strlcpy(compressor, buf, sizeof(compressor));
-	/* ignore trailing newline */
-	sz = strlen(compressor);
-	if (sz > 0 && compressor[sz - 1] == '\n')
-		compressor[sz - 1] = 0x00;
+			if (!strcmp(zram->comp_algs[prio], algo)) {
+				prio_max = prio + 1;
+				found = true;
+				break;
+			}
+		}
 
-	if (!zcomp_available_algorithm(compressor))
-		return -EINVAL;
+		if (!found) {
+			ret = -EINVAL;
+			goto release_init_lock;
+		}
+	}
 
-	down_write(&zram->init_lock);
-	if (init_done(zram)) {
-		up_write(&zram->init_lock);
-		pr_info("Can't change algorithm for initialized device\n");
-		return -EBUSY;
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		ret = -ENOMEM;
+		goto release_init_lock;
 	}
 
-	strcpy(zram->compressor, compressor);
-	up_write(&zram->init_lock);
-	return len;
+	ret = len;
+	for (index = 0; index < nr_pages && max_pages; index++) {
+		int err = 0;
+
+		zram_slot_lock(zram, index);
+
+		if (!zram_allocated(zram, index))
+			goto next;
+
+		if (mode & RECOMPRESS_IDLE &&
+		    !zram_test_flag(zram, index, ZRAM_IDLE))
+			goto next;
+
+		if (mode & RECOMPRESS_HUGE &&
+		    !zram_test_flag(zram, index, ZRAM_HUGE))
+			goto next;
+
+		if (zram_test_flag(zram, index, ZRAM_WB) ||
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE))
+			goto next;
+
+		err = zram_recompress(zram, index, page, threshold,
+				      prio, prio_max);
+		max_pages--;
+next:
+		zram_slot_unlock(zram, index);
+		if (err) {
+			ret = err;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	__free_page(page);
+
+release_init_lock:
+	up_read(&zram->init_lock);
+	return ret;
 }
+#endif
 
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
@@ -1074,6 +2238,9 @@ static ssize_t mm_stat_show(struct device *dev,
 	u64 orig_size, mem_used = 0;
 	long max_used;
 	ssize_t ret;
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	u32 prio;
+#endif
 
 	memset(&pool_stats, 0x00, sizeof(struct zs_pool_stats));
 
@@ -1087,7 +2254,7 @@ static ssize_t mm_stat_show(struct device *dev,
 	max_used = atomic_long_read(&zram->stats.max_used_pages);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu\n",
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu",
 			orig_size << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.compr_data_size),
 			mem_used << PAGE_SHIFT,
@@ -1097,6 +2264,14 @@ static ssize_t mm_stat_show(struct device *dev,
 			atomic_long_read(&pool_stats.pages_compacted),
 			(u64)atomic64_read(&zram->stats.huge_pages),
 			(u64)atomic64_read(&zram->stats.huge_pages_since));
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	/* Per secondary algorithm: stored pages and their compressed size */
+	for (prio = ZRAM_SECONDARY_COMP; prio < ZRAM_MAX_COMPS; prio++)
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, " %8llu %8llu",
+			(u64)atomic64_read(&zram->stats.recomp_pages[prio]),
+			(u64)atomic64_read(&zram->stats.recomp_data_size[prio]));
+#endif
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, "\n");
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1112,10 +2287,17 @@ static ssize_t bd_stat_show(struct device *dev,
 
 	down_read(&zram->init_lock);
 	ret = scnprintf(buf, PAGE_SIZE,
-		"%8llu %8llu %8llu\n",
+		"%8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu\n",
 			FOUR_K((u64)atomic64_read(&zram->stats.bd_count)),
 			FOUR_K((u64)atomic64_read(&zram->stats.bd_reads)),
-			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)));
+			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)),
+			(u64)atomic64_read(&zram->stats.bd_wb_pages),
+			(u64)atomic64_read(&zram->stats.bd_wb_bytes),
+			(u64)atomic64_read(&zram->stats.bd_wb_scanned),
+			(u64)atomic64_read(&zram->stats.bd_wb_inflight),
+			(u64)atomic64_read(&zram->stats.bd_wb_kbps),
+			(u64)atomic64_read(&zram->stats.bd_ra_pages),
+			(u64)atomic64_read(&zram->stats.bd_ra_hits));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1135,6 +2317,22 @@ static ssize_t debug_stat_show(struct device *dev,
 			version,
 			(u64)atomic64_read(&zram->stats.writestall),
 			(u64)atomic64_read(&zram->stats.miss_free));
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+			"recompress: %8llu\n",
+			(u64)atomic64_read(&zram->stats.num_recompress));
+#endif
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+			"batch: %8llu\n",
+			(u64)atomic64_read(&zram->stats.batched_pages));
+#ifdef CONFIG_ZRAM_DEDUP
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+			"dedup: %8llu %8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.dedup_hits),
+			(u64)atomic64_read(&zram->stats.dedup_misses),
+			(u64)atomic64_read(&zram->stats.dup_data_size),
+			(u64)atomic64_read(&zram->stats.meta_data_size));
+#endif
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1156,6 +2354,7 @@ static void zram_meta_free(struct zram *zram, u64 disksize)
 	for (index = 0; index < num_pages; index++)
 		zram_free_page(zram, index);
 
+	zram_dedup_fini(zram);
 	zs_destroy_pool(zram->mem_pool);
 	vfree(zram->table);
 }
@@ -1175,6 +2374,12 @@ static bool zram_meta_alloc(struct zram *zram, u64 disksize)
 		return false;
 	}
 
+	if (zram_dedup_init(zram, num_pages)) {
+		zs_destroy_pool(zram->mem_pool);
+		vfree(zram->table);
+		return false;
+	}
+
 	if (!huge_class_size)
 		huge_class_size = zs_huge_class_size(zram->mem_pool);
 	return true;
@@ -1188,6 +2393,7 @@ static bool zram_meta_alloc(struct zram *zram, u64 disksize)
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	unsigned long handle;
+	u32 prio;
 
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	zram->table[index].ac_time = 0;
@@ -1200,9 +2406,26 @@ static void zram_free_page(struct zram *zram, size_t index)
 		atomic64_dec(&zram->stats.huge_pages);
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE))
+		zram_clear_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+
+	/*
+	 * Makes a pending readahead of the slot drop its copy. Both this and
+	 * the readahead's test and set happen under the slot lock.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_UNDER_RA))
+		zram_clear_flag(zram, index, ZRAM_UNDER_RA);
+
+	if (zram_test_flag(zram, index, ZRAM_READAHEAD))
+		zram_clear_flag(zram, index, ZRAM_READAHEAD);
+
+	prio = zram_get_priority(zram, index);
+	zram_set_priority(zram, index, 0);
+
 	if (zram_test_flag(zram, index, ZRAM_WB)) {
 		zram_clear_flag(zram, index, ZRAM_WB);
-		free_block_bdev(zram, zram_get_element(zram, index));
+		free_block_bdev(zram, zram_get_element(zram, index),
+				zram_get_obj_size(zram, index));
 		goto out;
 	}
 
@@ -1220,10 +2443,20 @@ static void zram_free_page(struct zram *zram, size_t index)
 	if (!handle)
 		return;
 
-	zs_free(zram->mem_pool, handle);
+	if (!zram_put_handle(zram, handle)) {
+		/* Other slots still share the object */
+		atomic64_sub(zram_get_obj_size(zram, index),
+				&zram->stats.dup_data_size);
+		goto out;
+	}
 
 	atomic64_sub(zram_get_obj_size(zram, index),
 			&zram->stats.compr_data_size);
+	if (prio != ZRAM_PRIMARY_COMP) {
+		atomic64_dec(&zram->stats.recomp_pages[prio]);
+		atomic64_sub(zram_get_obj_size(zram, index),
+				&zram->stats.recomp_data_size[prio]);
+	}
 out:
 	atomic64_dec(&zram->stats.pages_stored);
 	zram_set_handle(zram, index, 0);
@@ -1232,27 +2465,19 @@ static void zram_free_page(struct zram *zram, size_t index)
 		~(1UL << ZRAM_LOCK | 1UL << ZRAM_UNDER_WB));
 }
 
-static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
-				struct bio *bio, bool partial_io)
+/*
+ * Decompress the slot into @page. Caller should hold the slot lock and
+ * make sure the slot is not ZRAM_WB.
+ */
+static int __zram_read_from_zspool(struct zram *zram, struct page *page,
+				   u32 index)
 {
-	int ret;
+	struct zcomp_strm *zstrm;
 	unsigned long handle;
 	unsigned int size;
 	void *src, *dst;
-
-	zram_slot_lock(zram, index);
-	if (zram_test_flag(zram, index, ZRAM_WB)) {
-		struct bio_vec bvec;
-
-		zram_slot_unlock(zram, index);
-
-		bvec.bv_page = page;
-		bvec.bv_len = PAGE_SIZE;
-		bvec.bv_offset = 0;
-		return read_from_bdev(zram, &bvec,
-				zram_get_element(zram, index),
-				bio, partial_io);
-	}
+	u32 prio;
+	int ret;
 
 	handle = zram_get_handle(zram, index);
 	if (!handle || zram_test_flag(zram, index, ZRAM_SAME)) {
@@ -1263,10 +2488,10 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		mem = kmap_atomic(page);
 		zram_fill_page(mem, PAGE_SIZE, value);
 		kunmap_atomic(mem);
-		zram_slot_unlock(zram, index);
 		return 0;
 	}
 
+	handle = zram_entry_handle(zram, handle);
 	size = zram_get_obj_size(zram, index);
 
 	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
@@ -1276,14 +2501,41 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		kunmap_atomic(dst);
 		ret = 0;
 	} else {
-		struct zcomp_strm *zstrm = zcomp_stream_get(zram->comp);
-
+		prio = zram_get_priority(zram, index);
+		zstrm = zcomp_stream_get(zram->comps[prio]);
 		dst = kmap_atomic(page);
 		ret = zcomp_decompress(zstrm, src, size, dst);
 		kunmap_atomic(dst);
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(zram->comps[prio]);
 	}
 	zs_unmap_object(zram->mem_pool, handle);
+
+	return ret;
+}
+
+static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
+				struct bio *bio, bool partial_io)
+{
+	int ret;
+
+	zram_slot_lock(zram, index);
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long pos = zram_get_element(zram, index);
+		unsigned int size = zram_get_obj_size(zram, index);
+		u32 prio = zram_get_priority(zram, index);
+
+		zram_slot_unlock(zram, index);
+		return read_from_bdev(zram, page, index, pos, size, prio,
+				bio, partial_io);
+	}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_READAHEAD)) {
+		zram_clear_flag(zram, index, ZRAM_READAHEAD);
+		atomic64_inc(&zram->stats.bd_ra_hits);
+	}
+#endif
+	ret = __zram_read_from_zspool(zram, page, index);
 	zram_slot_unlock(zram, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
@@ -1338,6 +2590,8 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	struct page *page = bvec->bv_page;
 	unsigned long element = 0;
 	enum zram_pageflags flags = 0;
+	struct zram_entry *entry;
+	u32 checksum = 0;
 
 	mem = kmap_atomic(page);
 	if (page_same_filled(mem, &element)) {
@@ -1349,14 +2603,21 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	}
 	kunmap_atomic(mem);
 
+	entry = zram_dedup_find(zram, page, &checksum);
+	if (entry) {
+		comp_len = entry->len;
+		handle = (unsigned long)entry;
+		goto out;
+	}
+
 compress_again:
-	zstrm = zcomp_stream_get(zram->comp);
+	zstrm = zcomp_stream_get(zram->comps[ZRAM_PRIMARY_COMP]);
 	src = kmap_atomic(page);
 	ret = zcomp_compress(zstrm, src, &comp_len);
 	kunmap_atomic(src);
 
 	if (unlikely(ret)) {
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(zram->comps[ZRAM_PRIMARY_COMP]);
 		pr_err("Compression failed! err=%d\n", ret);
 		zs_free(zram->mem_pool, handle);
 		return ret;
@@ -1385,7 +2646,7 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 				__GFP_MOVABLE |
 				__GFP_CMA);
 	if (!handle) {
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(zram->comps[ZRAM_PRIMARY_COMP]);
 		atomic64_inc(&zram->stats.writestall);
 		handle = zs_malloc(zram->mem_pool, comp_len,
 				GFP_NOIO | __GFP_HIGHMEM |
@@ -1399,7 +2660,7 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	update_used_max(zram, alloced_pages);
 
 	if (zram->limit_pages && alloced_pages > zram->limit_pages) {
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(zram->comps[ZRAM_PRIMARY_COMP]);
 		zs_free(zram->mem_pool, handle);
 		return -ENOMEM;
 	}
@@ -1413,8 +2674,19 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	if (comp_len == PAGE_SIZE)
 		kunmap_atomic(src);
 
-	zcomp_stream_put(zram->comp);
+	zcomp_stream_put(zram->comps[ZRAM_PRIMARY_COMP]);
 	zs_unmap_object(zram->mem_pool, handle);
+
+	if (zram_dedup_enabled(zram)) {
+		entry = zram_dedup_alloc_entry(zram, handle, comp_len,
+				GFP_NOIO | __GFP_NOWARN);
+		if (!entry) {
+			zs_free(zram->mem_pool, handle);
+			return -ENOMEM;
+		}
+		zram_dedup_insert(zram, entry, checksum);
+		handle = (unsigned long)entry;
+	}
 	atomic64_add(comp_len, &zram->stats.compr_data_size);
 out:
 	/*
@@ -1563,6 +2835,238 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 	return ret;
 }
 
+/*
+ * Multi-page writes go through the batched path, which stores each
+ * segment as a whole page. Anything else, such as a bio that does not
+ * start on a page boundary or has a partial-page segment (e.g. a
+ * sector-aligned O_DIRECT write), is left to the per-page path. Dedup
+ * lookups are per page too.
+ */
+static bool zram_can_batch(struct zram *zram, struct bio *bio)
+{
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+
+	if (PAGE_SIZE != ZRAM_LOGICAL_BLOCK_SIZE ||
+	    !op_is_write(bio_op(bio)) ||
+	    bio->bi_iter.bi_size <= PAGE_SIZE ||
+	    zram_dedup_enabled(zram))
+		return false;
+
+	if (bio->bi_iter.bi_sector & (SECTORS_PER_PAGE - 1))
+		return false;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		if (bvec.bv_offset || bvec.bv_len != PAGE_SIZE)
+			return false;
+	}
+
+	return true;
+}
+
+struct zram_batch {
+	int nr;
+	u32 index[ZRAM_BATCH_PAGES];
+	struct page *page[ZRAM_BATCH_PAGES];
+};
+
+/*
+ * Compress and store the pages of @batch under a single stream
+ * acquisition, allocating all the objects with one zs_malloc_bulk()
+ * call. Returns -EAGAIN without storing anything if the allocation
+ * would need to reclaim; the caller then falls back to the per-page
+ * path, which knows how to do that.
+ */
+static int zram_write_batch(struct zram *zram, struct zram_batch *batch)
+{
+	struct zcomp *comp = zram->comps[ZRAM_PRIMARY_COMP];
+	unsigned int comp_len[ZRAM_BATCH_PAGES];
+	unsigned long element[ZRAM_BATCH_PAGES];
+	unsigned long handle[ZRAM_BATCH_PAGES];
+	unsigned long handles[ZRAM_BATCH_PAGES];
+	size_t sizes[ZRAM_BATCH_PAGES];
+	void *objs[ZRAM_BATCH_PAGES];
+	/* batch slots of the objects, sorted by compressed size */
+	int order[ZRAM_BATCH_PAGES];
+	unsigned long alloced_pages;
+	struct zcomp_strm *zstrm;
+	int i, j, nr_objs = 0;
+	size_t off = 0;
+	void *src, *dst;
+	int ret;
+
+	zstrm = zcomp_stream_get(comp);
+	for (i = 0; i < batch->nr; i++) {
+		src = kmap_atomic(batch->page[i]);
+		if (page_same_filled(src, &element[i])) {
+			kunmap_atomic(src);
+			comp_len[i] = 0;
+			continue;
+		}
+
+		ret = zcomp_compress(zstrm, src, &comp_len[i]);
+		kunmap_atomic(src);
+		if (unlikely(ret)) {
+			zcomp_stream_put(comp);
+			pr_err("Compression failed! err=%d\n", ret);
+			return ret;
+		}
+
+		if (comp_len[i] >= huge_class_size) {
+			/* stored as is, copied straight from the page */
+			comp_len[i] = PAGE_SIZE;
+			objs[i] = NULL;
+		} else {
+			objs[i] = zstrm->batch_buffer + off;
+			memcpy(objs[i], zstrm->buffer, comp_len[i]);
+			off += comp_len[i];
+		}
+
+		for (j = nr_objs; j > 0 && comp_len[order[j - 1]] > comp_len[i];
+				j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+		nr_objs++;
+	}
+
+	for (j = 0; j < nr_objs; j++)
+		sizes[j] = comp_len[order[j]];
+
+	if (nr_objs && zs_malloc_bulk(zram->mem_pool, sizes, handles, nr_objs,
+				__GFP_KSWAPD_RECLAIM |
+				__GFP_NOWARN |
+				__GFP_HIGHMEM |
+				__GFP_MOVABLE |
+				__GFP_CMA) < nr_objs) {
+		zcomp_stream_put(comp);
+		for (j = 0; j < nr_objs && handles[j]; j++)
+			zs_free(zram->mem_pool, handles[j]);
+		atomic64_inc(&zram->stats.writestall);
+		return -EAGAIN;
+	}
+
+	alloced_pages = zs_get_total_pages(zram->mem_pool);
+	update_used_max(zram, alloced_pages);
+
+	if (zram->limit_pages && alloced_pages > zram->limit_pages) {
+		zcomp_stream_put(comp);
+		for (j = 0; j < nr_objs; j++)
+			zs_free(zram->mem_pool, handles[j]);
+		return -ENOMEM;
+	}
+
+	for (j = 0; j < nr_objs; j++) {
+		i = order[j];
+		handle[i] = handles[j];
+
+		dst = zs_map_object(zram->mem_pool, handle[i], ZS_MM_WO);
+		if (objs[i]) {
+			memcpy(dst, objs[i], comp_len[i]);
+		} else {
+			src = kmap_atomic(batch->page[i]);
+			memcpy(dst, src, PAGE_SIZE);
+			kunmap_atomic(src);
+		}
+		zs_unmap_object(zram->mem_pool, handle[i]);
+	}
+	zcomp_stream_put(comp);
+
+	/* Publish the whole batch */
+	for (i = 0; i < batch->nr; i++) {
+		u32 index = batch->index[i];
+
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+
+		if (!comp_len[i]) {
+			zram_set_flag(zram, index, ZRAM_SAME);
+			zram_set_element(zram, index, element[i]);
+			atomic64_inc(&zram->stats.same_pages);
+		} else {
+			if (comp_len[i] == PAGE_SIZE) {
+				zram_set_flag(zram, index, ZRAM_HUGE);
+				atomic64_inc(&zram->stats.huge_pages);
+				atomic64_inc(&zram->stats.huge_pages_since);
+			}
+			zram_set_handle(zram, index, handle[i]);
+			zram_set_obj_size(zram, index, comp_len[i]);
+			atomic64_add(comp_len[i],
+					&zram->stats.compr_data_size);
+		}
+		zram_accessed(zram, index);
+		zram_slot_unlock(zram, index);
+	}
+
+	atomic64_add(batch->nr, &zram->stats.pages_stored);
+	atomic64_add(batch->nr, &zram->stats.batched_pages);
+	return 0;
+}
+
+static int zram_flush_batch(struct zram *zram, struct zram_batch *batch,
+				struct bio *bio)
+{
+	unsigned long start_time = jiffies;
+	struct request_queue *q = zram->disk->queue;
+	int i, ret;
+
+	if (!batch->nr)
+		return 0;
+
+	generic_start_io_acct(q, REQ_OP_WRITE,
+			batch->nr << SECTORS_PER_PAGE_SHIFT,
+			&zram->disk->part0);
+	atomic64_add(batch->nr, &zram->stats.num_writes);
+
+	ret = zram_write_batch(zram, batch);
+	if (ret == -EAGAIN) {
+		for (i = 0; i < batch->nr; i++) {
+			struct bio_vec bv = {
+				.bv_page = batch->page[i],
+				.bv_len = PAGE_SIZE,
+				.bv_offset = 0,
+			};
+
+			ret = zram_bvec_write(zram, &bv, batch->index[i], 0,
+					bio);
+			if (ret < 0)
+				break;
+
+			zram_slot_lock(zram, batch->index[i]);
+			zram_accessed(zram, batch->index[i]);
+			zram_slot_unlock(zram, batch->index[i]);
+		}
+	}
+
+	generic_end_io_acct(q, REQ_OP_WRITE, &zram->disk->part0, start_time);
+	if (unlikely(ret < 0))
+		atomic64_inc(&zram->stats.failed_writes);
+
+	batch->nr = 0;
+	return ret;
+}
+
+static int zram_bio_write_batch(struct zram *zram, struct bio *bio, u32 index)
+{
+	struct zram_batch batch;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	int ret;
+
+	batch.nr = 0;
+	bio_for_each_segment(bvec, bio, iter) {
+		batch.index[batch.nr] = index++;
+		batch.page[batch.nr] = bvec.bv_page;
+		if (++batch.nr < ZRAM_BATCH_PAGES)
+			continue;
+
+		ret = zram_flush_batch(zram, &batch, bio);
+		if (ret < 0)
+			return ret;
+	}
+
+	return zram_flush_batch(zram, &batch, bio);
+}
+
 static void __zram_make_request(struct zram *zram, struct bio *bio)
 {
 	int offset;
@@ -1584,6 +3088,13 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 		break;
 	}
 
+	if (zram_can_batch(zram, bio)) {
+		if (zram_bio_write_batch(zram, bio, index) < 0)
+			goto out;
+		bio_endio(bio);
+		return;
+	}
+
 	bio_for_each_segment(bvec, bio, iter) {
 		struct bio_vec bv = bvec;
 		unsigned int unwritten = bvec.bv_len;
@@ -1698,9 +3209,23 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	return ret;
 }
 
+static void zram_destroy_comps(struct zram *zram)
+{
+	u32 prio;
+
+	for (prio = 0; prio < ZRAM_MAX_COMPS; prio++) {
+		struct zcomp *comp = zram->comps[prio];
+
+		zram->comps[prio] = NULL;
+		if (!comp)
+			continue;
+		zcomp_destroy(comp);
+		zram->num_active_comps--;
+	}
+}
+
 static void zram_reset_device(struct zram *zram)
 {
-	struct zcomp *comp;
 	u64 disksize;
 
 	down_write(&zram->init_lock);
@@ -1712,7 +3237,6 @@ static void zram_reset_device(struct zram *zram)
 		return;
 	}
 
-	comp = zram->comp;
 	disksize = zram->disksize;
 	zram->disksize = 0;
 
@@ -1723,7 +3247,7 @@ static void zram_reset_device(struct zram *zram)
 	/* I/O operation under all of CPU are done so let's free */
 	zram_meta_free(zram, disksize);
 	memset(&zram->stats, 0, sizeof(zram->stats));
-	zcomp_destroy(comp);
+	zram_destroy_comps(zram);
 	reset_bdev(zram);
 }
 
@@ -1734,6 +3258,7 @@ static ssize_t disksize_store(struct device *dev,
 	struct zcomp *comp;
 	struct zram *zram = dev_to_zram(dev);
 	int err;
+	u32 prio;
 
 	disksize = memparse(buf, NULL);
 	if (!disksize)
@@ -1752,15 +3277,23 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_unlock;
 	}
 
-	comp = zcomp_create(zram->compressor);
-	if (IS_ERR(comp)) {
-		pr_err("Cannot initialise %s compressing backend\n",
-				zram->compressor);
-		err = PTR_ERR(comp);
-		goto out_free_meta;
+	for (prio = 0; prio < ZRAM_MAX_COMPS; prio++) {
+		if (!zram->comp_algs[prio][0])
+			continue;
+
+		comp = zcomp_create(zram->comp_algs[prio],
+				prio == ZRAM_PRIMARY_COMP ? ZRAM_BATCH_PAGES : 0);
+		if (IS_ERR(comp)) {
+			pr_err("Cannot initialise %s compressing backend\n",
+					zram->comp_algs[prio]);
+			err = PTR_ERR(comp);
+			goto out_free_comps;
+		}
+
+		zram->comps[prio] = comp;
+		zram->num_active_comps++;
 	}
 
-	zram->comp = comp;
 	zram->disksize = disksize;
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
@@ -1769,7 +3302,8 @@ static ssize_t disksize_store(struct device *dev,
 
 	return len;
 
-out_free_meta:
+out_free_comps:
+	zram_destroy_comps(zram);
 	zram_meta_free(zram, disksize);
 out_unlock:
 	up_write(&zram->init_lock);
@@ -1852,11 +3386,19 @@ static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_WO(idle);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+#ifdef CONFIG_ZRAM_DEDUP
+static DEVICE_ATTR_RW(use_dedup);
+#endif
+#ifdef CONFIG_ZRAM_MULTI_COMP
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(recompress);
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
 static DEVICE_ATTR_WO(writeback);
 static DEVICE_ATTR_RW(writeback_limit);
 static DEVICE_ATTR_RW(writeback_limit_enable);
+static DEVICE_ATTR_RW(writeback_readahead);
 #endif
 
 static struct attribute *zram_disk_attrs[] = {
@@ -1869,11 +3411,19 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_idle.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+#ifdef CONFIG_ZRAM_DEDUP
+	&dev_attr_use_dedup.attr,
+#endif
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recompress.attr,
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
 	&dev_attr_writeback.attr,
 	&dev_attr_writeback_limit.attr,
 	&dev_attr_writeback_limit_enable.attr,
+	&dev_attr_writeback_readahead.attr,
 #endif
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
@@ -1915,6 +3465,7 @@ static int zram_add(void)
 	init_rwsem(&zram->init_lock);
 #ifdef CONFIG_ZRAM_WRITEBACK
 	spin_lock_init(&zram->wb_limit_lock);
+	spin_lock_init(&zram->bitmap_lock);
 #endif
 	queue = blk_alloc_queue(GFP_KERNEL);
 	if (!queue) {
@@ -1978,7 +3529,8 @@ static int zram_add(void)
 	disk_to_dev(zram->disk)->groups = zram_disk_attr_groups;
 	add_disk(zram->disk);
 
-	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
+	strlcpy(zram->comp_algs[ZRAM_PRIMARY_COMP], default_compressor,
+		sizeof(zram->comp_algs[ZRAM_PRIMARY_COMP]));
 
 	zram_debugfs_register(zram);
 	pr_info("Added device: %s\n", zram->disk->disk_name);
@@ -16,10 +16,13 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/rwsem.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
 
 #include "zcomp.h"
+#include "zram_dedup.h"
 
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
@@ -37,9 +40,14 @@
  * zram is mainly used for memory efficiency so we want to keep memory
  * footprint small so we can squeeze size and flags into a field.
  * The lower ZRAM_FLAG_SHIFT bits is for object size (excluding header),
- * the higher bits is for zram_pageflags.
+ * the higher bits is for zram_pageflags. The object size never exceeds
+ * PAGE_SIZE, so PAGE_SHIFT + 1 bits are enough to hold it and leave
+ * room for the flags even with 32-bit table.flags.
  */
-#define ZRAM_FLAG_SHIFT 24
+#define ZRAM_FLAG_SHIFT (PAGE_SHIFT + 1)
+
+/* Only 2 bits are allowed for comp priority index */
+#define ZRAM_COMP_PRIORITY_MASK	0x3
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
@@ -50,10 +58,36 @@ enum zram_pageflags {
 	ZRAM_UNDER_WB,	/* page is under writeback */
 	ZRAM_HUGE,	/* Incompressible page */
 	ZRAM_IDLE,	/* not accessed page since last idle marking */
+	ZRAM_INCOMPRESSIBLE, /* none of the algorithms could compress it */
+	ZRAM_COMP_PRIORITY_BIT1, /* First bit of comp priority index */
+	ZRAM_COMP_PRIORITY_BIT2, /* Second bit of comp priority index */
+	ZRAM_UNDER_RA,	/* backing device copy is being read ahead */
+	ZRAM_READAHEAD,	/* brought back by readahead, not read since */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+#ifdef CONFIG_ZRAM_MULTI_COMP
+#define ZRAM_MAX_COMPS	4
+#else
+#define ZRAM_MAX_COMPS	1
+#endif
+
+/* Max pages of a write bio compressed under one stream acquisition */
+#define ZRAM_BATCH_PAGES	8
+
+/* Max pages of backing device written by one writeback bio */
+#define ZRAM_WB_BATCH_PAGES	32
+/* Max objects packed into one writeback bio */
+#define ZRAM_WB_BATCH_SLOTS	(ZRAM_WB_BATCH_PAGES * 8)
+/* Max writeback bios in flight per writeback request */
+#define ZRAM_WB_MAX_INFLIGHT	16
+/* Max neighbouring slots read ahead with a written back slot */
+#define ZRAM_WB_RA_MAX		16
+
+#define ZRAM_PRIMARY_COMP	0U
+#define ZRAM_SECONDARY_COMP	1U
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
@@ -68,6 +102,24 @@ struct zram_table_entry {
 #endif
 };
 
+/*
+ * With dedup enabled, table.handle points to one of these instead of
+ * holding the zsmalloc handle directly, so that identical pages can
+ * share a single compressed object.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 len;
+	u32 checksum;
+	unsigned long refcount;
+	unsigned long handle;
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
 struct zram_stats {
 	atomic64_t compr_data_size;	/* compressed size of pages stored */
 	atomic64_t num_reads;	/* failed + successful */
@@ -87,13 +139,30 @@ struct zram_stats {
 	atomic64_t bd_count;		/* no. of pages in backing device */
 	atomic64_t bd_reads;		/* no. of reads from backing device */
 	atomic64_t bd_writes;		/* no. of writes from backing device */
+	atomic64_t bd_wb_pages;		/* no. of slots written back */
+	atomic64_t bd_wb_bytes;		/* compressed bytes written back */
+	atomic64_t bd_wb_scanned;	/* slots scanned by last writeback */
+	atomic64_t bd_wb_inflight;	/* writeback bios in flight */
+	atomic64_t bd_wb_kbps;		/* throughput of last writeback */
+	atomic64_t bd_ra_pages;		/* no. of slots read ahead */
+	atomic64_t bd_ra_hits;		/* no. of read ahead slots used */
 #endif
+	/* no. of pages currently stored by each secondary algorithm */
+	atomic64_t recomp_pages[ZRAM_MAX_COMPS];
+	/* compressed size of pages stored by each secondary algorithm */
+	atomic64_t recomp_data_size[ZRAM_MAX_COMPS];
+	atomic64_t num_recompress;	/* no. of recompression attempts */
+	atomic64_t dedup_hits;		/* no. of writes found a duplicate */
+	atomic64_t dedup_misses;	/* no. of writes found no duplicate */
+	atomic64_t dup_data_size;	/* compressed size saved by dedup */
+	atomic64_t meta_data_size;	/* size of zram_entries */
+	atomic64_t batched_pages;	/* no. of pages stored in batches */
 };
 
 struct zram {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
-	struct zcomp *comp;
+	struct zcomp *comps[ZRAM_MAX_COMPS];
 	struct gendisk *disk;
 	/* Prevent concurrent execution of device init */
 	struct rw_semaphore init_lock;
@@ -108,7 +177,12 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
-	char compressor[CRYPTO_MAX_ALG_NAME];
+	/*
+	 * comp_algs[ZRAM_PRIMARY_COMP] is used for every store; secondary
+	 * algorithms (if any) are only used by recompression.
+	 */
+	char comp_algs[ZRAM_MAX_COMPS][CRYPTO_MAX_ALG_NAME];
+	u32 num_active_comps;
 	/*
 	 * zram is claimed so open request will be failed
 	 */
@@ -121,10 +195,33 @@ struct zram {
 	struct block_device *bdev;
 	unsigned int old_block_size;
 	unsigned long *bitmap;
+	/*
+	 * Written back objects are packed, so a block can hold several of
+	 * them. blk_refs counts the objects overlapping each block; the
+	 * block is released once it drops to zero.
+	 */
+	u16 *blk_refs;
+	spinlock_t bitmap_lock;
 	unsigned long nr_pages;
+	/* no. of following slots to read ahead with a ZRAM_WB slot */
+	u32 wb_readahead;
 #endif
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	struct dentry *debugfs_dir;
 #endif
+#ifdef CONFIG_ZRAM_DEDUP
+	bool use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;
+#endif
 };
+
+static inline bool zram_dedup_enabled(struct zram *zram)
+{
+#ifdef CONFIG_ZRAM_DEDUP
+	return zram->use_dedup;
+#else
+	return false;
+#endif
+}
 #endif
@@ -59,6 +59,8 @@ static struct target_type android_verity_target = {
 	.ctr                    = android_verity_ctr,
 	.dtr                    = verity_dtr,
 	.map                    = verity_map,
+	.postsuspend            = verity_postsuspend,
+	.resume                 = verity_resume,
 	.status                 = verity_status,
 	.prepare_ioctl          = verity_prepare_ioctl,
 	.iterate_devices        = verity_iterate_devices,
@@ -18,6 +18,7 @@
 #include <linux/module.h>
 #include <linux/rbtree.h>
 #include <linux/stacktrace.h>
+#include <linux/jump_label.h>
 
 #define DM_MSG_PREFIX "bufio"
 
@@ -81,6 +82,8 @@
  */
 struct dm_bufio_client {
 	struct mutex lock;
+	spinlock_t spinlock;
+	bool no_sleep;
 
 	struct list_head lru[LIST_SIZE];
 	unsigned long n_buffers[LIST_SIZE];
@@ -162,19 +165,45 @@ struct dm_buffer {
 
 #define dm_bufio_in_request()	(!!current->bio_list)
 
+static DEFINE_STATIC_KEY_FALSE(no_sleep_enabled);
+
+static inline bool dm_bufio_no_sleep(struct dm_bufio_client *c)
+{
+	return static_branch_unlikely(&no_sleep_enabled) && c->no_sleep;
+}
+
 static void dm_bufio_lock(struct dm_bufio_client *c)
 {
-	mutex_lock_nested(&c->lock, dm_bufio_in_request());
+	if (dm_bufio_no_sleep(c))
+		spin_lock_bh(&c->spinlock);
+	else
+		mutex_lock_nested(&c->lock, dm_bufio_in_request());
 }
 
 static int dm_bufio_trylock(struct dm_bufio_client *c)
 {
+	if (dm_bufio_no_sleep(c))
+		return spin_trylock_bh(&c->spinlock);
+
 	return mutex_trylock(&c->lock);
 }
 
 static void dm_bufio_unlock(struct dm_bufio_client *c)
 {
-	mutex_unlock(&c->lock);
+	if (dm_bufio_no_sleep(c))
+		spin_unlock_bh(&c->spinlock);
+	else
+		mutex_unlock(&c->lock);
+}
+
+/*
+ * Used in loops that run with the client lock held, which is a spinlock
+ * for DM_BUFIO_CLIENT_NO_SLEEP clients.
+ */
+static void dm_bufio_cond_resched(struct dm_bufio_client *c)
+{
+	if (!dm_bufio_no_sleep(c))
+		cond_resched();
 }
 
 /*----------------------------------------------------------------*/
@@ -760,35 +789,79 @@ static void __make_buffer_clean(struct dm_buffer *b)
 	wait_on_bit_io(&b->state, B_WRITING, TASK_UNINTERRUPTIBLE);
 }
 
+/*
+ * __make_buffer_clean() for DM_BUFIO_CLIENT_NO_SLEEP clients, whose lock is
+ * a spinlock: pin the buffer and drop the lock while writing it and
+ * waiting for its I/O.  The caller must look the buffer up again, as the
+ * lists may have changed meanwhile.
+ */
+static void __make_buffer_clean_unlocked(struct dm_buffer *b)
+{
+	struct dm_bufio_client *c = b->c;
+	LIST_HEAD(write_list);
+
+	b->hold_count++;
+	if (test_bit(B_DIRTY, &b->state) && !test_bit(B_WRITING, &b->state))
+		__write_dirty_buffer(b, &write_list);
+	dm_bufio_unlock(c);
+
+	__flush_write_list(&write_list);
+	wait_on_bit_io(&b->state, B_READING, TASK_UNINTERRUPTIBLE);
+	wait_on_bit_io(&b->state, B_WRITING, TASK_UNINTERRUPTIBLE);
+
+	dm_bufio_lock(c);
+	b->hold_count--;
+}
+
 /*
  * Find some buffer that is not held by anybody, clean it, unlink it and
  * return it.
+ *
+ * Buffers of DM_BUFIO_CLIENT_NO_SLEEP clients with I/O pending or dirty
+ * data are skipped, as they can't be waited for under the spinlock.  If
+ * nothing else is free, the first of them is waited for with the lock
+ * dropped and the search starts over.
  */
 static struct dm_buffer *__get_unclaimed_buffer(struct dm_bufio_client *c)
 {
-	struct dm_buffer *b;
+	struct dm_buffer *b, *busy;
 
+retry:
+	busy = NULL;
 	list_for_each_entry_reverse(b, &c->lru[LIST_CLEAN], lru_list) {
 		BUG_ON(test_bit(B_WRITING, &b->state));
 		BUG_ON(test_bit(B_DIRTY, &b->state));
 
 		if (!b->hold_count) {
+			if (dm_bufio_no_sleep(c) && b->state) {
+				busy = busy ? : b;
+				continue;
+			}
 			__make_buffer_clean(b);
 			__unlink_buffer(b);
 			return b;
 		}
-		cond_resched();
+		dm_bufio_cond_resched(c);
 	}
 
 	list_for_each_entry_reverse(b, &c->lru[LIST_DIRTY], lru_list) {
 		BUG_ON(test_bit(B_READING, &b->state));
 
 		if (!b->hold_count) {
+			if (dm_bufio_no_sleep(c) && b->state) {
+				busy = busy ? : b;
+				continue;
+			}
 			__make_buffer_clean(b);
 			__unlink_buffer(b);
 			return b;
 		}
-		cond_resched();
+		dm_bufio_cond_resched(c);
+	}
+
+	if (busy) {
+		__make_buffer_clean_unlocked(busy);
+		goto retry;
 	}
 
 	return NULL;
@@ -931,7 +1004,7 @@ static void __write_dirty_buffers_async(struct dm_bufio_client *c, int no_wait,
 			return;
 
 		__write_dirty_buffer(b, write_list);
-		cond_resched();
+		dm_bufio_cond_resched(c);
 	}
 }
 
@@ -1011,6 +1084,13 @@ static struct dm_buffer *__bufio_new(struct dm_bufio_client *c, sector_t block,
 	if (nf == NF_GET && unlikely(test_bit(B_READING, &b->state)))
 		return NULL;
 
+	/*
+	 * Releasing a buffer that failed to read frees it, which cannot be
+	 * done from the atomic context no-sleep clients may call us in.
+	 */
+	if (nf == NF_GET && dm_bufio_no_sleep(c) && unlikely(b->read_error))
+		return NULL;
+
 	b->hold_count++;
 	__relink_lru(b, test_bit(B_DIRTY, &b->state) ||
 		     test_bit(B_WRITING, &b->state));
@@ -1064,7 +1144,8 @@ static void *new_read(struct dm_bufio_client *c, sector_t block,
 	if (need_submit)
 		submit_io(b, REQ_OP_READ, read_endio);
 
-	wait_on_bit_io(&b->state, B_READING, TASK_UNINTERRUPTIBLE);
+	if (nf != NF_GET)	/* NF_GET never returns a reading buffer */
+		wait_on_bit_io(&b->state, B_READING, TASK_UNINTERRUPTIBLE);
 
 	if (b->read_error) {
 		int error = blk_status_to_errno(b->read_error);
@@ -1274,7 +1355,7 @@ int dm_bufio_write_dirty_buffers(struct dm_bufio_client *c)
 		    !test_bit(B_WRITING, &b->state))
 			__relink_lru(b, LIST_CLEAN);
 
-		cond_resched();
+		dm_bufio_cond_resched(c);
 
 		/*
 		 * If we dropped the lock, the list is no longer consistent,
@@ -1358,6 +1439,11 @@ void dm_bufio_release_move(struct dm_buffer *b, sector_t new_block)
 			goto retry;
 		}
 
+		if (dm_bufio_no_sleep(c) && new->state) {
+			__make_buffer_clean_unlocked(new);
+			goto retry;
+		}
+
 		/*
 		 * FIXME: Is there any point waiting for a write that's going
 		 * to be overwritten in a bit?
@@ -1535,7 +1621,8 @@ static void drop_buffers(struct dm_bufio_client *c)
  */
 static bool __try_evict_buffer(struct dm_buffer *b, gfp_t gfp)
 {
-	if (!(gfp & __GFP_FS)) {
+	/* DM_BUFIO_CLIENT_NO_SLEEP clients hold a spinlock, never wait */
+	if (!(gfp & __GFP_FS) || dm_bufio_no_sleep(b->c)) {
 		if (test_bit(B_READING, &b->state) ||
 		    test_bit(B_WRITING, &b->state) ||
 		    test_bit(B_DIRTY, &b->state))
@@ -1578,7 +1665,7 @@ static unsigned long __scan(struct dm_bufio_client *c, unsigned long nr_to_scan,
 				freed++;
 			if (!--nr_to_scan || ((count - freed) <= retain_target))
 				return freed;
-			cond_resched();
+			dm_bufio_cond_resched(c);
 		}
 	}
 	return freed;
@@ -1618,7 +1705,8 @@ dm_bufio_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
 struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsigned block_size,
 					       unsigned reserved_buffers, unsigned aux_size,
 					       void (*alloc_callback)(struct dm_buffer *),
-					       void (*write_callback)(struct dm_buffer *))
+					       void (*write_callback)(struct dm_buffer *),
+					       unsigned int flags)
 {
 	int r;
 	struct dm_bufio_client *c;
@@ -1653,7 +1741,13 @@ struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsign
 		c->n_buffers[i] = 0;
 	}
 
+	if (flags & DM_BUFIO_CLIENT_NO_SLEEP) {
+		c->no_sleep = true;
+		static_branch_inc(&no_sleep_enabled);
+	}
+
 	mutex_init(&c->lock);
+	spin_lock_init(&c->spinlock);
 	INIT_LIST_HEAD(&c->reserved_buffers);
 	c->need_reserved_buffers = reserved_buffers;
 
@@ -1728,6 +1822,8 @@ struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsign
 	dm_io_client_destroy(c->dm_io);
 bad_dm_io:
 	mutex_destroy(&c->lock);
+	if (c->no_sleep)
+		static_branch_dec(&no_sleep_enabled);
 	kfree(c);
 bad_client:
 	return ERR_PTR(r);
@@ -1775,6 +1871,8 @@ void dm_bufio_client_destroy(struct dm_bufio_client *c)
 	kmem_cache_destroy(c->slab_buffer);
 	dm_io_client_destroy(c->dm_io);
 	mutex_destroy(&c->lock);
+	if (c->no_sleep)
+		static_branch_dec(&no_sleep_enabled);
 	kfree(c);
 }
 EXPORT_SYMBOL_GPL(dm_bufio_client_destroy);
@@ -1827,7 +1925,7 @@ static void __evict_old_buffers(struct dm_bufio_client *c, unsigned long age_hz)
 		if (__try_evict_buffer(b, 0))
 			count--;
 
-		cond_resched();
+		dm_bufio_cond_resched(c);
 	}
 
 	dm_bufio_unlock(c);
@@ -8,18 +8,26 @@
 #include <uapi/linux/dm-user.h>
 
 #include <linux/bio.h>
+#include <linux/bitmap.h>
+#include <linux/highmem.h>
 #include <linux/init.h>
 #include <linux/mempool.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/poll.h>
 #include <linux/uio.h>
+#include <linux/vmalloc.h>
 #include <linux/wait.h>
 
 #define DM_MSG_PREFIX "user"
 
 #define MAX_OUTSTANDING_MESSAGES 128
 
+#define RING_MAX_ENTRIES 4096
+#define RING_MIN_ARENA_SIZE (BIO_MAX_PAGES * PAGE_SIZE)
+#define RING_MAX_ARENA_SIZE (64 << 20)
+
 /*
  * dm-user uses four structures:
  *
@@ -48,6 +56,11 @@
  *  - dev_write(), which looks up a message (keyed by sequence number) and
  *    completes the corresponding BIO.
  *
+ * Channels that have been switched to the ring transport replace the last two
+ * with ring_enter(), which does both for a batch of messages at a time.  The
+ * rings and the data arena are a single vmalloc() area that is mapped into
+ * the daemon, see "struct ring".
+ *
  * Lock ordering (outer to inner)
  *
  * 1) miscdevice's global lock.  This is held around dev_open, so it has to be
@@ -80,6 +93,13 @@ struct message {
 	 */
 	u64 return_type;
 	u64 return_flags;
+
+	/*
+	 * Pages of the ring's data arena holding the payload, only used by
+	 * channels on the ring transport.
+	 */
+	unsigned long arena_page;
+	unsigned long arena_nr_pages;
 };
 
 struct target {
@@ -170,6 +190,37 @@ struct channel {
 	 * only ever be pointer to by from_user_cur, and will never have a BIO.
 	 */
 	struct message scratch_message_from_user;
+
+	/*
+	 * Set up by DM_USER_IOC_SETUP_RING, after which messages are exchanged
+	 * through the ring rather than read() and write().  Messages handed to
+	 * the daemon are kept on from_user as above.
+	 */
+	struct ring *ring;
+};
+
+/*
+ * The ring transport.  Everything here is protected by the channel lock,
+ * except of course for the mapping shared with userspace: the kernel keeps
+ * its own copy of the indices it owns, and every value read back from the
+ * mapping is checked before use.
+ */
+struct ring {
+	void *base;
+	size_t size;
+
+	struct dm_user_ring_header *hdr;
+	struct dm_user_sqe *sqes;
+	struct dm_user_cqe *cqes;
+	void *arena;
+	u32 sq_entries;
+	u32 cq_entries;
+	u32 sq_tail;
+	u32 cq_head;
+
+	/* One bit per arena page, set while the page holds a payload. */
+	unsigned long *arena_map;
+	unsigned long arena_pages;
 };
 
 static inline struct target *target_from_target(struct dm_target *target)
@@ -477,6 +528,40 @@ static ssize_t msg_copy_from_iov(struct message *msg, struct iov_iter *from)
 	return copied;
 }
 
+static inline bool msg_has_payload(struct message *msg)
+{
+	return msg->msg.type == DM_USER_REQ_MAP_READ ||
+	       msg->msg.type == DM_USER_REQ_MAP_WRITE;
+}
+
+static void bio_copy_to_arena(struct bio *bio, void *dst)
+{
+	struct bio_vec bvec;
+	struct bvec_iter biter;
+
+	bio_for_each_segment (bvec, bio, biter) {
+		void *src = kmap_atomic(bvec.bv_page);
+
+		memcpy(dst, src + bvec.bv_offset, bvec.bv_len);
+		kunmap_atomic(src);
+		dst += bvec.bv_len;
+	}
+}
+
+static void bio_copy_from_arena(struct bio *bio, const void *src)
+{
+	struct bio_vec bvec;
+	struct bvec_iter biter;
+
+	bio_for_each_segment (bvec, bio, biter) {
+		void *dst = kmap_atomic(bvec.bv_page);
+
+		memcpy(dst + bvec.bv_offset, src, bvec.bv_len);
+		kunmap_atomic(dst);
+		src += bvec.bv_len;
+	}
+}
+
 static struct message *msg_get_map(struct target *t)
 {
 	struct message *m;
@@ -575,6 +660,13 @@ static void target_put(struct target *t)
 		mutex_unlock(&t->lock);
 }
 
+static void ring_free(struct ring *r)
+{
+	bitmap_free(r->arena_map);
+	vfree(r->base);
+	kfree(r);
+}
+
 static struct channel *channel_alloc(struct target *t)
 {
 	struct channel *c;
@@ -620,6 +712,9 @@ static void channel_free(struct channel *c)
 		message_kill(list_entry(cur, struct message, from_user),
 			     &c->target->message_pool);
 
+	if (c->ring != NULL)
+		ring_free(c->ring);
+
 	mutex_lock(&c->target->lock);
 	target_put(c->target);
 	mutex_unlock(&c->lock);
@@ -665,6 +760,11 @@ static ssize_t dev_read(struct kiocb *iocb, struct iov_iter *to)
 
 	mutex_lock(&c->lock);
 
+	if (unlikely(c->ring != NULL)) {
+		total_processed = -EINVAL;
+		goto cleanup_unlock;
+	}
+
 	if (unlikely(c->to_user_error)) {
 		total_processed = c->to_user_error;
 		goto cleanup_unlock;
@@ -760,6 +860,11 @@ static ssize_t dev_write(struct kiocb *iocb, struct iov_iter *from)
 
 	mutex_lock(&c->lock);
 
+	if (unlikely(c->ring != NULL)) {
+		total_processed = -EINVAL;
+		goto cleanup_unlock;
+	}
+
 	if (unlikely(c->from_user_error)) {
 		total_processed = c->from_user_error;
 		goto cleanup_unlock;
@@ -876,6 +981,296 @@ static int dev_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static int ring_setup(struct channel *c,
+		      struct dm_user_ring_params __user *uparams)
+{
+	struct dm_user_ring_params params;
+	struct ring *r;
+	size_t sq_size, cq_size;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+
+	if (!is_power_of_2(params.sq_entries) ||
+	    params.sq_entries > RING_MAX_ENTRIES ||
+	    !is_power_of_2(params.cq_entries) ||
+	    params.cq_entries > RING_MAX_ENTRIES ||
+	    params.arena_size < RING_MIN_ARENA_SIZE ||
+	    params.arena_size > RING_MAX_ARENA_SIZE ||
+	    !PAGE_ALIGNED(params.arena_size))
+		return -EINVAL;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (r == NULL)
+		return -ENOMEM;
+
+	sq_size = PAGE_ALIGN(params.sq_entries * sizeof(struct dm_user_sqe));
+	cq_size = PAGE_ALIGN(params.cq_entries * sizeof(struct dm_user_cqe));
+	r->size = PAGE_SIZE + sq_size + cq_size + params.arena_size;
+	r->arena_pages = params.arena_size >> PAGE_SHIFT;
+
+	r->base = vmalloc_user(r->size);
+	r->arena_map = bitmap_zalloc(r->arena_pages, GFP_KERNEL);
+	if (r->base == NULL || r->arena_map == NULL) {
+		ring_free(r);
+		return -ENOMEM;
+	}
+
+	r->hdr = r->base;
+	r->sqes = r->base + PAGE_SIZE;
+	r->cqes = r->base + PAGE_SIZE + sq_size;
+	r->arena = r->base + PAGE_SIZE + sq_size + cq_size;
+	r->sq_entries = params.sq_entries;
+	r->cq_entries = params.cq_entries;
+
+	r->hdr->magic = DM_USER_RING_MAGIC;
+	r->hdr->version = DM_USER_RING_VERSION;
+	r->hdr->sq_entries = params.sq_entries;
+	r->hdr->cq_entries = params.cq_entries;
+	r->hdr->sq_offset = PAGE_SIZE;
+	r->hdr->cq_offset = PAGE_SIZE + sq_size;
+	r->hdr->arena_offset = PAGE_SIZE + sq_size + cq_size;
+	r->hdr->arena_size = params.arena_size;
+
+	/*
+	 * Messages that have already gone through read() can't be moved to
+	 * the ring, so only a channel that has never been used can switch.
+	 */
+	mutex_lock(&c->lock);
+	if (c->ring != NULL || c->cur_to_user != NULL ||
+	    !list_empty(&c->from_user) ||
+	    c->cur_from_user->posn_from_user != 0) {
+		mutex_unlock(&c->lock);
+		ring_free(r);
+		return -EBUSY;
+	}
+	c->ring = r;
+	mutex_unlock(&c->lock);
+
+	return put_user(r->size, &uparams->ring_size);
+}
+
+static int dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct channel *c = channel_from_file(file);
+	int err;
+
+	mutex_lock(&c->lock);
+	if (c->ring == NULL)
+		err = -ENODEV;
+	else if (vma->vm_pgoff || !(vma->vm_flags & VM_SHARED) ||
+		 vma->vm_end - vma->vm_start != c->ring->size)
+		err = -EINVAL;
+	else
+		err = remap_vmalloc_range(vma, c->ring->base, 0);
+	mutex_unlock(&c->lock);
+
+	return err;
+}
+
+/*
+ * Completes the messages userspace has posted to the CQ.
+ */
+static int ring_reap(struct channel *c, struct ring *r)
+{
+	struct target *t = target_from_channel(c);
+	u32 head = r->cq_head;
+	u32 tail;
+	int err = 0;
+
+	lockdep_assert_held(&c->lock);
+
+	/* Pairs with the release of cq_tail by userspace */
+	tail = smp_load_acquire(&r->hdr->cq_tail);
+	if (unlikely(tail - head > r->cq_entries))
+		return -EINVAL;
+
+	while (head != tail) {
+		struct dm_user_cqe *cqe = &r->cqes[head & (r->cq_entries - 1)];
+		u64 seq = READ_ONCE(cqe->seq);
+		u64 type = READ_ONCE(cqe->type);
+		struct message *m;
+
+		m = msg_get_from_user(c, seq);
+		if (m == NULL) {
+			pr_info("user provided an invalid messag seq of %llx\n",
+				seq);
+			err = -EINVAL;
+			break;
+		}
+		head++;
+
+		if (type == DM_USER_RESP_SUCCESS) {
+			m->bio->bi_status = BLK_STS_OK;
+			if (m->msg.type == DM_USER_REQ_MAP_READ)
+				bio_copy_from_arena(m->bio, r->arena +
+					(m->arena_page << PAGE_SHIFT));
+		} else {
+			m->bio->bi_status = BLK_STS_IOERR;
+		}
+
+		bitmap_clear(r->arena_map, m->arena_page, m->arena_nr_pages);
+		bio_endio(m->bio);
+		bio_put(m->bio);
+		mempool_free(m, &t->message_pool);
+	}
+
+	r->cq_head = head;
+	smp_store_release(&r->hdr->cq_head, head);
+	return err;
+}
+
+static bool ring_alloc_payload(struct ring *r, struct message *m)
+{
+	unsigned long nr = 0, page = 0;
+
+	if (msg_has_payload(m)) {
+		nr = DIV_ROUND_UP(m->msg.len, PAGE_SIZE);
+		page = bitmap_find_next_zero_area(r->arena_map, r->arena_pages,
+						  0, nr, 0);
+		if (page >= r->arena_pages)
+			return false;
+		bitmap_set(r->arena_map, page, nr);
+	}
+
+	m->arena_page = page;
+	m->arena_nr_pages = nr;
+	return true;
+}
+
+/*
+ * Moves as many messages from the target to the SQ as there is room for.
+ * "blocked" is set if some were left behind for lack of room.
+ */
+static long ring_submit(struct channel *c, struct ring *r, bool *blocked)
+{
+	struct target *t = target_from_channel(c);
+	struct message *m, *tmp;
+	u32 tail = r->sq_tail;
+	u32 head, room;
+	long submitted = 0;
+	LIST_HEAD(batch);
+
+	lockdep_assert_held(&c->lock);
+	*blocked = false;
+
+	/* Userspace must be done with the entries before we reuse them */
+	head = smp_load_acquire(&r->hdr->sq_head);
+	if (unlikely(tail - head > r->sq_entries))
+		return -EINVAL;
+	room = r->sq_entries - (tail - head);
+
+	mutex_lock(&t->lock);
+	if (unlikely(t->dm_destroyed)) {
+		/* As in dev_read() */
+		mutex_unlock(&t->lock);
+		return -ENOTBLK;
+	}
+
+	while (!list_empty(&t->to_user)) {
+		m = list_first_entry(&t->to_user, struct message, to_user);
+		if (submitted == room || !ring_alloc_payload(r, m)) {
+			*blocked = true;
+			break;
+		}
+		list_move_tail(&m->to_user, &batch);
+		submitted++;
+	}
+	mutex_unlock(&t->lock);
+
+	/* Pairs with the barrier in user_map() */
+	smp_rmb();
+
+	/*
+	 * The payloads are copied without the target lock, which user_map()
+	 * needs.  The batch is already off the target, so only we see it.
+	 */
+	list_for_each_entry_safe (m, tmp, &batch, to_user) {
+		struct dm_user_sqe *sqe = &r->sqes[tail & (r->sq_entries - 1)];
+
+		list_del(&m->to_user);
+		if (m->msg.type == DM_USER_REQ_MAP_WRITE)
+			bio_copy_to_arena(m->bio, r->arena +
+					  (m->arena_page << PAGE_SHIFT));
+
+		sqe->seq = m->msg.seq;
+		sqe->type = m->msg.type;
+		sqe->flags = m->msg.flags;
+		sqe->sector = m->msg.sector;
+		sqe->len = m->msg.len;
+		sqe->buf = m->arena_page << PAGE_SHIFT;
+
+		list_add_tail(&m->from_user, &c->from_user);
+		tail++;
+	}
+
+	r->sq_tail = tail;
+	smp_store_release(&r->hdr->sq_tail, tail);
+	return submitted;
+}
+
+static long ring_enter(struct channel *c, unsigned long flags)
+{
+	struct target *t = target_from_channel(c);
+	struct ring *r;
+	bool blocked;
+	long ret;
+
+	if (flags & ~DM_USER_RING_ENTER_WAIT)
+		return -EINVAL;
+
+	mutex_lock(&c->lock);
+
+	r = c->ring;
+	if (unlikely(r == NULL)) {
+		ret = -EINVAL;
+		goto cleanup_unlock;
+	}
+
+	ret = ring_reap(c, r);
+	if (unlikely(ret < 0))
+		goto cleanup_unlock;
+
+	for (;;) {
+		int e;
+
+		ret = ring_submit(c, r, &blocked);
+		if (ret != 0 || blocked || !(flags & DM_USER_RING_ENTER_WAIT))
+			break;
+
+		/* Don't sleep while userspace hasn't caught up with the SQ */
+		if (READ_ONCE(r->hdr->sq_head) != r->sq_tail)
+			break;
+
+		mutex_unlock(&c->lock);
+		e = wait_event_interruptible(t->wq, target_poll(t));
+		mutex_lock(&c->lock);
+
+		if (unlikely(e != 0)) {
+			ret = e;
+			break;
+		}
+	}
+
+cleanup_unlock:
+	mutex_unlock(&c->lock);
+	return ret;
+}
+
+static long dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct channel *c = channel_from_file(file);
+
+	switch (cmd) {
+	case DM_USER_IOC_SETUP_RING:
+		return ring_setup(c, (void __user *)arg);
+	case DM_USER_IOC_RING_ENTER:
+		return ring_enter(c, arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
 static const struct file_operations file_operations = {
 	.owner = THIS_MODULE,
 	.open = dev_open,
@@ -883,6 +1278,9 @@ static const struct file_operations file_operations = {
 	.read_iter = dev_read,
 	.write_iter = dev_write,
 	.release = dev_release,
+	.unlocked_ioctl = dev_ioctl,
+	.compat_ioctl = dev_ioctl,
+	.mmap = dev_mmap,
 };
 
 static int user_ctr(struct dm_target *ti, unsigned int argc, char **argv)
@@ -1105,7 +1503,7 @@ static int user_map(struct dm_target *ti, struct bio *bio)
 
 static struct target_type user_target = {
 	.name = "user",
-	.version = { 1, 0, 0 },
+	.version = { 1, 1, 0 },
 	.module = THIS_MODULE,
 	.ctr = user_ctr,
 	.dtr = user_dtr,
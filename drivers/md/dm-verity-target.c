@@ -17,6 +17,7 @@
 #include "dm-verity.h"
 #include "dm-verity-fec.h"
 
+#include <crypto/hash_mb.h>
 #include <linux/module.h>
 #include <linux/reboot.h>
 
@@ -33,13 +34,24 @@
 #define DM_VERITY_OPT_RESTART		"restart_on_corruption"
 #define DM_VERITY_OPT_IGN_ZEROES	"ignore_zero_blocks"
 #define DM_VERITY_OPT_AT_MOST_ONCE	"check_at_most_once"
+#define DM_VERITY_OPT_INLINE		"try_verify_inline"
 
-#define DM_VERITY_OPTS_MAX		(3 + DM_VERITY_OPTS_FEC)
+#define DM_VERITY_OPTS_MAX		(4 + DM_VERITY_OPTS_FEC)
+
+#define DM_VERITY_DEFAULT_INLINE_MAX	32768
 
 static unsigned dm_verity_prefetch_cluster = DM_VERITY_DEFAULT_PREFETCH_SIZE;
 
 module_param_named(prefetch_cluster, dm_verity_prefetch_cluster, uint, S_IRUGO | S_IWUSR);
 
+static bool dm_verity_use_mb = true;
+
+module_param_named(use_multibuffer, dm_verity_use_mb, bool, S_IRUGO | S_IWUSR);
+
+static unsigned dm_verity_inline_max_bytes = DM_VERITY_DEFAULT_INLINE_MAX;
+
+module_param_named(inline_max_bytes, dm_verity_inline_max_bytes, uint, S_IRUGO | S_IWUSR);
+
 struct dm_verity_prefetch_work {
 	struct work_struct work;
 	struct dm_verity *v;
@@ -47,6 +59,21 @@ struct dm_verity_prefetch_work {
 	unsigned n_blocks;
 };
 
+/*
+ * Data blocks of a bio waiting to be hashed together by verity_verify_batch().
+ */
+struct dm_verity_batch {
+	unsigned n;
+	struct {
+		sector_t block;
+		struct bvec_iter start;
+		struct page *page;
+		unsigned offset;
+		u8 want_digest[HASH_MAX_DIGESTSIZE];
+		u8 real_digest[HASH_MAX_DIGESTSIZE];
+	} blk[DM_VERITY_MAX_MB_MSGS];
+};
+
 /*
  * Auxiliary structure appended to each dm-bufio buffer. If the value
  * hash_verified is nonzero, hash of the block has been verified.
@@ -188,6 +215,47 @@ int verity_hash(struct dm_verity *v, struct ahash_request *req,
 	return r;
 }
 
+/*
+ * The synchronous counterparts of verity_hash_init() and verity_hash_final(),
+ * for use where we must not sleep.
+ */
+static int verity_shash_init(struct dm_verity *v, struct shash_desc *desc)
+{
+	desc->tfm = v->shash_tfm;
+	desc->flags = 0;
+
+	if (likely(v->initial_hashstate))
+		return crypto_shash_import(desc, v->initial_hashstate);
+
+	/* Only version 0 with a salt gets here, and it salts at the end */
+	return crypto_shash_init(desc);
+}
+
+static int verity_shash_final(struct dm_verity *v, struct shash_desc *desc,
+			      u8 *digest)
+{
+	if (unlikely(v->salt_size && !v->version))
+		return crypto_shash_finup(desc, v->salt, v->salt_size, digest);
+
+	return crypto_shash_final(desc, digest);
+}
+
+static int verity_shash(struct dm_verity *v, const u8 *data, size_t len,
+			u8 *digest)
+{
+	SHASH_DESC_ON_STACK(desc, v->shash_tfm);
+	int r;
+
+	r = verity_shash_init(v, desc);
+	if (likely(!r))
+		r = crypto_shash_update(desc, data, len);
+	if (likely(!r))
+		r = verity_shash_final(v, desc, digest);
+	shash_desc_zero(desc);
+
+	return r;
+}
+
 static void verity_hash_at_level(struct dm_verity *v, sector_t block, int level,
 				 sector_t *hash_block, unsigned *offset)
 {
@@ -206,6 +274,20 @@ static void verity_hash_at_level(struct dm_verity *v, sector_t block, int level,
 		*offset = idx << (v->hash_dev_block_bits - v->hash_per_block_bits);
 }
 
+/*
+ * Forget which data blocks have been validated. Once the device was found
+ * corrupted or had to be corrected, blocks validated earlier may have been
+ * modified too, so they are all hashed again on their next read.
+ */
+static void verity_reset_validated(struct dm_verity *v)
+{
+	if (!v->validated_blocks)
+		return;
+
+	bitmap_zero(v->validated_blocks, v->data_blocks);
+	atomic_inc(&v->validated_resets);
+}
+
 /*
  * Handle verification errors.
  */
@@ -220,6 +302,8 @@ static int verity_handle_err(struct dm_verity *v, enum verity_block_type type,
 	/* Corruption should be visible in device status in all modes */
 	v->hash_failed = 1;
 
+	verity_reset_validated(v);
+
 	if (v->corrupted_errs >= DM_VERITY_MAX_CORRUPTED_ERRS)
 		goto out;
 
@@ -285,7 +369,12 @@ static int verity_verify_level(struct dm_verity *v, struct dm_verity_io *io,
 
 	verity_hash_at_level(v, block, level, &hash_block, &offset);
 
-	data = dm_bufio_read(v->bufio, hash_block, &buf);
+	if (io->in_end_io) {
+		data = dm_bufio_get(v->bufio, hash_block, &buf);
+		if (!data)
+			return -EAGAIN;
+	} else
+		data = dm_bufio_read(v->bufio, hash_block, &buf);
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
@@ -297,20 +386,29 @@ static int verity_verify_level(struct dm_verity *v, struct dm_verity_io *io,
 			goto release_ret_r;
 		}
 
-		r = verity_hash(v, verity_io_hash_req(v, io),
-				data, 1 << v->hash_dev_block_bits,
-				verity_io_real_digest(v, io));
+		if (io->in_end_io)
+			r = verity_shash(v, data, 1 << v->hash_dev_block_bits,
+					 verity_io_real_digest(v, io));
+		else
+			r = verity_hash(v, verity_io_hash_req(v, io),
+					data, 1 << v->hash_dev_block_bits,
+					verity_io_real_digest(v, io));
 		if (unlikely(r < 0))
 			goto release_ret_r;
 
 		if (likely(memcmp(verity_io_real_digest(v, io), want_digest,
 				  v->digest_size) == 0))
 			aux->hash_verified = 1;
-		else if (verity_fec_decode(v, io,
+		else if (io->in_end_io) {
+			/* Leave error correction to verity_work() */
+			r = -EAGAIN;
+			goto release_ret_r;
+		} else if (verity_fec_decode(v, io,
 					   DM_VERITY_BLOCK_TYPE_METADATA,
-					   hash_block, data, NULL) == 0)
+					   hash_block, data, NULL) == 0) {
 			aux->hash_verified = 1;
-		else if (verity_handle_err(v,
+			verity_reset_validated(v);
+		} else if (verity_handle_err(v,
 					   DM_VERITY_BLOCK_TYPE_METADATA,
 					   hash_block)) {
 			r = -EIO;
@@ -408,6 +506,40 @@ static int verity_for_io_block(struct dm_verity *v, struct dm_verity_io *io,
 	return 0;
 }
 
+/*
+ * Like verity_for_io_block() followed by verity_hash_final(), but with the
+ * synchronous hash, so that it doesn't sleep.
+ */
+static int verity_shash_io_block(struct dm_verity *v, struct dm_verity_io *io,
+				 struct bvec_iter *iter, u8 *digest)
+{
+	unsigned int todo = 1 << v->data_dev_block_bits;
+	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_io_data_size);
+	SHASH_DESC_ON_STACK(desc, v->shash_tfm);
+	int r;
+
+	r = verity_shash_init(v, desc);
+
+	while (likely(!r) && todo) {
+		struct bio_vec bv = bio_iter_iovec(bio, *iter);
+		unsigned int len = min(bv.bv_len, todo);
+		u8 *page;
+
+		page = kmap_atomic(bv.bv_page);
+		r = crypto_shash_update(desc, page + bv.bv_offset, len);
+		kunmap_atomic(page);
+
+		bio_advance_iter(bio, iter, len);
+		todo -= len;
+	}
+
+	if (likely(!r))
+		r = verity_shash_final(v, desc, digest);
+	shash_desc_zero(desc);
+
+	return r;
+}
+
 /*
  * Calls function process for 1 << v->data_dev_block_bits bytes in the bio_vec
  * starting from iter.
@@ -465,6 +597,108 @@ static inline void verity_bv_skip_block(struct dm_verity *v,
 	bio_advance_iter(bio, iter, 1 << v->data_dev_block_bits);
 }
 
+/*
+ * Compare the computed digest of a data block with the expected one, and try
+ * to correct or report the block if they differ. "start" is the position of
+ * the block in the bio.
+ */
+static int verity_check_data_block(struct dm_verity_io *io, sector_t block,
+				   const u8 *want_digest, const u8 *real_digest,
+				   struct bvec_iter *start)
+{
+	struct dm_verity *v = io->v;
+	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_io_data_size);
+
+	if (likely(memcmp(real_digest, want_digest, v->digest_size) == 0)) {
+		if (v->validated_blocks)
+			set_bit(block, v->validated_blocks);
+		return 0;
+	}
+
+	/* Leave error correction and reporting to verity_work() */
+	if (io->in_end_io)
+		return -EAGAIN;
+
+	/* FEC checks the corrected block against verity_io_want_digest() */
+	if (want_digest != verity_io_want_digest(v, io))
+		memcpy(verity_io_want_digest(v, io), want_digest,
+		       v->digest_size);
+
+	if (verity_fec_decode(v, io, DM_VERITY_BLOCK_TYPE_DATA,
+			      block, NULL, start) == 0) {
+		verity_reset_validated(v);
+		return 0;
+	}
+
+	if (bio->bi_status) {
+		/*
+		 * Error correction failed; Just return error
+		 */
+		return -EIO;
+	}
+
+	if (verity_handle_err(v, DM_VERITY_BLOCK_TYPE_DATA, block))
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Hash the data blocks queued in "batch" together and check their digests.
+ */
+static int verity_verify_batch(struct dm_verity_io *io,
+			       struct dm_verity_batch *batch)
+{
+	struct dm_verity *v = io->v;
+	SHASH_DESC_ON_STACK(desc, v->shash_tfm);
+	const u8 *data[DM_VERITY_MAX_MB_MSGS];
+	u8 *outs[DM_VERITY_MAX_MB_MSGS];
+	unsigned i, n = batch->n;
+	int r;
+
+	if (!n)
+		return 0;
+	batch->n = 0;
+
+	desc->tfm = v->shash_tfm;
+	desc->flags = 0;
+	r = crypto_shash_import(desc, v->initial_hashstate);
+	if (likely(!r)) {
+		for (i = 0; i < n; i++) {
+			data[i] = kmap_atomic(batch->blk[i].page) +
+				  batch->blk[i].offset;
+			outs[i] = batch->blk[i].real_digest;
+		}
+
+		r = crypto_shash_finup_mb(desc, data,
+					  1 << v->data_dev_block_bits,
+					  outs, n);
+
+		while (i--)
+			kunmap_atomic((void *)data[i] - batch->blk[i].offset);
+	}
+	shash_desc_zero(desc);
+
+	if (unlikely(r < 0)) {
+		DMERR("verity_verify_batch crypto op failed: %d", r);
+		return r;
+	}
+
+	if (n > 1)
+		atomic64_add(n, &v->hashes_batched);
+
+	for (i = 0; i < n; i++) {
+		r = verity_check_data_block(io, batch->blk[i].block,
+					    batch->blk[i].want_digest,
+					    batch->blk[i].real_digest,
+					    &batch->blk[i].start);
+		if (unlikely(r < 0))
+			return r;
+	}
+
+	return 0;
+}
+
 /*
  * Verify one "dm_verity_io" structure.
  */
@@ -476,20 +710,39 @@ static int verity_verify_io(struct dm_verity_io *io)
 	unsigned b;
 	struct crypto_wait wait;
 	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_io_data_size);
+	struct dm_verity_batch batch;
+	unsigned batch_size = 0;
+	unsigned skipped = 0;
+	int r;
+
+	if (v->mb_max_msgs && READ_ONCE(dm_verity_use_mb))
+		batch_size = v->mb_max_msgs;
+	batch.n = 0;
 
 	for (b = 0; b < io->n_blocks; b++) {
-		int r;
 		sector_t cur_block = io->block + b;
 		struct ahash_request *req = verity_io_hash_req(v, io);
+		u8 *want_digest = verity_io_want_digest(v, io);
+		struct bio_vec bv;
 
 		if (v->validated_blocks && bio->bi_status == BLK_STS_OK &&
 		    likely(test_bit(cur_block, v->validated_blocks))) {
+			skipped++;
 			verity_bv_skip_block(v, io, &io->iter);
 			continue;
 		}
 
-		r = verity_hash_for_block(v, io, cur_block,
-					  verity_io_want_digest(v, io),
+		/*
+		 * Blocks are batched only if they lie within a single page,
+		 * so that they can be hashed from a plain mapping.
+		 */
+		bv = bio_iter_iovec(bio, io->iter);
+		if (batch_size && bv.bv_len >= 1 << v->data_dev_block_bits)
+			want_digest = batch.blk[batch.n].want_digest;
+		else
+			bv.bv_page = NULL;
+
+		r = verity_hash_for_block(v, io, cur_block, want_digest,
 					  &is_zero);
 		if (unlikely(r < 0))
 			return r;
@@ -507,43 +760,60 @@ static int verity_verify_io(struct dm_verity_io *io)
 			continue;
 		}
 
-		r = verity_hash_init(v, req, &wait);
-		if (unlikely(r < 0))
-			return r;
+		if (bv.bv_page) {
+			batch.blk[batch.n].block = cur_block;
+			batch.blk[batch.n].start = io->iter;
+			batch.blk[batch.n].page = bv.bv_page;
+			batch.blk[batch.n].offset = bv.bv_offset;
+			verity_bv_skip_block(v, io, &io->iter);
+
+			if (++batch.n == batch_size) {
+				r = verity_verify_batch(io, &batch);
+				if (unlikely(r < 0))
+					return r;
+			}
+			continue;
+		}
 
 		start = io->iter;
-		r = verity_for_io_block(v, io, &io->iter, &wait);
-		if (unlikely(r < 0))
-			return r;
+		if (io->in_end_io) {
+			r = verity_shash_io_block(v, io, &io->iter,
+						  verity_io_real_digest(v, io));
+			if (unlikely(r < 0))
+				return r;
+		} else {
+			r = verity_hash_init(v, req, &wait);
+			if (unlikely(r < 0))
+				return r;
 
-		r = verity_hash_final(v, req, verity_io_real_digest(v, io),
-					&wait);
-		if (unlikely(r < 0))
-			return r;
+			r = verity_for_io_block(v, io, &io->iter, &wait);
+			if (unlikely(r < 0))
+				return r;
 
-		if (likely(memcmp(verity_io_real_digest(v, io),
-				  verity_io_want_digest(v, io), v->digest_size) == 0)) {
-			if (v->validated_blocks)
-				set_bit(cur_block, v->validated_blocks);
-			continue;
-		}
-		else if (verity_fec_decode(v, io, DM_VERITY_BLOCK_TYPE_DATA,
-					   cur_block, NULL, &start) == 0)
-			continue;
-		else {
-			if (bio->bi_status) {
-				/*
-				 * Error correction failed; Just return error
-				 */
-				return -EIO;
-			}
-			if (verity_handle_err(v, DM_VERITY_BLOCK_TYPE_DATA,
-					      cur_block))
-				return -EIO;
+			r = verity_hash_final(v, req,
+					      verity_io_real_digest(v, io),
+					      &wait);
+			if (unlikely(r < 0))
+				return r;
 		}
+
+		r = verity_check_data_block(io, cur_block, want_digest,
+					    verity_io_real_digest(v, io),
+					    &start);
+		if (unlikely(r < 0))
+			return r;
 	}
 
-	return 0;
+	/*
+	 * Counted once per I/O rather than per block, and only once the I/O
+	 * got this far, so an inline attempt that falls back to the
+	 * workqueue isn't counted twice.
+	 */
+	if (skipped)
+		atomic64_add(skipped, &v->hashes_skipped);
+
+	/* Hash what is left of the last batch */
+	return verity_verify_batch(io, &batch);
 }
 
 /*
@@ -578,6 +848,44 @@ static void verity_work(struct work_struct *w)
 	verity_finish_io(io, errno_to_blk_status(verity_verify_io(io)));
 }
 
+/*
+ * Try to verify a small I/O right in its completion, which saves a trip
+ * through verify_wq. This only works if every hash block needed is in the
+ * dm-bufio cache and every data block matches its digest; reading hash
+ * blocks, error correction and error reporting all may sleep and are left
+ * to verity_work(), which then starts over. Returns false in that case.
+ */
+static bool verity_verify_inline(struct dm_verity_io *io)
+{
+	struct dm_verity *v = io->v;
+	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_io_data_size);
+	struct bvec_iter iter = io->iter;
+	int r;
+
+	/* Don't hold off other interrupts while hashing */
+	if (bio->bi_status || in_irq() || irqs_disabled() ||
+	    ((size_t)io->n_blocks << v->data_dev_block_bits) >
+	    READ_ONCE(dm_verity_inline_max_bytes))
+		goto fallback;
+
+	io->in_end_io = true;
+	r = verity_verify_io(io);
+	io->in_end_io = false;
+
+	if (r) {
+		io->iter = iter;
+		goto fallback;
+	}
+
+	atomic64_inc(&v->inline_verified);
+	verity_finish_io(io, BLK_STS_OK);
+	return true;
+
+fallback:
+	atomic64_inc(&v->inline_fallbacks);
+	return false;
+}
+
 static void verity_end_io(struct bio *bio)
 {
 	struct dm_verity_io *io = bio->bi_private;
@@ -590,6 +898,9 @@ static void verity_end_io(struct bio *bio)
 		return;
 	}
 
+	if (io->v->use_inline && verity_verify_inline(io))
+		return;
+
 	INIT_WORK(&io->work, verity_work);
 	queue_work(io->v->verify_wq, &io->work);
 }
@@ -690,6 +1001,7 @@ int verity_map(struct dm_target *ti, struct bio *bio)
 	io->orig_bi_end_io = bio->bi_end_io;
 	io->block = bio->bi_iter.bi_sector >> (v->data_dev_block_bits - SECTOR_SHIFT);
 	io->n_blocks = bio->bi_iter.bi_size >> v->data_dev_block_bits;
+	io->in_end_io = false;
 
 	bio->bi_end_io = verity_end_io;
 	bio->bi_private = io;
@@ -746,6 +1058,8 @@ void verity_status(struct dm_target *ti, status_type_t type,
 			args++;
 		if (v->validated_blocks)
 			args++;
+		if (v->use_inline)
+			args++;
 		if (!args)
 			return;
 		DMEMIT(" %u", args);
@@ -766,6 +1080,8 @@ void verity_status(struct dm_target *ti, status_type_t type,
 			DMEMIT(" " DM_VERITY_OPT_IGN_ZEROES);
 		if (v->validated_blocks)
 			DMEMIT(" " DM_VERITY_OPT_AT_MOST_ONCE);
+		if (v->use_inline)
+			DMEMIT(" " DM_VERITY_OPT_INLINE);
 		sz = verity_fec_status_table(v, sz, result, maxlen);
 		break;
 	}
@@ -804,9 +1120,41 @@ void verity_io_hints(struct dm_target *ti, struct queue_limits *limits)
 	blk_limits_io_min(limits, limits->logical_block_size);
 }
 
+void verity_resume(struct dm_target *ti)
+{
+	struct dm_verity *v = ti->private;
+	struct kobject *kobj = &v->kobj_holder.kobj;
+	struct mapped_device *md = dm_table_get_md(ti->table);
+	int r;
+
+	if (kobj->state_in_sysfs)
+		return;
+
+	/* Only statistics, the device works without them */
+	r = kobject_add(kobj, &disk_to_dev(dm_disk(md))->kobj, "%s", "verity");
+	if (r)
+		DMWARN("%s: cannot add sysfs attributes: %d",
+		       dm_device_name(md), r);
+}
+
+void verity_postsuspend(struct dm_target *ti)
+{
+	struct dm_verity *v = ti->private;
+	struct kobject *kobj = &v->kobj_holder.kobj;
+
+	if (kobj->state_in_sysfs)
+		kobject_del(kobj);
+}
+
 void verity_dtr(struct dm_target *ti)
 {
 	struct dm_verity *v = ti->private;
+	struct kobject *kobj = &v->kobj_holder.kobj;
+
+	if (kobj->state_initialized) {
+		kobject_put(kobj);
+		wait_for_completion(dm_get_completion_from_kobject(kobj));
+	}
 
 	if (v->verify_wq)
 		destroy_workqueue(v->verify_wq);
@@ -818,6 +1166,10 @@ void verity_dtr(struct dm_target *ti)
 	kfree(v->salt);
 	kfree(v->root_digest);
 	kfree(v->zero_digest);
+	kfree(v->initial_hashstate);
+
+	if (v->shash_tfm)
+		crypto_free_shash(v->shash_tfm);
 
 	if (v->tfm)
 		crypto_free_ahash(v->tfm);
@@ -835,6 +1187,74 @@ void verity_dtr(struct dm_target *ti)
 	kfree(v);
 }
 
+static ssize_t hashes_skipped_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	struct dm_verity *v = container_of(kobj, struct dm_verity,
+					   kobj_holder.kobj);
+
+	return sprintf(buf, "%lld\n", atomic64_read(&v->hashes_skipped));
+}
+
+static ssize_t hashes_batched_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	struct dm_verity *v = container_of(kobj, struct dm_verity,
+					   kobj_holder.kobj);
+
+	return sprintf(buf, "%lld\n", atomic64_read(&v->hashes_batched));
+}
+
+static ssize_t validated_resets_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	struct dm_verity *v = container_of(kobj, struct dm_verity,
+					   kobj_holder.kobj);
+
+	return sprintf(buf, "%d\n", atomic_read(&v->validated_resets));
+}
+
+static ssize_t inline_verified_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	struct dm_verity *v = container_of(kobj, struct dm_verity,
+					   kobj_holder.kobj);
+
+	return sprintf(buf, "%lld\n", atomic64_read(&v->inline_verified));
+}
+
+static ssize_t inline_fallbacks_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	struct dm_verity *v = container_of(kobj, struct dm_verity,
+					   kobj_holder.kobj);
+
+	return sprintf(buf, "%lld\n", atomic64_read(&v->inline_fallbacks));
+}
+
+static struct kobj_attribute attr_hashes_skipped = __ATTR_RO(hashes_skipped);
+static struct kobj_attribute attr_hashes_batched = __ATTR_RO(hashes_batched);
+static struct kobj_attribute attr_validated_resets =
+	__ATTR_RO(validated_resets);
+static struct kobj_attribute attr_inline_verified = __ATTR_RO(inline_verified);
+static struct kobj_attribute attr_inline_fallbacks =
+	__ATTR_RO(inline_fallbacks);
+
+static struct attribute *verity_attrs[] = {
+	&attr_hashes_skipped.attr,
+	&attr_hashes_batched.attr,
+	&attr_validated_resets.attr,
+	&attr_inline_verified.attr,
+	&attr_inline_fallbacks.attr,
+	NULL
+};
+
+static struct kobj_type verity_ktype = {
+	.sysfs_ops = &kobj_sysfs_ops,
+	.default_attrs = verity_attrs,
+	.release = dm_kobject_release
+};
+
 static int verity_alloc_most_once(struct dm_verity *v)
 {
 	struct dm_target *ti = v->ti;
@@ -856,6 +1276,72 @@ static int verity_alloc_most_once(struct dm_verity *v)
 	return 0;
 }
 
+/*
+ * Set up the synchronous hash, which is needed to verify in bio completion
+ * context and to hash data blocks in batches if the hash implementation can
+ * hash several messages together. Batched data blocks all continue from the
+ * same state, so for them the salt must come first.
+ */
+static int verity_setup_shash(struct dm_verity *v)
+{
+	struct crypto_shash *tfm;
+	SHASH_DESC_ON_STACK(desc, tfm);
+	bool mb;
+	int r;
+
+	tfm = crypto_alloc_shash(v->alg_name, 0, 0);
+	if (IS_ERR(tfm)) {
+		if (v->use_inline)
+			DMWARN("%s has no synchronous implementation, "
+			       "verifying in the workqueue only", v->alg_name);
+		v->use_inline = false;
+		return 0;
+	}
+
+	mb = crypto_shash_mb_max_msgs(tfm) >= 2 &&
+	     (!v->salt_size || v->version);
+	if (!mb && !v->use_inline) {
+		crypto_free_shash(tfm);
+		return 0;
+	}
+
+	if (!v->salt_size || v->version) {
+		v->initial_hashstate = kmalloc(crypto_shash_statesize(tfm),
+					       GFP_KERNEL);
+		if (!v->initial_hashstate) {
+			crypto_free_shash(tfm);
+			return -ENOMEM;
+		}
+
+		desc->tfm = tfm;
+		desc->flags = 0;
+		r = crypto_shash_init(desc);
+		if (!r && v->salt_size)
+			r = crypto_shash_update(desc, v->salt, v->salt_size);
+		if (!r)
+			r = crypto_shash_export(desc, v->initial_hashstate);
+		shash_desc_zero(desc);
+		if (r) {
+			kfree(v->initial_hashstate);
+			v->initial_hashstate = NULL;
+			crypto_free_shash(tfm);
+			return r;
+		}
+	}
+
+	v->shash_tfm = tfm;
+	if (!mb)
+		return 0;
+
+	v->mb_max_msgs = min_t(unsigned, crypto_shash_mb_max_msgs(tfm),
+			       DM_VERITY_MAX_MB_MSGS);
+	DMINFO("%s hashing %u data blocks together using \"%s\"",
+	       v->alg_name, v->mb_max_msgs,
+	       crypto_tfm_alg_driver_name(crypto_shash_tfm(tfm)));
+
+	return 0;
+}
+
 static int verity_alloc_zero_digest(struct dm_verity *v)
 {
 	int r = -ENOMEM;
@@ -931,6 +1417,10 @@ static int verity_parse_opt_args(struct dm_arg_set *as, struct dm_verity *v)
 				return r;
 			continue;
 
+		} else if (!strcasecmp(arg_name, DM_VERITY_OPT_INLINE)) {
+			v->use_inline = true;
+			continue;
+
 		} else if (verity_is_fec_opt_arg(arg_name)) {
 			r = verity_fec_parse_opt_args(as, v, &argc, arg_name);
 			if (r)
@@ -1140,6 +1630,12 @@ int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	}
 #endif
 
+	r = verity_setup_shash(v);
+	if (r) {
+		ti->error = "Cannot set up synchronous hashing";
+		goto bad;
+	}
+
 	v->hash_per_block_bits =
 		__fls((1 << v->hash_dev_block_bits) / v->digest_size);
 
@@ -1173,7 +1669,8 @@ int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 
 	v->bufio = dm_bufio_client_create(v->hash_dev->bdev,
 		1 << v->hash_dev_block_bits, 1, sizeof(struct buffer_aux),
-		dm_bufio_alloc_callback, NULL);
+		dm_bufio_alloc_callback, NULL,
+		v->use_inline ? DM_BUFIO_CLIENT_NO_SLEEP : 0);
 	if (IS_ERR(v->bufio)) {
 		ti->error = "Cannot initialize dm-bufio";
 		r = PTR_ERR(v->bufio);
@@ -1205,6 +1702,14 @@ int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	ti->per_io_data_size = roundup(ti->per_io_data_size,
 				       __alignof__(struct dm_verity_io));
 
+	/*
+	 * The sysfs attributes are only added on resume: on a table reload
+	 * the new target is constructed while the old one still holds the
+	 * "verity" directory, which it gives up when it is suspended.
+	 */
+	init_completion(&v->kobj_holder.completion);
+	kobject_init(&v->kobj_holder.kobj, &verity_ktype);
+
 	return 0;
 
 bad:
@@ -1216,11 +1721,13 @@ int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 static struct target_type verity_target = {
 	.name		= "verity",
 	.features	= DM_TARGET_IMMUTABLE,
-	.version	= {1, 4, 0},
+	.version	= {1, 5, 0},
 	.module		= THIS_MODULE,
 	.ctr		= verity_ctr,
 	.dtr		= verity_dtr,
 	.map		= verity_map,
+	.postsuspend	= verity_postsuspend,
+	.resume		= verity_resume,
 	.status		= verity_status,
 	.prepare_ioctl	= verity_prepare_ioctl,
 	.iterate_devices = verity_iterate_devices,
@@ -12,11 +12,14 @@
 #ifndef DM_VERITY_H
 #define DM_VERITY_H
 
+#include "dm-core.h"
+
 #include <linux/dm-bufio.h>
 #include <linux/device-mapper.h>
 #include <crypto/hash.h>
 
 #define DM_VERITY_MAX_LEVELS		63
+#define DM_VERITY_MAX_MB_MSGS		2	/* blocks hashed together */
 
 enum verity_mode {
 	DM_VERITY_MODE_EIO,
@@ -38,6 +41,8 @@ struct dm_verity {
 	struct dm_bufio_client *bufio;
 	char *alg_name;
 	struct crypto_ahash *tfm;
+	struct crypto_shash *shash_tfm;	/* for multi-buffer hashing */
+	u8 *initial_hashstate;	/* shash state after hashing the salt */
 	u8 *root_digest;	/* digest of the root block */
 	u8 *salt;		/* salt: its size is salt_size */
 	u8 *zero_digest;	/* digest for a zero block */
@@ -53,6 +58,8 @@ struct dm_verity {
 	unsigned char version;
 	unsigned digest_size;	/* digest size for the current hash algorithm */
 	unsigned int ahash_reqsize;/* the size of temporary space for crypto */
+	unsigned int mb_max_msgs;	/* data blocks hashed together, or 0 */
+	bool use_inline;	/* try to verify in bio completion context */
 	int hash_failed;	/* set to 1 if hash of any block failed */
 	enum verity_mode mode;	/* mode for handling verification errors */
 	unsigned corrupted_errs;/* Number of errors for corrupted blocks */
@@ -64,6 +71,13 @@ struct dm_verity {
 
 	struct dm_verity_fec *fec;	/* forward error correction */
 	unsigned long *validated_blocks; /* bitset blocks validated */
+
+	atomic64_t hashes_skipped;	/* data blocks found in the bitset */
+	atomic64_t hashes_batched;	/* data blocks hashed together */
+	atomic_t validated_resets;	/* times the bitset was cleared */
+	atomic64_t inline_verified;	/* I/Os verified in end_io */
+	atomic64_t inline_fallbacks;	/* I/Os deferred to verify_wq */
+	struct dm_kobject_holder kobj_holder;	/* for sysfs attributes */
 };
 
 struct dm_verity_io {
@@ -76,6 +90,7 @@ struct dm_verity_io {
 
 	sector_t block;
 	unsigned n_blocks;
+	bool in_end_io;		/* see verity_verify_inline() */
 
 	struct work_struct work;
 
@@ -127,6 +142,8 @@ extern int verity_prepare_ioctl(struct dm_target *ti, struct block_device **bdev
 extern int verity_iterate_devices(struct dm_target *ti,
 				iterate_devices_callout_fn fn, void *data);
 extern void verity_io_hints(struct dm_target *ti, struct queue_limits *limits);
+extern void verity_resume(struct dm_target *ti);
+extern void verity_postsuspend(struct dm_target *ti);
 extern void verity_dtr(struct dm_target *ti);
 extern int verity_ctr(struct dm_target *ti, unsigned argc, char **argv);
 extern int verity_map(struct dm_target *ti, struct bio *bio);
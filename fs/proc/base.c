@@ -92,6 +92,7 @@
 #include <linux/sched/coredump.h>
 #include <linux/sched/debug.h>
 #include <linux/sched/stat.h>
+#include <linux/psi.h>
 #include <linux/flex_array.h>
 #include <linux/posix-timers.h>
 #include <linux/cpufreq_times.h>
@@ -486,6 +487,36 @@ static int proc_pid_schedstat(struct seq_file *m, struct pid_namespace *ns,
 }
 #endif
 
+#ifdef CONFIG_PSI
+/*
+ * Provides /proc/PID/psi_stall and /proc/PID/task/TID/psi_stall: the
+ * cumulative time in microseconds spent stalled on memory and IO
+ */
+static int do_psi_stall(struct seq_file *m, struct task_struct *task, bool whole)
+{
+	u64 memstall, iowait;
+
+	psi_task_stall_time(task, whole, &memstall, &iowait);
+	seq_printf(m, "memstall %llu\niowait %llu\n",
+		   div_u64(memstall, NSEC_PER_USEC),
+		   div_u64(iowait, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int proc_tid_psi_stall(struct seq_file *m, struct pid_namespace *ns,
+			      struct pid *pid, struct task_struct *task)
+{
+	return do_psi_stall(m, task, false);
+}
+
+static int proc_tgid_psi_stall(struct seq_file *m, struct pid_namespace *ns,
+			       struct pid *pid, struct task_struct *task)
+{
+	return do_psi_stall(m, task, true);
+}
+#endif
+
 #ifdef CONFIG_LATENCYTOP
 static int lstats_show_proc(struct seq_file *m, void *v)
 {
@@ -3437,6 +3468,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 #ifdef CONFIG_SCHED_INFO
 	ONE("schedstat",  S_IRUGO, proc_pid_schedstat),
 #endif
+#ifdef CONFIG_PSI
+	ONE("psi_stall",  S_IRUGO, proc_tgid_psi_stall),
+#endif
 #ifdef CONFIG_LATENCYTOP
 	REG("latency",  S_IRUGO, proc_lstats_operations),
 #endif
@@ -3839,6 +3873,9 @@ static const struct pid_entry tid_base_stuff[] = {
 #ifdef CONFIG_SCHED_INFO
 	ONE("schedstat", S_IRUGO, proc_pid_schedstat),
 #endif
+#ifdef CONFIG_PSI
+	ONE("psi_stall", S_IRUGO, proc_tid_psi_stall),
+#endif
 #ifdef CONFIG_LATENCYTOP
 	REG("latency",  S_IRUGO, proc_lstats_operations),
 #endif
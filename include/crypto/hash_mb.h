@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Multi-buffer synchronous hashing
+ *
+ * Some users, such as dm-verity, hash many equal-length messages which all
+ * start from the same state (e.g. a salt). An algorithm implementation may
+ * be able to finish several such messages faster together than one after
+ * another, by interleaving them to hide instruction latencies. This API
+ * lets users do so without knowing which implementation they got.
+ */
+
+#ifndef _CRYPTO_HASH_MB_H
+#define _CRYPTO_HASH_MB_H
+
+#include <crypto/hash.h>
+
+typedef int (*shash_finup_mb_t)(struct shash_desc *desc,
+				const u8 * const data[], unsigned int len,
+				u8 * const outs[], unsigned int num_msgs);
+
+/**
+ * crypto_shash_mb_max_msgs() - maximum useful number of messages per call
+ * @tfm: hash transformation object
+ *
+ * Return: the largest @num_msgs for which crypto_shash_finup_mb() hashes the
+ *	   messages together, or 1 if the implementation has no multi-buffer
+ *	   support and crypto_shash_finup_mb() would only hash them in turn.
+ */
+unsigned int crypto_shash_mb_max_msgs(struct crypto_shash *tfm);
+
+/**
+ * crypto_shash_finup_mb() - finish several messages from one hash state
+ * @desc: hash state the messages continue from; left in an undefined state
+ * @data: the remaining data of each message
+ * @len: length of each element of @data in bytes
+ * @outs: where to store the digest of each message
+ * @num_msgs: number of messages
+ *
+ * Equivalent to cloning @desc @num_msgs times and calling
+ * crypto_shash_finup() on each clone with the corresponding data.
+ *
+ * Context: Any context.
+ * Return: 0 if the message digests have been calculated; < 0 if an error
+ *	   occurred
+ */
+int crypto_shash_finup_mb(struct shash_desc *desc, const u8 * const data[],
+			  unsigned int len, u8 * const outs[],
+			  unsigned int num_msgs);
+
+#endif	/* _CRYPTO_HASH_MB_H */
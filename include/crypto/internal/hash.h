@@ -15,6 +15,7 @@
 
 #include <crypto/algapi.h>
 #include <crypto/hash.h>
+#include <crypto/hash_mb.h>
 
 struct ahash_request;
 struct scatterlist;
@@ -101,6 +102,10 @@ int crypto_register_shash(struct shash_alg *alg);
 int crypto_unregister_shash(struct shash_alg *alg);
 int crypto_register_shashes(struct shash_alg *algs, int count);
 int crypto_unregister_shashes(struct shash_alg *algs, int count);
+int crypto_register_shash_finup_mb(struct shash_alg *alg,
+				   shash_finup_mb_t finup_mb,
+				   unsigned int max_msgs);
+void crypto_unregister_shash_finup_mb(struct shash_alg *alg);
 int shash_register_instance(struct crypto_template *tmpl,
 			    struct shash_instance *inst);
 void shash_free_instance(struct crypto_instance *inst);
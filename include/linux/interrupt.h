@@ -530,6 +530,14 @@ extern void raise_softirq(unsigned int nr);
 DECLARE_PER_CPU(struct task_struct *, ksoftirqd);
 DECLARE_PER_CPU(__u32, active_softirqs);
 
+#ifdef CONFIG_IRQ_SBALANCE
+extern u64 sbalance_softirq_start(void);
+extern void sbalance_softirq_end(u64 start);
+#else
+static inline u64 sbalance_softirq_start(void) { return 0; }
+static inline void sbalance_softirq_end(u64 start) { }
+#endif
+
 static inline struct task_struct *this_cpu_ksoftirqd(void)
 {
 	return this_cpu_read(ksoftirqd);
@@ -73,6 +73,8 @@ struct irq_desc {
 	int			threads_handled_last;
 #ifdef CONFIG_IRQ_SBALANCE
 	unsigned int		last_cpu;
+	atomic64_t		hardirq_ns;	/* Time in handlers */
+	atomic64_t		softirq_ns;	/* Softirq time raised by us */
 #endif
 	raw_spinlock_t		lock;
 	struct cpumask		*percpu_enabled;
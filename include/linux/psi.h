@@ -23,6 +23,9 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 void psi_memstall_enter(unsigned long *flags);
 void psi_memstall_leave(unsigned long *flags);
 
+void psi_task_stall_time(struct task_struct *task, bool whole,
+			 u64 *memstall, u64 *iowait);
+
 int psi_show(struct seq_file *s, struct psi_group *group, enum psi_res res);
 
 struct psi_trigger *psi_trigger_create(struct psi_group *group,
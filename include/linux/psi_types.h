@@ -2,6 +2,7 @@
 #define _LINUX_PSI_TYPES_H
 
 #include <linux/kthread.h>
+#include <linux/hrtimer.h>
 #include <linux/seqlock.h>
 #include <linux/types.h>
 #include <linux/kref.h>
@@ -166,14 +167,15 @@ struct psi_group {
 
 	/* Monitor work control */
 	struct task_struct __rcu *poll_task;
-	struct timer_list poll_timer;
+	struct hrtimer poll_timer;
 	wait_queue_head_t poll_wait;
 	atomic_t poll_wakeup;
+	atomic_t poll_scheduled;
 
-	/* Protects data used by the monitor */
+	/* Serializes trigger creation and destruction */
 	struct mutex trigger_lock;
 
-	/* Configured polling triggers */
+	/* Configured polling triggers, RCU-protected for the monitor */
 	struct list_head triggers;
 	u32 nr_triggers[NR_PSI_STATES - 1];
 	u32 poll_states;
@@ -50,6 +50,7 @@ struct rcu_node;
 struct reclaim_state;
 struct robust_list_head;
 struct sched_attr;
+struct sched_boost_client;
 struct sched_param;
 struct seq_file;
 struct sighand_struct;
@@ -380,6 +381,9 @@ struct sched_info {
 	/* When were we last queued to run? */
 	unsigned long long		last_queued;
 
+	/* When were we last woken up, if we haven't run since? */
+	unsigned long long		last_wakeup;
+
 #endif /* CONFIG_SCHED_INFO */
 };
 
@@ -593,6 +597,11 @@ extern u32 sched_get_init_task_load(struct task_struct *p);
 extern void sched_update_cpu_freq_min_max(const cpumask_t *cpus, u32 fmin,
 					  u32 fmax);
 extern int sched_set_boost(int enable);
+extern struct sched_boost_client *sched_boost_client_register(const char *name);
+extern void sched_boost_client_unregister(struct sched_boost_client *client);
+extern int sched_boost_request(struct sched_boost_client *client, int type,
+			       unsigned int duration_ms);
+extern int sched_boost_release(struct sched_boost_client *client, int type);
 extern void sched_set_refresh_rate(enum fps fps);
 
 #define RAVG_HIST_SIZE_MAX 5
@@ -659,6 +668,24 @@ static inline int sched_set_boost(int enable)
 {
 	return -EINVAL;
 }
+
+static inline struct sched_boost_client *
+sched_boost_client_register(const char *name)
+{
+	return NULL;
+}
+static inline void
+sched_boost_client_unregister(struct sched_boost_client *client) { }
+static inline int sched_boost_request(struct sched_boost_client *client,
+				      int type, unsigned int duration_ms)
+{
+	return -EINVAL;
+}
+static inline int sched_boost_release(struct sched_boost_client *client,
+				      int type)
+{
+	return -EINVAL;
+}
 static inline void sched_update_cpu_freq_min_max(const cpumask_t *cpus,
 					u32 fmin, u32 fmax) { }
 
@@ -1252,6 +1279,11 @@ struct task_struct {
 #ifdef CONFIG_PSI
 	/* Pressure stall state */
 	unsigned int			psi_flags;
+	/* Cumulative ns spent in TSK_MEMSTALL and TSK_IOWAIT: */
+	u64				psi_memstall_time;
+	u64				psi_iowait_time;
+	/* Time of the last psi_flags change: */
+	u64				psi_stamp;
 #endif
 #ifdef CONFIG_TASK_XACCT
 	/* Accumulated RSS usage: */
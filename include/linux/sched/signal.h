@@ -189,6 +189,11 @@ struct signal_struct {
 	unsigned long maxrss, cmaxrss;
 	struct task_io_accounting ioac;
 
+#ifdef CONFIG_PSI
+	/* Cumulative ns of memory and IO stalls of dead threads in the group */
+	u64 psi_memstall_time, psi_iowait_time;
+#endif
+
 	/*
 	 * Cumulative ns of schedule CPU time fo dead threads in the
 	 * group, not including a zombie group leader, (This only differs
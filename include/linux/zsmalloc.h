@@ -37,6 +37,12 @@ enum zs_mapmode {
 struct zs_pool_stats {
 	/* How many pages were migrated (freed) */
 	atomic_long_t pages_compacted;
+	/* Share of the above freed by background compaction */
+	atomic_long_t bg_pages_compacted;
+	/* How many objects background compaction moved */
+	atomic_long_t bg_objs_migrated;
+	/* Time background compaction spent, in microseconds */
+	atomic_long_t bg_compact_us;
 };
 
 struct zs_pool;
@@ -45,9 +51,12 @@ struct zs_pool *zs_create_pool(const char *name);
 void zs_destroy_pool(struct zs_pool *pool);
 
 unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags);
+int zs_malloc_bulk(struct zs_pool *pool, const size_t *sizes,
+		   unsigned long *handles, int nr, gfp_t flags);
 void zs_free(struct zs_pool *pool, unsigned long obj);
 
 size_t zs_huge_class_size(struct zs_pool *pool);
+unsigned int zs_lookup_class_index(struct zs_pool *pool, unsigned int size);
 
 void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 			enum zs_mapmode mm);
@@ -1770,6 +1770,65 @@ TRACE_EVENT(sched_isolate,
 		__entry->time, __entry->isolate)
 );
 
+#ifdef CONFIG_SCHED_CASS
+/*
+ * sched_cass_select - CASS picked a CPU to wake a task on
+ *
+ * @util: relative utilization of the chosen CPU with @p on it
+ * @eff_util: utilization the CPU governor would see
+ * @cap: capacity left after RT, DL and IRQ time
+ * @exit_lat: 0 if busy, otherwise 1 + the idle state's exit latency
+ * @prev_dist: cache distance from the previous CPU (0 = same CPU)
+ * @waker_dist: cache distance from the waker for sync wakes, else 0
+ */
+TRACE_EVENT(sched_cass_select,
+
+	TP_PROTO(struct task_struct *p, int cpu, int prev_cpu, int this_cpu,
+		 bool sync, unsigned long util, unsigned long eff_util,
+		 unsigned long cap, unsigned int exit_lat, int prev_dist,
+		 int waker_dist),
+
+	TP_ARGS(p, cpu, prev_cpu, this_cpu, sync, util, eff_util, cap,
+		exit_lat, prev_dist, waker_dist),
+
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, cpu)
+		__field(int, prev_cpu)
+		__field(int, this_cpu)
+		__field(bool, sync)
+		__field(unsigned long, util)
+		__field(unsigned long, eff_util)
+		__field(unsigned long, cap)
+		__field(unsigned int, exit_lat)
+		__field(int, prev_dist)
+		__field(int, waker_dist)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid		= p->pid;
+		__entry->cpu		= cpu;
+		__entry->prev_cpu	= prev_cpu;
+		__entry->this_cpu	= this_cpu;
+		__entry->sync		= sync;
+		__entry->util		= util;
+		__entry->eff_util	= eff_util;
+		__entry->cap		= cap;
+		__entry->exit_lat	= exit_lat;
+		__entry->prev_dist	= prev_dist;
+		__entry->waker_dist	= waker_dist;
+	),
+
+	TP_printk("comm=%s pid=%d cpu=%d prev_cpu=%d this_cpu=%d sync=%d util=%lu eff_util=%lu cap=%lu exit_lat=%u prev_dist=%d waker_dist=%d",
+		__entry->comm, __entry->pid, __entry->cpu, __entry->prev_cpu,
+		__entry->this_cpu, __entry->sync, __entry->util,
+		__entry->eff_util, __entry->cap, __entry->exit_lat,
+		__entry->prev_dist, __entry->waker_dist)
+);
+#endif /* CONFIG_SCHED_CASS */
+
 #include "walt.h"
 #endif /* CONFIG_SMP */
 #endif /* _TRACE_SCHED_H */
@@ -7,13 +7,15 @@
 #ifndef _LINUX_DM_USER_H
 #define _LINUX_DM_USER_H
 
+#include <linux/ioctl.h>
 #include <linux/types.h>
 
 /*
  * dm-user proxies device mapper ops between the kernel and userspace.  It's
  * essentially just an RPC mechanism: all kernel calls create a request,
  * userspace handles that with a response.  Userspace obtains requests via
- * read() and provides responses via write().
+ * read() and provides responses via write(), or through a pair of rings
+ * shared with the kernel (see below).
  *
  * See Documentation/block/dm-user.rst for more information.
  */
@@ -65,4 +67,89 @@ struct dm_user_message {
 	__u8 buf[];
 };
 
+/*
+ * Ring transport
+ *
+ * A freshly opened channel can be switched to the ring transport with
+ * DM_USER_IOC_SETUP_RING, after which read() and write() fail on it.  The
+ * channel is then mmap()ed (MAP_SHARED, offset 0, ring_size bytes) and holds:
+ *
+ *  - struct dm_user_ring_header, in the first page;
+ *  - the submission queue (SQ) of struct dm_user_sqe at sq_offset, which
+ *    carries requests from the kernel to userspace;
+ *  - the completion queue (CQ) of struct dm_user_cqe at cq_offset, which
+ *    carries responses from userspace to the kernel;
+ *  - the data arena at arena_offset.  The payload of a request lives at
+ *    arena_offset + sqe->buf: the data to write for DM_USER_REQ_MAP_WRITE,
+ *    and the place to put the data read for DM_USER_REQ_MAP_READ.  Other
+ *    requests have no payload.  The space belongs to userspace until the
+ *    request is completed.
+ *
+ * Both queues are single-producer, single-consumer rings with free-running
+ * 32-bit indices; entry i lives in slot i & (entries - 1).  The producer
+ * fills entries before publishing the new tail with release semantics, and
+ * the consumer loads the tail with acquire semantics and publishes its head
+ * once it is done with the entries.  The kernel owns sq_tail and cq_head,
+ * userspace owns sq_head and cq_tail.
+ *
+ * DM_USER_IOC_RING_ENTER first completes the requests that userspace posted
+ * to the CQ, then moves as many pending requests to the SQ as there is room
+ * for in the SQ and the arena, and returns how many it moved.  With
+ * DM_USER_RING_ENTER_WAIT it sleeps until there is at least one, unless
+ * userspace still has requests to pick up from the SQ or requests are only
+ * held back by lack of room.  Userspace processes any number of requests
+ * between calls, and a single call both returns all of their results and
+ * fetches the next batch.
+ */
+
+#define DM_USER_RING_MAGIC 0x444d5552 /* "DMUR" */
+#define DM_USER_RING_VERSION 1
+
+struct dm_user_ring_params {
+	__u32 sq_entries; /* power of two */
+	__u32 cq_entries; /* power of two */
+	__u64 arena_size; /* multiple of the page size, at least 1MiB */
+	__u64 ring_size; /* set by the kernel: length to mmap() */
+};
+
+struct dm_user_ring_header {
+	__u32 magic;
+	__u32 version;
+	__u32 sq_entries;
+	__u32 cq_entries;
+	__u64 sq_offset;
+	__u64 cq_offset;
+	__u64 arena_offset;
+	__u64 arena_size;
+
+	/* Written by the kernel */
+	__u32 sq_tail __attribute__((aligned(64)));
+	__u32 cq_head;
+
+	/* Written by userspace */
+	__u32 sq_head __attribute__((aligned(64)));
+	__u32 cq_tail;
+};
+
+struct dm_user_sqe {
+	__u64 seq;
+	__u64 type; /* DM_USER_REQ_MAP_* */
+	__u64 flags; /* DM_USER_REQ_MAP_FLAG_* */
+	__u64 sector;
+	__u64 len;
+	__u64 buf; /* payload offset into the arena */
+};
+
+struct dm_user_cqe {
+	__u64 seq;
+	__u64 type; /* DM_USER_RESP_* */
+};
+
+#define DM_USER_RING_ENTER_WAIT 0x1
+
+#define DM_USER_IOC_MAGIC 0xfd
+#define DM_USER_IOC_SETUP_RING _IOWR(DM_USER_IOC_MAGIC, 0x80, \
+				     struct dm_user_ring_params)
+#define DM_USER_IOC_RING_ENTER _IO(DM_USER_IOC_MAGIC, 0x81)
+
 #endif
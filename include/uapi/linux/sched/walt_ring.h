@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_SCHED_WALT_RING_H
+#define _UAPI_LINUX_SCHED_WALT_RING_H
+
+#include <linux/types.h>
+
+/*
+ * Layout of the per-CPU WALT window rings exported through /dev/walt_ring.
+ *
+ * The ring of CPU n is mapped read-only at offset n << WALT_RING_MMAP_SHIFT
+ * of the device. Its size is data_offset + nr_records * record_size, which
+ * a consumer can learn by mapping the first page alone; mappings may be
+ * shorter than the ring but not longer. The same rings are also available,
+ * for debugging, as <debugfs>/walt_ring/cpuN mapped at offset 0.
+ *
+ * A ring is one page holding struct walt_ring_header followed by
+ * nr_records records at data_offset. The kernel is the only writer.
+ * Record i lives in slot i & (nr_records - 1) and carries seq == i + 1
+ * once complete; head counts the records written so far and is updated
+ * after the record.
+ *
+ * A consumer keeps its own position and, for each record below head
+ * (loaded with acquire semantics), copies the slot and accepts it only
+ * if seq reads i + 1 both before and after the copy. If head ran more
+ * than nr_records ahead of the position, the oldest records were
+ * overwritten and the consumer skips forward to head - nr_records.
+ */
+
+#define WALT_RING_MAGIC		0x57414c54	/* "WALT" */
+#define WALT_RING_VERSION	1
+
+/* Offset of a CPU's ring in /dev/walt_ring, as a shift of the CPU number */
+#define WALT_RING_MMAP_SHIFT	24
+
+enum walt_ring_type {
+	WALT_RING_TASK = 1,	/* task demand update (update_history) */
+	WALT_RING_CPU,		/* CPU busy time of the closed window */
+};
+
+struct walt_ring_header {
+	__u32 magic;
+	__u32 version;
+	__u32 cpu;
+	__u32 nr_records;	/* power of two */
+	__u32 record_size;
+	__u32 data_offset;	/* from the start of the mapping */
+	__u64 head;
+};
+
+struct walt_ring_record {
+	__u64 seq;
+	__u64 window_start;	/* window following the sample */
+	__u16 type;		/* enum walt_ring_type */
+	__u16 __reserved0;
+	__u32 pid;		/* WALT_RING_TASK only */
+	union {
+		struct {
+			__u32 runtime;	/* busy time per closed window */
+			__u32 samples;	/* number of windows closed */
+			__u32 demand;
+			__u32 pred_demand;
+			__u16 demand_scaled;
+			__u16 pred_demand_scaled;
+			__u32 __reserved1;
+		} task;
+		struct {
+			__u32 busy;	/* prev_runnable_sum */
+			__u32 nt_busy;	/* contribution of new tasks */
+			__u32 grp_busy;	/* related thread groups */
+			__u32 grp_nt_busy;
+			__u32 window_size;
+			__u32 __reserved1;
+		} cpu;
+	};
+	__u64 __reserved2[2];
+};
+
+#endif /* _UAPI_LINUX_SCHED_WALT_RING_H */
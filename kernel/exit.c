@@ -199,6 +199,10 @@ static void __exit_signal(struct task_struct *tsk)
 	sig->oublock += task_io_get_oublock(tsk);
 	task_io_accounting_add(&sig->ioac, &tsk->ioac);
 	sig->sum_sched_runtime += tsk->se.sum_exec_runtime;
+#ifdef CONFIG_PSI
+	sig->psi_memstall_time += tsk->psi_memstall_time;
+	sig->psi_iowait_time += tsk->psi_iowait_time;
+#endif
 	sig->nr_threads--;
 	__unhash_process(tsk, group_dead);
 	write_sequnlock(&sig->stats_lock);
@@ -1923,6 +1923,9 @@ static __latent_entropy struct task_struct *copy_process(
 
 #ifdef CONFIG_PSI
 	p->psi_flags = 0;
+	p->psi_memstall_time = 0;
+	p->psi_iowait_time = 0;
+	p->psi_stamp = 0;
 #endif
 
 	task_io_accounting_init(&p->ioac);
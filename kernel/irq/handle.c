@@ -139,8 +139,11 @@ irqreturn_t __handle_irq_event_percpu(struct irq_desc *desc, unsigned int *flags
 	irqreturn_t retval = IRQ_NONE;
 	unsigned int irq = desc->irq_data.irq;
 	struct irqaction *action;
+	u32 softirqs;
+	u64 start;
 
 	record_irq_time(desc);
+	start = sbalance_irq_start(&softirqs);
 
 	for_each_action_of_desc(desc, action) {
 		irqreturn_t res;
@@ -178,6 +181,7 @@ irqreturn_t __handle_irq_event_percpu(struct irq_desc *desc, unsigned int *flags
 		retval |= res;
 	}
 
+	sbalance_irq_handled(desc, start, softirqs);
 	return retval;
 }
 
@@ -129,9 +129,25 @@ static inline void unregister_handler_proc(unsigned int irq,
 #ifdef CONFIG_IRQ_SBALANCE
 extern void sbalance_desc_add(struct irq_desc *desc);
 extern void sbalance_desc_del(struct irq_desc *desc);
+extern void sbalance_irq_handled(struct irq_desc *desc, u64 start,
+				 u32 softirqs);
+
+/* Sample the state sbalance_irq_handled() needs before running handlers */
+static inline u64 sbalance_irq_start(u32 *softirqs)
+{
+	*softirqs = local_softirq_pending();
+	return sched_clock();
+}
 #else
 static inline void sbalance_desc_add(struct irq_desc *desc) { }
 static inline void sbalance_desc_del(struct irq_desc *desc) { }
+static inline void sbalance_irq_handled(struct irq_desc *desc, u64 start,
+					u32 softirqs) { }
+static inline u64 sbalance_irq_start(u32 *softirqs)
+{
+	*softirqs = 0;
+	return 0;
+}
 #endif
 
 extern bool __irq_can_set_affinity(struct irq_desc *desc);
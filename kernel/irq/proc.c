@@ -314,6 +314,18 @@ static int irq_spurious_proc_show(struct seq_file *m, void *v)
 	return 0;
 }
 
+#ifdef CONFIG_IRQ_SBALANCE
+static int irq_cost_proc_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc = irq_to_desc((long) m->private);
+
+	seq_printf(m, "hardirq_us %llu\n" "softirq_us %llu\n",
+		   div_u64(atomic64_read(&desc->hardirq_ns), NSEC_PER_USEC),
+		   div_u64(atomic64_read(&desc->softirq_ns), NSEC_PER_USEC));
+	return 0;
+}
+#endif
+
 #define MAX_NAMELEN 128
 
 static int name_unique(unsigned int irq, struct irqaction *new_action)
@@ -405,6 +417,12 @@ void register_irq_proc(unsigned int irq, struct irq_desc *desc)
 	proc_create_single_data("spurious", 0444, desc->dir,
 			irq_spurious_proc_show, (void *)(long)irq);
 
+#ifdef CONFIG_IRQ_SBALANCE
+	/* create /proc/irq/<irq>/cost */
+	proc_create_single_data("cost", 0444, desc->dir,
+			irq_cost_proc_show, (void *)(long)irq);
+#endif
+
 out_unlock:
 	mutex_unlock(&register_lock);
 }
@@ -426,6 +444,9 @@ void unregister_irq_proc(unsigned int irq, struct irq_desc *desc)
 # endif
 #endif
 	remove_proc_entry("spurious", desc->dir);
+#ifdef CONFIG_IRQ_SBALANCE
+	remove_proc_entry("cost", desc->dir);
+#endif
 
 	sprintf(name, "%u", irq);
 	remove_proc_entry(name, root_irq_dir);
@@ -23,6 +23,15 @@
  * processing interrupts rather than just the sheer number of them. This also
  * makes SBalance aware of CPU asymmetry, where different CPUs can have
  * different performance capacities and be proportionally balanced.
+ *
+ * With CONFIG_IRQ_SBALANCE_TIME, IRQs are weighed by the time spent on their
+ * behalf instead of by their interrupt counts: the time spent in their
+ * handlers plus the time of the softirq processing they raise. An IRQ which
+ * raises a softirq when none are pending on its CPU is charged for the whole
+ * of the next softirq run on that CPU. This is an approximation, since other
+ * IRQs may raise softirqs before that run, but it captures the common case of
+ * a NIC IRQ whose cost is dominated by NET_RX processing. A CPU's load is then
+ * the sum of the time of the IRQs which last fired on it.
  */
 
 #define pr_fmt(fmt) "sbalance: " fmt
@@ -44,7 +53,11 @@
  * This threshold is compared to the _scaled_ interrupt counts per CPU; i.e.,
  * the number of interrupts scaled to the CPU's capacity.
  */
+#ifdef CONFIG_IRQ_SBALANCE_TIME
+#define IRQ_SCALED_THRESH CONFIG_IRQ_SBALANCE_TIME_THRESH_US
+#else
 #define IRQ_SCALED_THRESH CONFIG_IRQ_SBALANCE_THRESH
+#endif
 
 struct bal_irq {
 	struct list_head node;
@@ -53,6 +66,7 @@ struct bal_irq {
 	struct irq_desc *desc;
 	unsigned int delta_nr;
 	unsigned int old_nr;
+	u64 old_cost;
 	int prev_cpu;
 };
 
@@ -69,6 +83,43 @@ static DEFINE_PER_CPU(struct bal_domain, balance_data);
 static DEFINE_PER_CPU(unsigned long, cpu_cap);
 static cpumask_t cpu_exclude_mask __read_mostly;
 
+/* IRQ number plus one of the IRQ charged for the next softirq run, or 0 */
+static DEFINE_PER_CPU(unsigned int, softirq_owner);
+
+void sbalance_irq_handled(struct irq_desc *desc, u64 start, u32 softirqs)
+{
+	atomic64_add(sched_clock() - start, &desc->hardirq_ns);
+
+	/* Claim the next softirq run if this IRQ raised the first softirq */
+	if (!softirqs && local_softirq_pending() &&
+	    !__this_cpu_read(softirq_owner))
+		__this_cpu_write(softirq_owner, irq_desc_get_irq(desc) + 1);
+}
+
+u64 sbalance_softirq_start(void)
+{
+	return __this_cpu_read(softirq_owner) ? sched_clock() : 0;
+}
+
+void sbalance_softirq_end(u64 start)
+{
+	struct irq_desc *desc;
+	unsigned int owner;
+
+	/* Nothing to charge if there was no owner when softirqs started */
+	if (!start)
+		return;
+
+	owner = __this_cpu_read(softirq_owner);
+	__this_cpu_write(softirq_owner, 0);
+
+	rcu_read_lock();
+	desc = irq_to_desc(owner - 1);
+	if (desc)
+		atomic64_add(sched_clock() - start, &desc->softirq_ns);
+	rcu_read_unlock();
+}
+
 void sbalance_desc_add(struct irq_desc *desc)
 {
 	struct bal_irq *bi;
@@ -110,7 +161,11 @@ static int bal_irq_move_node_cmp(void *priv, struct list_head *lhs_p, struct lis
 static bool update_irq_data(struct bal_irq *bi, int *cpu)
 {
 	struct irq_desc *desc = bi->desc;
+#ifdef CONFIG_IRQ_SBALANCE_TIME
+	u64 cost, delta;
+#else
 	unsigned int nr;
+#endif
 
 	/*
 	 * Get the CPU which currently has this IRQ affined. Due to hardware and
@@ -122,6 +177,18 @@ static bool update_irq_data(struct bal_irq *bi, int *cpu)
 	if (*cpu >= nr_cpu_ids)
 		return false;
 
+#ifdef CONFIG_IRQ_SBALANCE_TIME
+	/* Calculate the new time in microseconds spent on behalf of this IRQ */
+	cost = atomic64_read(&desc->hardirq_ns) +
+	       atomic64_read(&desc->softirq_ns);
+	delta = div_u64(cost - bi->old_cost, NSEC_PER_USEC);
+	if (!delta)
+		return false;
+
+	bi->delta_nr = min_t(u64, delta, UINT_MAX / SCHED_CAPACITY_SCALE);
+	bi->old_cost = cost;
+	return true;
+#else
 	/*
 	 * Calculate the number of new interrupts from this IRQ. It is assumed
 	 * that the IRQ has been running on the same CPU since the last
@@ -139,6 +206,7 @@ static bool update_irq_data(struct bal_irq *bi, int *cpu)
 	bi->delta_nr = nr - bi->old_nr;
 	bi->old_nr = nr;
 	return true;
+#endif
 }
 
 static int move_irq_to_cpu(struct bal_irq *bi, int cpu)
@@ -160,7 +228,8 @@ static int move_irq_to_cpu(struct bal_irq *bi, int cpu)
 
 	if (!ret) {
 		/* Update the old interrupt count using the new CPU */
-		bi->old_nr = *per_cpu_ptr(desc->kstat_irqs, cpu);
+		if (!IS_ENABLED(CONFIG_IRQ_SBALANCE_TIME))
+			bi->old_nr = *per_cpu_ptr(desc->kstat_irqs, cpu);
 		pr_debug("Moved IRQ%d (CPU%d -> CPU%d)\n",
 			 irq_desc_get_irq(desc), prev_cpu, cpu);
 	}
@@ -170,7 +239,8 @@ static int move_irq_to_cpu(struct bal_irq *bi, int cpu)
 static unsigned int scale_intrs(unsigned int intrs, int cpu)
 {
 	/* Scale the number of interrupts to this CPU's current capacity */
-	return intrs * SCHED_CAPACITY_SCALE / per_cpu(cpu_cap, cpu);
+	return div_u64((u64)intrs * SCHED_CAPACITY_SCALE,
+		       per_cpu(cpu_cap, cpu));
 }
 
 /* Returns true if IRQ balancing should stop */
@@ -233,21 +303,30 @@ static void balance_irqs(void)
 		 * balancing because balancing is only done using interrupt
 		 * counts rather than time spent in interrupts. That way, time
 		 * spent processing each interrupt is considered when balancing.
+		 * When balancing by time, this makes CPUs which are already
+		 * busy with IRQs look even heavier, which is desirable.
 		 */
 		per_cpu(cpu_cap, cpu) = cpu_rq(cpu)->cpu_capacity;
 
+#ifndef CONFIG_IRQ_SBALANCE_TIME
 		/* Get the number of new interrupts on this CPU */
 		bd = per_cpu_ptr(&balance_data, cpu);
 		bd->intrs = kstat_cpu_irqs_sum(cpu) - bd->old_total;
 		bd->old_total += bd->intrs;
+#endif
 	}
 
 	list_for_each_entry_rcu(bi, &bal_irq_list, node) {
-		/* Consider this IRQ for balancing if it's movable */
-		if (!__irq_can_set_affinity(bi->desc))
+		if (!update_irq_data(bi, &cpu))
 			continue;
 
-		if (!update_irq_data(bi, &cpu))
+#ifdef CONFIG_IRQ_SBALANCE_TIME
+		/* Every IRQ's time counts towards its CPU's load */
+		per_cpu(balance_data, cpu).intrs += bi->delta_nr;
+#endif
+
+		/* Consider this IRQ for balancing if it's movable */
+		if (!__irq_can_set_affinity(bi->desc))
 			continue;
 
 		/* Ignore for this run if the IRQ isn't on the expected CPU */
@@ -6,6 +6,8 @@
 #include "sched.h"
 #include "walt.h"
 #include <linux/of.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/sched/core_ctl.h>
 #include <trace/events/sched.h>
 
@@ -13,7 +15,8 @@
  * Scheduler boost is a mechanism to temporarily place tasks on CPUs
  * with higher capacity than those where a task would have normally
  * ended up with their load characteristics. Any entity enabling
- * boost is responsible for disabling it as well.
+ * boost is responsible for disabling it as well, unless it asked for
+ * a time-bounded boost through sched_boost_request().
  */
 
 unsigned int sysctl_sched_boost; /* To/from userspace */
@@ -127,106 +130,332 @@ static struct sched_boost_data sched_boosts[] = {
 #define SCHED_BOOST_START FULL_THROTTLE_BOOST
 #define SCHED_BOOST_END (RESTRAINED_BOOST + 1)
 
+/*
+ * Boost requests are made on behalf of clients. Each client holds its
+ * own reference count per boost type and contributes a single reference
+ * to sched_boosts[type] while it holds any, so clients cannot drop each
+ * other's boosts. Timed requests are dropped by the client's hrtimer,
+ * which defers to a work item as entering and exiting boosts may sleep.
+ * Requests through sched_set_boost() and the sysctl are accounted to the
+ * built-in "sysctl" client and never expire.
+ */
+struct sched_boost_client {
+	struct list_head node;
+	char name[16];
+	int refcount[MAX_NUM_BOOST_TYPE];
+	ktime_t expires[MAX_NUM_BOOST_TYPE];	/* 0: held until released */
+	struct hrtimer timer;
+	struct work_struct expire_work;
+};
+
+static LIST_HEAD(sched_boost_clients);
+static struct sched_boost_client sched_boost_sysctl = {
+	.name = "sysctl",
+};
+
+/* Boost types with a non-zero refcount, one bit per type */
+static unsigned long sched_boost_active;
+
 static int sched_effective_boost(void)
 {
-	int i;
-
 	/*
 	 * The boosts are sorted in descending order by
-	 * priority.
+	 * priority, so the lowest active type wins.
 	 */
-	for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++) {
-		if (sched_boosts[i].refcount >= 1)
-			return i;
-	}
+	if (!sched_boost_active)
+		return NO_BOOST;
 
-	return NO_BOOST;
+	return __ffs(sched_boost_active);
 }
 
-static void sched_boost_disable(int type)
+/* Switch to the effective boost if it changed, under boost_mutex */
+static void sched_boost_update(void)
 {
-	struct sched_boost_data *sb = &sched_boosts[type];
-	int next_boost, prev_boost = sched_boost_type;
+	int next_boost = sched_effective_boost();
+	int prev_boost = sched_boost_type;
+
+	if (next_boost != prev_boost) {
+		sched_boosts[prev_boost].exit();
+		sched_boosts[next_boost].enter();
+	}
 
-	if (sb->refcount <= 0)
+	/*
+	 * sysctl_sched_boost holds the boost request from
+	 * user space which could be different from the
+	 * effectively enabled boost. Update the effective
+	 * boost here.
+	 */
+	sched_boost_type = next_boost;
+	sysctl_sched_boost = sched_boost_type;
+	set_boost_policy(sysctl_sched_boost);
+	trace_sched_set_boost(sysctl_sched_boost);
+}
+
+static void sched_boost_client_get(struct sched_boost_client *client,
+				   int type)
+{
+	if (client->refcount[type]++)
 		return;
 
-	sb->refcount--;
+	if (!sched_boosts[type].refcount++)
+		__set_bit(type, &sched_boost_active);
+}
 
-	if (sb->refcount)
+static void sched_boost_client_put(struct sched_boost_client *client,
+				   int type, bool all)
+{
+	if (client->refcount[type] <= 0)
 		return;
 
-	next_boost = sched_effective_boost();
-	if (next_boost == prev_boost)
+	client->refcount[type] = all ? 0 : client->refcount[type] - 1;
+	if (client->refcount[type])
 		return;
-	/*
-	 * This boost's refcount becomes zero, so it must
-	 * be disabled. Disable it first and then apply
-	 * the next boost.
-	 */
-	sched_boosts[prev_boost].exit();
-	sched_boosts[next_boost].enter();
+
+	client->expires[type] = 0;
+	if (!--sched_boosts[type].refcount)
+		__clear_bit(type, &sched_boost_active);
 }
 
-static void sched_boost_enable(int type)
+/* Arm the client's timer for its earliest timed request */
+static void sched_boost_client_arm(struct sched_boost_client *client)
 {
-	struct sched_boost_data *sb = &sched_boosts[type];
-	int next_boost, prev_boost = sched_boost_type;
+	ktime_t next = KTIME_MAX;
+	int i;
 
-	sb->refcount++;
+	for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++) {
+		if (client->refcount[i] && client->expires[i])
+			next = min(next, client->expires[i]);
+	}
+
+	if (next != KTIME_MAX)
+		hrtimer_start(&client->timer, next, HRTIMER_MODE_ABS);
+	else
+		hrtimer_try_to_cancel(&client->timer);
+}
+
+static void sched_boost_client_expire(struct work_struct *work)
+{
+	struct sched_boost_client *client = container_of(work,
+			struct sched_boost_client, expire_work);
+	ktime_t now = ktime_get();
+	bool changed = false;
+	int i;
+
+	mutex_lock(&boost_mutex);
+	for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++) {
+		if (client->refcount[i] && client->expires[i] &&
+		    client->expires[i] <= now) {
+			sched_boost_client_put(client, i, true);
+			changed = true;
+		}
+	}
+	sched_boost_client_arm(client);
+	if (changed)
+		sched_boost_update();
+	mutex_unlock(&boost_mutex);
+}
 
-	if (sb->refcount != 1)
+static enum hrtimer_restart sched_boost_client_timer(struct hrtimer *timer)
+{
+	struct sched_boost_client *client = container_of(timer,
+			struct sched_boost_client, timer);
+
+	schedule_work(&client->expire_work);
+
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * sched_boost_client_register - create a handle for boost requests
+ * @name: name shown in debugfs, truncated to 15 characters
+ *
+ * Returns the new client or NULL if memory allocation failed.
+ */
+struct sched_boost_client *sched_boost_client_register(const char *name)
+{
+	struct sched_boost_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return NULL;
+
+	strlcpy(client->name, name, sizeof(client->name));
+	hrtimer_init(&client->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	client->timer.function = sched_boost_client_timer;
+	INIT_WORK(&client->expire_work, sched_boost_client_expire);
+
+	mutex_lock(&boost_mutex);
+	list_add_tail(&client->node, &sched_boost_clients);
+	mutex_unlock(&boost_mutex);
+
+	return client;
+}
+EXPORT_SYMBOL_GPL(sched_boost_client_register);
+
+/**
+ * sched_boost_client_unregister - drop all requests of a client and free it
+ * @client: handle returned by sched_boost_client_register()
+ */
+void sched_boost_client_unregister(struct sched_boost_client *client)
+{
+	bool changed = false;
+	int i;
+
+	if (!client)
 		return;
 
+	mutex_lock(&boost_mutex);
+	list_del(&client->node);
+	for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++) {
+		if (client->refcount[i]) {
+			sched_boost_client_put(client, i, true);
+			changed = true;
+		}
+	}
+	if (changed)
+		sched_boost_update();
+	mutex_unlock(&boost_mutex);
+
 	/*
-	 * This boost enable request did not come before.
-	 * Take this new request and find the next boost
-	 * by aggregating all the enabled boosts. If there
-	 * is a change, disable the previous boost and enable
-	 * the next boost.
+	 * With no references left, the expire work can't arm the timer
+	 * again. Cancel the timer first, as a pending one would queue
+	 * the work after it was cancelled.
 	 */
+	hrtimer_cancel(&client->timer);
+	cancel_work_sync(&client->expire_work);
 
-	next_boost = sched_effective_boost();
-	if (next_boost == prev_boost)
-		return;
+	kfree(client);
+}
+EXPORT_SYMBOL_GPL(sched_boost_client_unregister);
+
+/**
+ * sched_boost_request - take a reference on a boost type
+ * @client: requesting client
+ * @type: FULL_THROTTLE_BOOST, CONSERVATIVE_BOOST or RESTRAINED_BOOST
+ * @duration_ms: drop all of the client's references on @type after this
+ *	long, or 0 to hold the reference until sched_boost_release().
+ *
+ * A timed request extends the client's expiry for @type if it ends
+ * later; once an untimed request was made the type does not expire.
+ */
+int sched_boost_request(struct sched_boost_client *client, int type,
+			unsigned int duration_ms)
+{
+	ktime_t expires;
+
+	if (!client || type < SCHED_BOOST_START || type >= SCHED_BOOST_END)
+		return -EINVAL;
+
+	mutex_lock(&boost_mutex);
+	if (duration_ms) {
+		expires = ktime_add_ms(ktime_get(), duration_ms);
+		if (!client->refcount[type] ||
+		    (client->expires[type] && client->expires[type] < expires))
+			client->expires[type] = expires;
+	} else {
+		client->expires[type] = 0;
+	}
+	sched_boost_client_get(client, type);
+	sched_boost_client_arm(client);
+	sched_boost_update();
+	mutex_unlock(&boost_mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sched_boost_request);
+
+/**
+ * sched_boost_release - drop one reference taken by sched_boost_request()
+ * @client: requesting client
+ * @type: boost type passed to sched_boost_request()
+ */
+int sched_boost_release(struct sched_boost_client *client, int type)
+{
+	int ret = 0;
+
+	if (!client || type < SCHED_BOOST_START || type >= SCHED_BOOST_END)
+		return -EINVAL;
+
+	mutex_lock(&boost_mutex);
+	if (client->refcount[type]) {
+		sched_boost_client_put(client, type, false);
+		sched_boost_client_arm(client);
+		sched_boost_update();
+	} else {
+		ret = -EINVAL;
+	}
+	mutex_unlock(&boost_mutex);
 
-	sched_boosts[prev_boost].exit();
-	sched_boosts[next_boost].enter();
+	return ret;
 }
+EXPORT_SYMBOL_GPL(sched_boost_release);
 
-static void sched_boost_disable_all(void)
+static void _sched_set_boost(int type)
 {
+	struct sched_boost_client *client = &sched_boost_sysctl;
 	int i;
 
+	if (type == 0) {
+		for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++)
+			sched_boost_client_put(client, i, true);
+	} else if (type > 0) {
+		sched_boost_client_get(client, type);
+	} else {
+		sched_boost_client_put(client, -type, false);
+	}
+
+	sched_boost_update();
+}
+
+#ifdef CONFIG_DEBUG_FS
+static void sched_boost_client_show(struct seq_file *m,
+				    struct sched_boost_client *client,
+				    ktime_t now)
+{
+	int i;
+
+	seq_printf(m, "%-15s", client->name);
 	for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++) {
-		if (sched_boosts[i].refcount > 0) {
-			sched_boosts[i].exit();
-			sched_boosts[i].refcount = 0;
-		}
+		if (client->refcount[i] && client->expires[i])
+			seq_printf(m, " %d:%lldms", client->refcount[i],
+				   max(0LL, ktime_ms_delta(client->expires[i],
+							   now)));
+		else
+			seq_printf(m, " %d", client->refcount[i]);
 	}
+	seq_putc(m, '\n');
 }
 
-static void _sched_set_boost(int type)
+static int sched_boost_clients_show(struct seq_file *m, void *v)
 {
-	if (type == 0)
-		sched_boost_disable_all();
-	else if (type > 0)
-		sched_boost_enable(type);
-	else
-		sched_boost_disable(-type);
+	struct sched_boost_client *client;
+	ktime_t now = ktime_get();
+	int i;
 
-	/*
-	 * sysctl_sched_boost holds the boost request from
-	 * user space which could be different from the
-	 * effectively enabled boost. Update the effective
-	 * boost here.
-	 */
+	mutex_lock(&boost_mutex);
+	seq_printf(m, "effective %d\n", sched_boost_type);
+	seq_printf(m, "%-15s", "total");
+	for (i = SCHED_BOOST_START; i < SCHED_BOOST_END; i++)
+		seq_printf(m, " %d", sched_boosts[i].refcount);
+	seq_putc(m, '\n');
+
+	sched_boost_client_show(m, &sched_boost_sysctl, now);
+	list_for_each_entry(client, &sched_boost_clients, node)
+		sched_boost_client_show(m, client, now);
+	mutex_unlock(&boost_mutex);
 
-	sched_boost_type = sched_effective_boost();
-	sysctl_sched_boost = sched_boost_type;
-	set_boost_policy(sysctl_sched_boost);
-	trace_sched_set_boost(sysctl_sched_boost);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sched_boost_clients);
+
+static int __init sched_boost_debugfs_init(void)
+{
+	debugfs_create_file("sched_boost_clients", 0444, NULL, NULL,
+			    &sched_boost_clients_fops);
+	return 0;
 }
+late_initcall(sched_boost_debugfs_init);
+#endif
 
 void sched_boost_parse_dt(void)
 {
@@ -25,8 +25,13 @@
  * satisfy the overall load at any given moment.
  */
 
+/* Cache distance between two CPUs that don't share any sched_domain */
+#define CASS_DIST_NONE INT_MAX
+
 struct cass_cpu_cand {
 	int cpu;
+	int prev_dist;
+	int waker_dist;
 	unsigned int exit_lat;
 	unsigned long cap;
 	unsigned long cap_max;
@@ -35,6 +40,19 @@ struct cass_cpu_cand {
 	unsigned long util;
 };
 
+#ifdef CONFIG_DEBUG_FS
+struct cass_stats {
+	u64 nr_select;
+	u64 nr_cands;
+	u64 select_ns;
+	u64 max_select_ns;
+};
+
+/* Wake-time cost of CASS, only collected while enabled through debugfs */
+static DEFINE_PER_CPU(struct cass_stats, cass_stats);
+static DEFINE_STATIC_KEY_FALSE(cass_stats_enabled);
+#endif
+
 static __always_inline
 void cass_cpu_util(struct cass_cpu_cand *c, int this_cpu, bool sync)
 {
@@ -72,6 +90,29 @@ void cass_cpu_util(struct cass_cpu_cand *c, int this_cpu, bool sync)
 	c->cap = c->cap_max - min(c->hard_util, c->cap_max - 1);
 }
 
+/*
+ * Returns the cache distance between @cpu and @other, which is the level of the
+ * lowest sched_domain of @cpu that spans @other, plus one. CPUs in the lower
+ * levels share the most cache with each other (e.g. SMT siblings share L1/L2,
+ * and MC siblings share the LLC), so a lower distance means that a task moved
+ * from @other to @cpu finds more of its working set still cached. Must be
+ * called under rcu_read_lock().
+ */
+static __always_inline int cass_cache_dist(int cpu, int other)
+{
+	struct sched_domain *sd;
+
+	if (cpu == other)
+		return 0;
+
+	for_each_domain(cpu, sd) {
+		if (cpumask_test_cpu(other, sched_domain_span(sd)))
+			return sd->level + 1;
+	}
+
+	return CASS_DIST_NONE;
+}
+
 /* Returns true if @a is a better CPU than @b */
 static __always_inline
 bool cass_cpu_better(const struct cass_cpu_cand *a,
@@ -108,6 +149,10 @@ bool cass_cpu_better(const struct cass_cpu_cand *a,
 	if (cass_cmp(a->cap, b->cap))
 		goto done;
 
+	/* Prefer the CPU that shares more cache with the waker for sync wakes */
+	if (sync && cass_cmp(b->waker_dist, a->waker_dist))
+		goto done;
+
 	/* Prefer the CPU with lower idle exit latency */
 	if (cass_cmp(b->exit_lat, a->exit_lat))
 		goto done;
@@ -116,9 +161,8 @@ bool cass_cpu_better(const struct cass_cpu_cand *a,
 	if (cass_eq(a->cpu, prev_cpu) || !cass_cmp(b->cpu, prev_cpu))
 		goto done;
 
-	/* Prefer the CPU that shares a cache with the previous CPU */
-	if (cass_cmp(cpus_share_cache(a->cpu, prev_cpu),
-		     cpus_share_cache(b->cpu, prev_cpu)))
+	/* Prefer the CPU that shares more cache with the previous CPU */
+	if (cass_cmp(b->prev_dist, a->prev_dist))
 		goto done;
 
 	/* @a isn't a better CPU than @b. @res must be <=0 to indicate such. */
@@ -127,7 +171,8 @@ bool cass_cpu_better(const struct cass_cpu_cand *a,
 	return res > 0;
 }
 
-static int cass_best_cpu(struct task_struct *p, int prev_cpu, bool sync, bool rt)
+static int cass_best_cpu(struct task_struct *p, int prev_cpu, bool sync, bool rt,
+			 unsigned int *nr_cands)
 {
 	/* Initialize @best such that @best always has a valid CPU at the end */
 	struct cass_cpu_cand cands[2], *best = cands;
@@ -144,22 +189,26 @@ static int cass_best_cpu(struct task_struct *p, int prev_cpu, bool sync, bool rt
 	uc_min = uclamp_eff_value(p, UCLAMP_MIN);
 
 	/*
-	 * Find the best CPU to wake @p on. Although idle_get_state() requires
-	 * an RCU read lock, an RCU read lock isn't needed because we're not
-	 * preemptible and RCU-sched is unified with normal RCU. Therefore,
-	 * non-preemptible contexts are implicitly RCU-safe.
+	 * Find the best CPU to wake @p on. idle_get_state() and the
+	 * sched_domain walk in cass_cache_dist() need an RCU read lock: the
+	 * RT select path doesn't hold one, and with RCU-sched separate from
+	 * normal RCU, merely being non-preemptible doesn't keep the domains
+	 * from being freed under us by a rebuild.
 	 *
 	 * Note: @curr->cpu must be initialized before this loop ends. This is
 	 * necessary to ensure @best->cpu contains a valid CPU upon returning;
 	 * otherwise, if only one CPU is allowed and it is skipped before
 	 * @curr->cpu is set, then @best->cpu will be garbage.
 	 */
+	rcu_read_lock();
 	for_each_cpu_and(cpu, &p->cpus_allowed, cpu_active_mask) {
 		/* Use the free candidate slot for @curr */
 		struct cass_cpu_cand *curr = &cands[cidx];
 		struct cpuidle_state *idle_state;
 		struct rq *rq = cpu_rq(cpu);
 
+		(*nr_cands)++;
+
 		/* Get the original, maximum _possible_ capacity of this CPU */
 		curr->cap_max = arch_scale_cpu_capacity(NULL, cpu);
 
@@ -204,6 +253,10 @@ static int cass_best_cpu(struct task_struct *p, int prev_cpu, bool sync, bool rt
 		curr->cpu = cpu;
 		cass_cpu_util(curr, this_cpu, sync);
 
+		/* Get this CPU's place in the cache hierarchy */
+		curr->prev_dist = cass_cache_dist(cpu, prev_cpu);
+		curr->waker_dist = sync ? cass_cache_dist(cpu, this_cpu) : 0;
+
 		/*
 		 * Add @p's utilization to this CPU if it's not @p's CPU, to
 		 * find what this CPU's relative utilization would look like if
@@ -252,17 +305,47 @@ static int cass_best_cpu(struct task_struct *p, int prev_cpu, bool sync, bool rt
 			cidx ^= 1;
 		}
 	}
+	rcu_read_unlock();
+
+	trace_sched_cass_select(p, best->cpu, prev_cpu, this_cpu, sync,
+				best->util, best->eff_util, best->cap,
+				best->exit_lat, best->prev_dist,
+				best->waker_dist);
 
 	return best->cpu;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int cass_best_cpu_stats(struct task_struct *p, int prev_cpu, bool sync,
+			       bool rt)
+{
+	struct cass_stats *st = this_cpu_ptr(&cass_stats);
+	unsigned int nr_cands = 0;
+	u64 start, delta;
+	int cpu;
+
+	start = local_clock();
+	cpu = cass_best_cpu(p, prev_cpu, sync, rt, &nr_cands);
+	delta = local_clock() - start;
+
+	st->nr_select++;
+	st->nr_cands += nr_cands;
+	st->select_ns += delta;
+	if (delta > st->max_select_ns)
+		st->max_select_ns = delta;
+
+	return cpu;
+}
+#endif
+
 static int cass_select_task_rq(struct task_struct *p, int prev_cpu,
-			       int wake_flags, bool rt)
+			       int sd_flag, int wake_flags, bool rt)
 {
+	unsigned int nr_cands = 0;
 	bool sync;
 
 	/* Don't balance on exec since we don't know what @p will look like */
-	if (wake_flags & SD_BALANCE_EXEC)
+	if (sd_flag & SD_BALANCE_EXEC)
 		return prev_cpu;
 
 	/*
@@ -274,21 +357,215 @@ static int cass_select_task_rq(struct task_struct *p, int prev_cpu,
 		return cpumask_first(&p->cpus_allowed);
 
 	/* cass_best_cpu() needs the CFS task's utilization, so sync it up */
-	if (!rt && !(wake_flags & SD_BALANCE_FORK))
+	if (!rt && !(sd_flag & SD_BALANCE_FORK))
 		sync_entity_load_avg(&p->se);
 
 	sync = (wake_flags & WF_SYNC) && !(current->flags & PF_EXITING);
-	return cass_best_cpu(p, prev_cpu, sync, rt);
+#ifdef CONFIG_DEBUG_FS
+	if (static_branch_unlikely(&cass_stats_enabled))
+		return cass_best_cpu_stats(p, prev_cpu, sync, rt);
+#endif
+	return cass_best_cpu(p, prev_cpu, sync, rt, &nr_cands);
 }
 
 static int cass_select_task_rq_fair(struct task_struct *p, int prev_cpu,
-				    int wake_flags, int flags, int sibling_count_hint)
+				    int sd_flag, int wake_flags, int sibling_count_hint)
 {
-	return cass_select_task_rq(p, prev_cpu, wake_flags, false);
+	return cass_select_task_rq(p, prev_cpu, sd_flag, wake_flags, false);
 }
 
-int cass_select_task_rq_rt(struct task_struct *p, int prev_cpu, int wake_flags, int flags,
+int cass_select_task_rq_rt(struct task_struct *p, int prev_cpu, int sd_flag, int wake_flags,
 		  int sibling_count_hint)
 {
-	return cass_select_task_rq(p, prev_cpu, wake_flags, true);
+	return cass_select_task_rq(p, prev_cpu, sd_flag, wake_flags, true);
+}
+
+#ifdef CONFIG_DEBUG_FS
+/**
+ * DOC: CASS debugfs interface
+ *
+ * /sys/kernel/debug/cass/ contains:
+ *
+ * stats_enabled: write 1 to start collecting per-CPU wake-time statistics and
+ * 0 to stop. Collection is off by default since it reads the clock twice per
+ * wakeup; when off, the only cost is a patched-out branch.
+ *
+ * stats: per-CPU number of selections, average candidates scanned, and average
+ * and maximum selection latency in nanoseconds. Writing anything resets them.
+ *
+ * bench: writing N replays a synthetic storm of N wakeups of the writing task
+ * through both CASS and the stock select_task_rq_fair(), rotating the previous
+ * CPU over the task's allowed CPUs and alternating sync and non-sync wakes.
+ * Reading it shows the per-wakeup cost of each from the last run.
+ */
+static DEFINE_MUTEX(cass_debugfs_lock);
+static unsigned int cass_bench_iters;
+static u64 cass_bench_ns[2];
+
+static int cass_stats_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_puts(m, "cpu     selects  avg_cands   avg_ns   max_ns\n");
+	for_each_possible_cpu(cpu) {
+		struct cass_stats *st = per_cpu_ptr(&cass_stats, cpu);
+		u64 nr = READ_ONCE(st->nr_select);
+
+		seq_printf(m, "%3d %11llu %10llu %8llu %8llu\n", cpu, nr,
+			   nr ? div64_u64(READ_ONCE(st->nr_cands), nr) : 0,
+			   nr ? div64_u64(READ_ONCE(st->select_ns), nr) : 0,
+			   READ_ONCE(st->max_select_ns));
+	}
+
+	return 0;
+}
+
+static int cass_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cass_stats_show, NULL);
+}
+
+static ssize_t cass_stats_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	/* Racy against concurrent wakeups; good enough for a reset */
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&cass_stats, cpu), 0,
+		       sizeof(struct cass_stats));
+
+	return count;
+}
+
+static const struct file_operations cass_stats_fops = {
+	.open		= cass_stats_open,
+	.read		= seq_read,
+	.write		= cass_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int cass_stats_enabled_get(void *data, u64 *val)
+{
+	*val = static_key_enabled(&cass_stats_enabled);
+	return 0;
+}
+
+static int cass_stats_enabled_set(void *data, u64 val)
+{
+	mutex_lock(&cass_debugfs_lock);
+	if (val && !static_key_enabled(&cass_stats_enabled))
+		static_branch_enable(&cass_stats_enabled);
+	else if (!val && static_key_enabled(&cass_stats_enabled))
+		static_branch_disable(&cass_stats_enabled);
+	mutex_unlock(&cass_debugfs_lock);
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(cass_stats_enabled_fops, cass_stats_enabled_get,
+			 cass_stats_enabled_set, "%llu\n");
+
+/* Returns the total time in nanoseconds taken by @iters selections for @p */
+static u64 cass_bench_run(struct task_struct *p, unsigned int iters, bool cass)
+{
+	int prev_cpu = task_cpu(p);
+	unsigned long flags;
+	unsigned int i;
+	u64 start, total = 0;
+
+	for (i = 0; i < iters; i++) {
+		int wake_flags = (i & 1) ? WF_SYNC : 0;
+
+		prev_cpu = cpumask_next(prev_cpu, &p->cpus_allowed);
+		if (prev_cpu >= nr_cpu_ids)
+			prev_cpu = cpumask_first(&p->cpus_allowed);
+
+		/* Same context as try_to_wake_up() -> select_task_rq() */
+		raw_spin_lock_irqsave(&p->pi_lock, flags);
+		start = local_clock();
+		if (cass)
+			cass_select_task_rq_fair(p, prev_cpu, SD_BALANCE_WAKE,
+						 wake_flags, 1);
+		else
+			select_task_rq_fair(p, prev_cpu, SD_BALANCE_WAKE,
+					    wake_flags, 1);
+		total += local_clock() - start;
+		raw_spin_unlock_irqrestore(&p->pi_lock, flags);
+
+		cond_resched();
+	}
+
+	return total;
+}
+
+static int cass_bench_show(struct seq_file *m, void *v)
+{
+	mutex_lock(&cass_debugfs_lock);
+	seq_printf(m, "iterations: %u\n", cass_bench_iters);
+	if (cass_bench_iters) {
+		seq_printf(m, "cass_ns_per_wakeup: %llu\n",
+			   div_u64(cass_bench_ns[0], cass_bench_iters));
+		seq_printf(m, "stock_ns_per_wakeup: %llu\n",
+			   div_u64(cass_bench_ns[1], cass_bench_iters));
+	}
+	mutex_unlock(&cass_debugfs_lock);
+
+	return 0;
+}
+
+static int cass_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cass_bench_show, NULL);
+}
+
+static ssize_t cass_bench_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	unsigned int iters;
+	int ret;
+
+	ret = kstrtouint_from_user(ubuf, count, 0, &iters);
+	if (ret)
+		return ret;
+	if (!iters)
+		return -EINVAL;
+
+	mutex_lock(&cass_debugfs_lock);
+	/* Warm up caches and PELT sync for both paths before timing them */
+	cass_bench_run(current, min(iters, 64U), true);
+	cass_bench_run(current, min(iters, 64U), false);
+	cass_bench_ns[0] = cass_bench_run(current, iters, true);
+	cass_bench_ns[1] = cass_bench_run(current, iters, false);
+	cass_bench_iters = iters;
+	mutex_unlock(&cass_debugfs_lock);
+
+	return count;
+}
+
+static const struct file_operations cass_bench_fops = {
+	.open		= cass_bench_open,
+	.read		= seq_read,
+	.write		= cass_bench_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init cass_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("cass", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	debugfs_create_file("stats", 0644, dir, NULL, &cass_stats_fops);
+	debugfs_create_file("stats_enabled", 0644, dir, NULL,
+			    &cass_stats_enabled_fops);
+	debugfs_create_file("bench", 0644, dir, NULL, &cass_bench_fops);
+
+	return 0;
 }
+late_initcall(cass_debugfs_init);
+#endif /* CONFIG_DEBUG_FS */
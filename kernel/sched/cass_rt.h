@@ -4,7 +4,7 @@
  */
 
 #ifdef CONFIG_SCHED_CASS
-int cass_select_task_rq_rt(struct task_struct *p, int prev_cpu, int wake_flags, int flags,
+int cass_select_task_rq_rt(struct task_struct *p, int prev_cpu, int sd_flag, int wake_flags,
 		  int sibling_count_hint);
 
 /* Use CASS. A dummy wrapper ensures the replaced function is still "used". */
@@ -2503,6 +2503,7 @@ ttwu_do_activate(struct rq *rq, struct task_struct *p, int wake_flags,
 	}
 
 	ttwu_activate(rq, p, en_flags);
+	sched_info_wakeup(rq, p);
 	ttwu_do_wakeup(rq, p, wake_flags, rf);
 }
 
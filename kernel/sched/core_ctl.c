@@ -48,11 +48,24 @@ struct cluster_data {
 	unsigned int boost;
 	struct kobject kobj;
 	unsigned int strict_nrrun;
+	/* Predictive mode */
+	bool predict_enable;
+	unsigned int predict_lookahead_ms;
+	int pred_nrrun;
+	bool pred_pending;
+	unsigned int pred_pending_need;
+	s64 pred_ts;
+	u64 nr_predictions;
+	u64 nr_pred_hits;
+	u64 nr_pred_misses;
+	u64 pred_saved_ms;
 };
 
 struct cpu_data {
 	bool is_busy;
 	unsigned int busy;
+	unsigned int prev_busy;
+	unsigned int pred_busy;
 	unsigned int cpu;
 	bool not_preferred;
 	struct cluster_data *cluster;
@@ -274,6 +287,71 @@ static ssize_t show_enable(const struct cluster_data *state, char *buf)
 	return scnprintf(buf, PAGE_SIZE, "%u\n", state->enable);
 }
 
+static ssize_t store_predict_enable(struct cluster_data *state,
+				    const char *buf, size_t count)
+{
+	unsigned int val;
+	bool bval;
+
+	if (sscanf(buf, "%u\n", &val) != 1)
+		return -EINVAL;
+
+	bval = !!val;
+	if (bval != state->predict_enable) {
+		state->predict_enable = bval;
+		apply_need(state);
+	}
+
+	return count;
+}
+
+static ssize_t show_predict_enable(const struct cluster_data *state,
+				   char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%u\n", state->predict_enable);
+}
+
+#define MAX_PREDICT_LOOKAHEAD_MS	1000
+
+static ssize_t store_predict_lookahead_ms(struct cluster_data *state,
+					  const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (sscanf(buf, "%u\n", &val) != 1)
+		return -EINVAL;
+
+	if (val > MAX_PREDICT_LOOKAHEAD_MS)
+		return -EINVAL;
+
+	state->predict_lookahead_ms = val;
+	apply_need(state);
+
+	return count;
+}
+
+static ssize_t show_predict_lookahead_ms(const struct cluster_data *state,
+					 char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%u\n", state->predict_lookahead_ms);
+}
+
+static ssize_t show_predict_stats(const struct cluster_data *state, char *buf)
+{
+	unsigned long flags;
+	ssize_t count;
+
+	spin_lock_irqsave(&state_lock, flags);
+	count = scnprintf(buf, PAGE_SIZE,
+			  "predictions: %llu\nhits: %llu\n"
+			  "mispredictions: %llu\nsaved_ms: %llu\n",
+			  state->nr_predictions, state->nr_pred_hits,
+			  state->nr_pred_misses, state->pred_saved_ms);
+	spin_unlock_irqrestore(&state_lock, flags);
+
+	return count;
+}
+
 static ssize_t show_need_cpus(const struct cluster_data *state, char *buf)
 {
 	return snprintf(buf, PAGE_SIZE, "%u\n", state->need_cpus);
@@ -313,6 +391,8 @@ static ssize_t show_global_state(const struct cluster_data *state, char *buf)
 						cluster->first_cpu);
 		count += snprintf(buf + count, PAGE_SIZE - count,
 					"\tBusy%%: %u\n", c->busy);
+		count += snprintf(buf + count, PAGE_SIZE - count,
+					"\tPred busy%%: %u\n", c->pred_busy);
 		count += snprintf(buf + count, PAGE_SIZE - count,
 					"\tIs busy: %u\n", c->is_busy);
 		count += snprintf(buf + count, PAGE_SIZE - count,
@@ -408,6 +488,9 @@ core_ctl_attr_ro(active_cpus);
 core_ctl_attr_ro(global_state);
 core_ctl_attr_rw(not_preferred);
 core_ctl_attr_rw(enable);
+core_ctl_attr_rw(predict_enable);
+core_ctl_attr_rw(predict_lookahead_ms);
+core_ctl_attr_ro(predict_stats);
 
 static struct attribute *default_attrs[] = {
 	&min_cpus.attr,
@@ -422,6 +505,9 @@ static struct attribute *default_attrs[] = {
 	&active_cpus.attr,
 	&global_state.attr,
 	&not_preferred.attr,
+	&predict_enable.attr,
+	&predict_lookahead_ms.attr,
+	&predict_stats.attr,
 	NULL
 };
 
@@ -661,6 +747,14 @@ static int compute_cluster_nr_strict_need(int index)
 
 	return nr_strict_need;
 }
+
+/* Number of WALT windows covered by the predictive lookahead */
+static unsigned int lookahead_windows(const struct cluster_data *cluster)
+{
+	return DIV_ROUND_UP_ULL((u64)cluster->predict_lookahead_ms *
+				NSEC_PER_MSEC, sched_ravg_window);
+}
+
 static void update_running_avg(void)
 {
 	struct cluster_data *cluster;
@@ -672,7 +766,7 @@ static void update_running_avg(void)
 
 	spin_lock_irqsave(&state_lock, flags);
 	for_each_cluster(cluster, index) {
-		int nr_need, prev_misfit_need;
+		int nr_need, prev_misfit_need, prev_nrrun;
 
 		if (!cluster->inited)
 			continue;
@@ -680,8 +774,14 @@ static void update_running_avg(void)
 		nr_need = compute_cluster_nr_need(index);
 		prev_misfit_need = compute_prev_cluster_misfit_need(index);
 
-
+		prev_nrrun = cluster->nrrun;
 		cluster->nrrun = nr_need + prev_misfit_need;
+
+		/* Extrapolate a rising task count over the lookahead */
+		cluster->pred_nrrun = cluster->nrrun;
+		if (cluster->nrrun > prev_nrrun)
+			cluster->pred_nrrun += (cluster->nrrun - prev_nrrun) *
+					       lookahead_windows(cluster);
 		cluster->max_nr = compute_cluster_max_nr(index);
 		cluster->nr_prev_assist = prev_cluster_nr_need_assist(index);
 
@@ -772,6 +872,82 @@ static bool need_all_cpus(const struct cluster_data *cluster)
 		sched_ravg_window < DEFAULT_SCHED_RAVG_WINDOW);
 }
 
+/* ===================== predictive core count ======================= */
+
+/*
+ * pred_busy:
+ *   Busy% this CPU is expected to reach within the lookahead. It is the
+ *   larger of the WALT predicted demand of the tasks runnable on it now
+ *   and the last busy% extrapolated along its trend, so a CPU whose load
+ *   ramps up is counted busy before it crosses busy_up_thres.
+ */
+static unsigned int compute_pred_busy(const struct cpu_data *c,
+				      unsigned int windows)
+{
+	struct rq *rq = cpu_rq(c->cpu);
+	unsigned int busy = c->busy;
+	u64 pred;
+
+	pred = READ_ONCE(rq->walt_stats.pred_demands_sum_scaled) * 100;
+	pred = div64_ul(pred, capacity_orig_of(c->cpu));
+	busy = max_t(u64, busy, pred);
+
+	if (c->busy > c->prev_busy)
+		busy = max(busy, c->busy + (c->busy - c->prev_busy) * windows);
+
+	return min(busy, 100U);
+}
+
+/*
+ * Raise the need to what the predicted load requires and score earlier
+ * predictions: one is a hit once the reactive need catches up with it,
+ * with the time in between counted as unisolation latency saved, and a
+ * miss if that does not happen within the lookahead plus one window.
+ */
+static unsigned int apply_pred_need(struct cluster_data *cluster,
+				    unsigned int thres_idx,
+				    unsigned int need, s64 now)
+{
+	unsigned int pred_need = 0, limited_need;
+	struct cpu_data *c;
+	s64 deadline;
+
+	list_for_each_entry(c, &cluster->lru, sib)
+		pred_need += c->pred_busy >= cluster->busy_up_thres[thres_idx];
+
+	pred_need = max(pred_need, need);
+	if (cluster->pred_nrrun > pred_need)
+		pred_need = pred_need + 1;
+
+	limited_need = apply_limits(cluster, need);
+	if (cluster->pred_pending) {
+		deadline = cluster->pred_ts + cluster->predict_lookahead_ms +
+			   sched_ravg_window / NSEC_PER_MSEC;
+		if (limited_need >= cluster->pred_pending_need) {
+			cluster->nr_pred_hits++;
+			cluster->pred_saved_ms += now - cluster->pred_ts;
+			cluster->pred_pending = false;
+		} else if (now > deadline) {
+			cluster->nr_pred_misses++;
+			cluster->pred_pending = false;
+		}
+	}
+
+	if (pred_need <= need)
+		return need;
+
+	if (!cluster->pred_pending &&
+	    apply_limits(cluster, pred_need) > cluster->active_cpus &&
+	    apply_limits(cluster, pred_need) > limited_need) {
+		cluster->pred_pending = true;
+		cluster->pred_pending_need = apply_limits(cluster, pred_need);
+		cluster->pred_ts = now;
+		cluster->nr_predictions++;
+	}
+
+	return pred_need;
+}
+
 static bool eval_need(struct cluster_data *cluster)
 {
 	unsigned long flags;
@@ -787,6 +963,8 @@ static bool eval_need(struct cluster_data *cluster)
 
 	spin_lock_irqsave(&state_lock, flags);
 
+	now = ktime_to_ms(ktime_get());
+
 	if (cluster->boost || !cluster->enable || need_all_cpus(cluster)) {
 		need_cpus = cluster->max_cpus;
 	} else {
@@ -806,12 +984,14 @@ static bool eval_need(struct cluster_data *cluster)
 			need_cpus += c->is_busy;
 		}
 		need_cpus = apply_task_need(cluster, need_cpus);
+		if (cluster->predict_enable)
+			need_cpus = apply_pred_need(cluster, thres_idx,
+						    need_cpus, now);
 	}
 	new_need = apply_limits(cluster, need_cpus);
 	need_flag = adjustment_possible(cluster, new_need);
 
 	last_need = cluster->need_cpus;
-	now = ktime_to_ms(ktime_get());
 
 	if (new_need > cluster->active_cpus) {
 		ret = 1;
@@ -962,7 +1142,11 @@ void core_ctl_check(u64 window_start)
 		if (!cluster || !cluster->inited)
 			continue;
 
+		c->prev_busy = c->busy;
 		c->busy = sched_get_cpu_util(cpu);
+		if (cluster->predict_enable)
+			c->pred_busy = compute_pred_busy(c,
+						lookahead_windows(cluster));
 	}
 	spin_unlock_irqrestore(&state_lock, flags);
 
@@ -1303,6 +1487,7 @@ static int cluster_init(const struct cpumask *mask)
 	cluster->enable = true;
 	cluster->nr_not_preferred_cpus = 0;
 	cluster->strict_nrrun = 0;
+	cluster->predict_lookahead_ms = 20;
 	INIT_LIST_HEAD(&cluster->lru);
 	spin_lock_init(&cluster->pending_lock);
 
@@ -21,6 +21,16 @@ struct sugov_tunables {
 	struct gov_attr_set	attr_set;
 	unsigned int		up_rate_limit_us;
 	unsigned int		down_rate_limit_us;
+	unsigned int		hysteresis_pct;
+};
+
+#define SUGOV_LAT_BUCKETS	16
+
+/* Per-frequency selection statistics, indexed like policy->freq_table */
+struct sugov_freq_stats {
+	u64			req_count;
+	u64			req_time_ns;
+	u64			applied_count;
 };
 
 struct sugov_policy {
@@ -48,6 +58,18 @@ struct sugov_policy {
 
 	bool			limits_changed;
 	bool			need_freq_update;
+
+	/* Frequency selection statistics, exported through "freq_stats" */
+	struct sugov_freq_stats	*freq_stats;
+	unsigned int		nr_freq_stats;
+	int			last_req_idx;
+	unsigned int		last_req_freq;
+	u64			last_req_time;
+	u64			nr_rate_limited;
+	u64			nr_hysteresis;
+	/* Oldest request not yet served by sugov_work, under update_lock */
+	u64			req_pending_ns;
+	u64			lat_hist[SUGOV_LAT_BUCKETS];
 };
 
 struct sugov_cpu {
@@ -145,15 +167,98 @@ static bool sugov_up_down_rate_limit(struct sugov_policy *sg_policy, u64 time,
 	return false;
 }
 
+/*
+ * With hysteresis_pct set, only lower the frequency once the request has
+ * dropped more than that percentage below the current one. Increases are
+ * never held, nor are decreases needed to honour a lowered policy->max.
+ */
+static bool sugov_hysteresis_hold(struct sugov_policy *sg_policy,
+				  unsigned int next_freq, unsigned int pct)
+{
+	unsigned int cur = sg_policy->next_freq;
+
+	if (next_freq >= cur || cur > sg_policy->policy->max)
+		return false;
+
+	return (u64)next_freq * (100 + pct) >= (u64)cur * 100;
+}
+
+static int sugov_freq_index(struct sugov_policy *sg_policy, unsigned int freq)
+{
+	int idx;
+
+	if (!sg_policy->freq_stats)
+		return -1;
+
+	idx = cpufreq_frequency_table_get_index(sg_policy->policy, freq);
+	if (idx < 0 || idx >= sg_policy->nr_freq_stats)
+		return -1;
+
+	return idx;
+}
+
+/* Charge the time since the last request to the frequency it asked for */
+static void sugov_account_request(struct sugov_policy *sg_policy, u64 time,
+				  unsigned int next_freq)
+{
+	int last = sg_policy->last_req_idx;
+
+	if (!sg_policy->freq_stats)
+		return;
+
+	if (last >= 0 && time > sg_policy->last_req_time)
+		sg_policy->freq_stats[last].req_time_ns +=
+			time - sg_policy->last_req_time;
+
+	/* Most requests repeat the last one, skip the table lookup then */
+	if (next_freq != sg_policy->last_req_freq) {
+		last = sugov_freq_index(sg_policy, next_freq);
+		sg_policy->last_req_freq = next_freq;
+	}
+	if (last >= 0)
+		sg_policy->freq_stats[last].req_count++;
+
+	sg_policy->last_req_idx = last;
+	sg_policy->last_req_time = time;
+}
+
+static void sugov_account_applied(struct sugov_policy *sg_policy,
+				  unsigned int freq, u64 lat_ns)
+{
+	int idx = sugov_freq_index(sg_policy, freq);
+	unsigned int bucket;
+
+	if (idx >= 0)
+		sg_policy->freq_stats[idx].applied_count++;
+
+	/* Bucket 0 is below 1us, bucket n covers [2^(n-1), 2^n) us */
+	bucket = fls64(div_u64(lat_ns, NSEC_PER_USEC));
+	bucket = min_t(unsigned int, bucket, SUGOV_LAT_BUCKETS - 1);
+	sg_policy->lat_hist[bucket]++;
+}
+
 static bool sugov_update_next_freq(struct sugov_policy *sg_policy, u64 time,
 				   unsigned int next_freq)
 {
+	unsigned int pct;
+
+	sugov_account_request(sg_policy, time, next_freq);
+
 	if (sg_policy->next_freq == next_freq)
 		return false;
 
+	pct = READ_ONCE(sg_policy->tunables->hysteresis_pct);
+	if (pct && sugov_hysteresis_hold(sg_policy, next_freq, pct)) {
+		/* Restore cached freq as next_freq is not changed */
+		sg_policy->cached_raw_freq = sg_policy->prev_cached_raw_freq;
+		sg_policy->nr_hysteresis++;
+		return false;
+	}
+
 	if (sugov_up_down_rate_limit(sg_policy, time, next_freq)) {
 		/* Restore cached freq as next_freq is not changed */
 		sg_policy->cached_raw_freq = sg_policy->prev_cached_raw_freq;
+		sg_policy->nr_rate_limited++;
 		return false;
 	}
 
@@ -167,23 +272,35 @@ static void sugov_fast_switch(struct sugov_policy *sg_policy, u64 time,
 			      unsigned int next_freq)
 {
 	struct cpufreq_policy *policy = sg_policy->policy;
+	u64 start;
 
 	if (!sugov_update_next_freq(sg_policy, time, next_freq))
 		return;
 
+	start = sched_clock();
 	next_freq = cpufreq_driver_fast_switch(policy, next_freq);
 	if (!next_freq)
 		return;
 
 	policy->cur = next_freq;
+	sugov_account_applied(sg_policy, next_freq, sched_clock() - start);
 }
 
 static void sugov_deferred_update(struct sugov_policy *sg_policy, u64 time,
 				  unsigned int next_freq)
 {
+	lockdep_assert_held(&sg_policy->update_lock);
+
 	if (!sugov_update_next_freq(sg_policy, time, next_freq))
 		return;
 
+	/*
+	 * Latency is measured from the oldest request the work will serve.
+	 * sugov_work() reads and clears this under update_lock too.
+	 */
+	if (!sg_policy->req_pending_ns)
+		sg_policy->req_pending_ns = sched_clock();
+
 	if (use_pelt())
 		sg_policy->work_in_progress = true;
 	irq_work_queue(&sg_policy->irq_work);
@@ -670,10 +787,20 @@ sugov_update_shared(struct update_util_data *hook, u64 time, unsigned int flags)
 static void sugov_work(struct kthread_work *work)
 {
 	struct sugov_policy *sg_policy = container_of(work, struct sugov_policy, work);
+	unsigned long flags;
+	u64 req_ns;
+
+	raw_spin_lock_irqsave(&sg_policy->update_lock, flags);
+	req_ns = sg_policy->req_pending_ns;
+	sg_policy->req_pending_ns = 0;
+	raw_spin_unlock_irqrestore(&sg_policy->update_lock, flags);
 
 	mutex_lock(&sg_policy->work_lock);
 	__cpufreq_driver_target(sg_policy->policy, sg_policy->next_freq,
 				CPUFREQ_RELATION_L);
+	if (req_ns)
+		sugov_account_applied(sg_policy, sg_policy->policy->cur,
+				      sched_clock() - req_ns);
 	mutex_unlock(&sg_policy->work_lock);
 }
 
@@ -760,12 +887,85 @@ static ssize_t down_rate_limit_us_store(struct gov_attr_set *attr_set,
 	return count;
 }
 
+static ssize_t hysteresis_pct_show(struct gov_attr_set *attr_set, char *buf)
+{
+	struct sugov_tunables *tunables = to_sugov_tunables(attr_set);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", tunables->hysteresis_pct);
+}
+
+static ssize_t hysteresis_pct_store(struct gov_attr_set *attr_set,
+				    const char *buf, size_t count)
+{
+	struct sugov_tunables *tunables = to_sugov_tunables(attr_set);
+	unsigned int pct;
+
+	if (kstrtouint(buf, 10, &pct) || pct > 100)
+		return -EINVAL;
+
+	WRITE_ONCE(tunables->hysteresis_pct, pct);
+
+	return count;
+}
+
+/*
+ * One block per policy using these tunables: per-frequency request
+ * count, time spent requesting it and number of times it was applied,
+ * the log2 histogram of request-to-apply latency and the number of
+ * requests dropped by rate limiting and by hysteresis.
+ */
+static ssize_t freq_stats_show(struct gov_attr_set *attr_set, char *buf)
+{
+	struct sugov_policy *sg_policy;
+	ssize_t count = 0;
+	unsigned int i;
+
+	list_for_each_entry(sg_policy, &attr_set->policy_list, tunables_hook) {
+		struct cpufreq_policy *policy = sg_policy->policy;
+
+		count += scnprintf(buf + count, PAGE_SIZE - count,
+				   "policy%u\nfreq requests request_ms applied\n",
+				   policy->cpu);
+		for (i = 0; i < sg_policy->nr_freq_stats; i++) {
+			struct sugov_freq_stats *fs = &sg_policy->freq_stats[i];
+			unsigned int freq = policy->freq_table[i].frequency;
+
+			if (freq == CPUFREQ_ENTRY_INVALID)
+				continue;
+			count += scnprintf(buf + count, PAGE_SIZE - count,
+					   "%u %llu %llu %llu\n", freq,
+					   fs->req_count,
+					   div_u64(fs->req_time_ns,
+						   NSEC_PER_MSEC),
+					   fs->applied_count);
+		}
+
+		count += scnprintf(buf + count, PAGE_SIZE - count,
+				   "latency_us");
+		for (i = 0; i < SUGOV_LAT_BUCKETS - 1; i++)
+			count += scnprintf(buf + count, PAGE_SIZE - count,
+					   " <%u:%llu", 1U << i,
+					   sg_policy->lat_hist[i]);
+		count += scnprintf(buf + count, PAGE_SIZE - count,
+				   " >=%u:%llu\nrate_limited %llu\nhysteresis %llu\n",
+				   1U << (i - 1), sg_policy->lat_hist[i],
+				   sg_policy->nr_rate_limited,
+				   sg_policy->nr_hysteresis);
+	}
+
+	return count;
+}
+
 static struct governor_attr up_rate_limit_us = __ATTR_RW(up_rate_limit_us);
 static struct governor_attr down_rate_limit_us = __ATTR_RW(down_rate_limit_us);
+static struct governor_attr hysteresis_pct = __ATTR_RW(hysteresis_pct);
+static struct governor_attr freq_stats = __ATTR_RO(freq_stats);
 
 static struct attribute *sugov_attributes[] = {
 	&up_rate_limit_us.attr,
 	&down_rate_limit_us.attr,
+	&hysteresis_pct.attr,
+	&freq_stats.attr,
 	NULL
 };
 
@@ -796,11 +996,28 @@ static struct sugov_policy *sugov_policy_alloc(struct cpufreq_policy *policy)
 
 	sg_policy->policy = policy;
 	raw_spin_lock_init(&sg_policy->update_lock);
+
+	/* Statistics are optional, drivers without a table go without */
+	if (policy->freq_table) {
+		unsigned int nr = 0;
+
+		while (policy->freq_table[nr].frequency != CPUFREQ_TABLE_END)
+			nr++;
+		sg_policy->freq_stats = kcalloc(nr,
+						sizeof(*sg_policy->freq_stats),
+						GFP_KERNEL);
+		if (sg_policy->freq_stats)
+			sg_policy->nr_freq_stats = nr;
+	}
+	sg_policy->last_req_idx = -1;
+	sg_policy->last_req_freq = 0;
+
 	return sg_policy;
 }
 
 static void sugov_policy_free(struct sugov_policy *sg_policy)
 {
+	kfree(sg_policy->freq_stats);
 	kfree(sg_policy);
 }
 
@@ -883,6 +1100,7 @@ static void sugov_tunables_restore(struct cpufreq_policy *policy)
 
 	tunables->up_rate_limit_us = cached->up_rate_limit_us;
 	tunables->down_rate_limit_us = cached->down_rate_limit_us;
+	tunables->hysteresis_pct = cached->hysteresis_pct;
 }
 
 static int sugov_init(struct cpufreq_policy *policy)
@@ -1004,6 +1222,9 @@ static int sugov_start(struct cpufreq_policy *policy)
 	sg_policy->need_freq_update		= false;
 	sg_policy->cached_raw_freq		= 0;
 	sg_policy->prev_cached_raw_freq		= 0;
+	sg_policy->last_req_idx			= -1;
+	sg_policy->last_req_freq		= 0;
+	sg_policy->req_pending_ns		= 0;
 
 	for_each_cpu(cpu, policy->cpus) {
 		struct sugov_cpu *sg_cpu = &per_cpu(sugov_cpu, cpu);
@@ -177,9 +177,10 @@ __setup("psi=", setup_psi);
 #define EXP_300s	2034		/* 1/exp(2s/300s) */
 
 /* PSI trigger definitions */
-#define WINDOW_MIN_US 500000	/* Min window size is 500ms */
+#define WINDOW_MIN_US 10000	/* Min window size is 10ms */
 #define WINDOW_MAX_US 10000000	/* Max window size is 10s */
 #define UPDATES_PER_WINDOW 10	/* 10 updates per window */
+#define POLL_WAKE_DELAY NSEC_PER_MSEC	/* 1ms monitor wakeup delay */
 
 /* Sampling frequency in nanoseconds */
 static u64 psi_period __read_mostly;
@@ -192,7 +193,7 @@ struct psi_group psi_system = {
 
 static void psi_avgs_work(struct work_struct *work);
 
-static void poll_timer_fn(struct timer_list *t);
+static enum hrtimer_restart poll_timer_fn(struct hrtimer *timer);
 
 static void group_init(struct psi_group *group)
 {
@@ -214,7 +215,9 @@ static void group_init(struct psi_group *group)
 	group->polling_next_update = ULLONG_MAX;
 	group->polling_until = 0;
 	init_waitqueue_head(&group->poll_wait);
-	timer_setup(&group->poll_timer, poll_timer_fn, 0);
+	atomic_set(&group->poll_scheduled, 0);
+	hrtimer_init(&group->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	group->poll_timer.function = poll_timer_fn;
 	rcu_assign_pointer(group->poll_task, NULL);
 }
 
@@ -514,12 +517,12 @@ static void init_triggers(struct psi_group *group, u64 now)
 {
 	struct psi_trigger *t;
 
-	list_for_each_entry(t, &group->triggers, node)
+	list_for_each_entry_rcu(t, &group->triggers, node)
 		window_reset(&t->win, now,
 				group->total[PSI_POLL][t->state], 0);
 	memcpy(group->polling_total, group->total[PSI_POLL],
 		   sizeof(group->polling_total));
-	group->polling_next_update = now + group->poll_min_period;
+	group->polling_next_update = now + READ_ONCE(group->poll_min_period);
 }
 
 static u64 update_triggers(struct psi_group *group, u64 now)
@@ -532,7 +535,7 @@ static u64 update_triggers(struct psi_group *group, u64 now)
 	 * On subsequent updates, calculate growth deltas and let
 	 * watchers know when their specified thresholds are exceeded.
 	 */
-	list_for_each_entry(t, &group->triggers, node) {
+	list_for_each_entry_rcu(t, &group->triggers, node) {
 		u64 growth;
 		bool new_stall;
 
@@ -568,8 +571,13 @@ static u64 update_triggers(struct psi_group *group, u64 now)
 		if (now < t->last_event_time + t->win.size)
 			continue;
 
-		/* Generate an event */
-		if (cmpxchg(&t->event, 0, 1) == 0) {
+		/*
+		 * Generate an event. With short windows the trigger can fire
+		 * again before the previous event was consumed; skip the
+		 * wakeup then, as well as when nobody is polling yet.
+		 */
+		if (cmpxchg(&t->event, 0, 1) == 0 &&
+		    wq_has_sleeper(&t->event_wait)) {
 			trace_psi_update_trigger_wake_up(t, growth);
 			wake_up_interruptible(&t->event_wait);
 		}
@@ -582,21 +590,21 @@ static u64 update_triggers(struct psi_group *group, u64 now)
 		memcpy(group->polling_total, total,
 				sizeof(group->polling_total));
 
-	return now + group->poll_min_period;
+	return now + READ_ONCE(group->poll_min_period);
 }
 
-/* Schedule polling if it's not already scheduled. */
-static void psi_schedule_poll_work(struct psi_group *group, unsigned long delay)
+/*
+ * Schedule polling if it's not already scheduled. @delay is in ns.
+ *
+ * The hot path calls this on every state change of a monitored group, so
+ * only the first caller after the monitor last ran arms the timer; the
+ * rest see poll_scheduled set and return without touching the timer base.
+ */
+static void psi_schedule_poll_work(struct psi_group *group, u64 delay)
 {
 	struct task_struct *task;
 
-	/*
-	 * Do not reschedule if already scheduled.
-	 * Possible race with a timer scheduled after this check but before
-	 * mod_timer below can be tolerated because group->polling_next_update
-	 * will keep updates on schedule.
-	 */
-	if (timer_pending(&group->poll_timer))
+	if (atomic_xchg(&group->poll_scheduled, 1))
 		return;
 
 	rcu_read_lock();
@@ -607,7 +615,10 @@ static void psi_schedule_poll_work(struct psi_group *group, unsigned long delay)
 	 * psi_task_change (hotpath) which can't use locks
 	 */
 	if (likely(task))
-		mod_timer(&group->poll_timer, jiffies + delay);
+		hrtimer_start(&group->poll_timer, ns_to_ktime(delay),
+			      HRTIMER_MODE_REL);
+	else
+		atomic_set(&group->poll_scheduled, 0);
 
 	rcu_read_unlock();
 }
@@ -617,13 +628,26 @@ static void psi_poll_work(struct psi_group *group)
 	u32 changed_states;
 	u64 now;
 
-	mutex_lock(&group->trigger_lock);
+	/*
+	 * Clear the flag before sampling so that a state change racing
+	 * with the collection below arms the timer again instead of
+	 * being lost.
+	 */
+	atomic_set(&group->poll_scheduled, 0);
+	smp_mb__after_atomic();
+
+	/*
+	 * The trigger list is walked under RCU only: trigger_lock is held
+	 * across kthread creation and trigger teardown, and a monitor that
+	 * had to wait for it would miss updates on short windows.
+	 */
+	rcu_read_lock();
 
 	now = sched_clock();
 
 	collect_percpu_times(group, PSI_POLL, &changed_states);
 
-	if (changed_states & group->poll_states) {
+	if (changed_states & READ_ONCE(group->poll_states)) {
 		/* Initialize trigger windows when entering polling mode */
 		if (now > group->polling_until)
 			init_triggers(group, now);
@@ -634,7 +658,7 @@ static void psi_poll_work(struct psi_group *group)
 		 * changing.
 		 */
 		group->polling_until = now +
-			group->poll_min_period * UPDATES_PER_WINDOW;
+			READ_ONCE(group->poll_min_period) * UPDATES_PER_WINDOW;
 	}
 
 	if (now > group->polling_until) {
@@ -645,11 +669,10 @@ static void psi_poll_work(struct psi_group *group)
 	if (now >= group->polling_next_update)
 		group->polling_next_update = update_triggers(group, now);
 
-	psi_schedule_poll_work(group,
-		nsecs_to_jiffies(group->polling_next_update - now) + 1);
+	psi_schedule_poll_work(group, group->polling_next_update - now);
 
 out:
-	mutex_unlock(&group->trigger_lock);
+	rcu_read_unlock();
 }
 
 static int psi_poll_worker(void *data)
@@ -673,12 +696,15 @@ static int psi_poll_worker(void *data)
 	return 0;
 }
 
-static void poll_timer_fn(struct timer_list *t)
+static enum hrtimer_restart poll_timer_fn(struct hrtimer *timer)
 {
-	struct psi_group *group = from_timer(group, t, poll_timer);
+	struct psi_group *group = container_of(timer, struct psi_group,
+					       poll_timer);
 
 	atomic_set(&group->poll_wakeup, 1);
 	wake_up_interruptible(&group->poll_wait);
+
+	return HRTIMER_NORESTART;
 }
 
 static void record_times(struct psi_group_cpu *groupc, u64 now)
@@ -774,7 +800,7 @@ static void psi_group_change(struct psi_group *group, int cpu,
 	write_seqcount_end(&groupc->seq);
 
 	if (state_mask & group->poll_states)
-		psi_schedule_poll_work(group, 1);
+		psi_schedule_poll_work(group, POLL_WAKE_DELAY);
 
 	if (wake_clock && !delayed_work_pending(&group->avgs_work))
 		schedule_delayed_work(&group->avgs_work, PSI_FREQ);
@@ -804,8 +830,29 @@ static struct psi_group *iterate_groups(struct task_struct *task, void **iter)
 	return &psi_system;
 }
 
-static void psi_flags_change(struct task_struct *task, int clear, int set)
+static void psi_task_stall_charge(struct task_struct *task, u64 now)
+{
+	s64 delta = now - task->psi_stamp;
+
+	/*
+	 * Charge the time since the last change to the task's own stall
+	 * counters. The timestamps can come from different CPUs' clocks
+	 * after a migration, so ignore the rare negative delta.
+	 */
+	if (delta > 0) {
+		if (task->psi_flags & TSK_MEMSTALL)
+			task->psi_memstall_time += delta;
+		if (task->psi_flags & TSK_IOWAIT)
+			task->psi_iowait_time += delta;
+	}
+	task->psi_stamp = now;
+}
+
+static void psi_flags_change(struct task_struct *task, int clear, int set,
+			     u64 now)
 {
+	psi_task_stall_charge(task, now);
+
 	if (((task->psi_flags & set) ||
 	     (task->psi_flags & clear) != clear) &&
 	    !psi_bug) {
@@ -830,9 +877,10 @@ void psi_task_change(struct task_struct *task, int clear, int set)
 	if (!task->pid)
 		return;
 
-	psi_flags_change(task, clear, set);
-
 	now = cpu_clock(cpu);
+
+	psi_flags_change(task, clear, set, now);
+
 	/*
 	 * Periodic aggregation shuts off if there is a period of no
 	 * task changes, so we wake it back up if necessary. However,
@@ -859,7 +907,7 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 	if (next->pid) {
 		bool identical_state;
 
-		psi_flags_change(next, 0, TSK_ONCPU);
+		psi_flags_change(next, 0, TSK_ONCPU, now);
 		/*
 		 * When switching between tasks that have an identical
 		 * runtime state, the cgroup that contains both tasks
@@ -897,7 +945,7 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 				set |= TSK_IOWAIT;
 		}
 
-		psi_flags_change(prev, clear, set);
+		psi_flags_change(prev, clear, set, now);
 
 		iter = NULL;
 		while ((group = iterate_groups(prev, &iter)) && group != common)
@@ -975,6 +1023,59 @@ void psi_memstall_leave(unsigned long *flags)
 	rq_unlock_irq(rq, &rf);
 }
 
+static void psi_task_stall_add(struct task_struct *task, u64 *memstall,
+			       u64 *iowait)
+{
+	unsigned int flags = READ_ONCE(task->psi_flags);
+	s64 delta = 0;
+
+	/* Include the stall that is still in progress, if any */
+	if (flags & (TSK_MEMSTALL | TSK_IOWAIT))
+		delta = max_t(s64, cpu_clock(task_cpu(task)) -
+				   READ_ONCE(task->psi_stamp), 0);
+
+	*memstall += READ_ONCE(task->psi_memstall_time) +
+		     (flags & TSK_MEMSTALL ? delta : 0);
+	*iowait += READ_ONCE(task->psi_iowait_time) +
+		   (flags & TSK_IOWAIT ? delta : 0);
+}
+
+/**
+ * psi_task_stall_time - get the cumulative stall time of a task
+ * @task: the task
+ * @whole: include all live and dead threads of @task's thread group
+ * @memstall: returns the ns spent stalled on memory
+ * @iowait: returns the ns spent waiting for IO
+ *
+ * Unlike the group averages, these are plain totals that the caller can
+ * sample and diff. They're updated locklessly, so a read that races with a
+ * state change may be off by that change.
+ */
+void psi_task_stall_time(struct task_struct *task, bool whole,
+			 u64 *memstall, u64 *iowait)
+{
+	struct task_struct *t = task;
+	unsigned long flags;
+
+	*memstall = 0;
+	*iowait = 0;
+
+	if (static_branch_likely(&psi_disabled))
+		return;
+
+	if (whole && lock_task_sighand(task, &flags)) {
+		*memstall = task->signal->psi_memstall_time;
+		*iowait = task->signal->psi_iowait_time;
+		do {
+			psi_task_stall_add(t, memstall, iowait);
+		} while_each_thread(task, t);
+		unlock_task_sighand(task, &flags);
+		return;
+	}
+
+	psi_task_stall_add(task, memstall, iowait);
+}
+
 #ifdef CONFIG_CGROUPS
 int psi_cgroup_alloc(struct cgroup *cgroup)
 {
@@ -1141,7 +1242,13 @@ struct psi_trigger *psi_trigger_create(struct psi_group *group,
 	t->state = state;
 	t->threshold = threshold_us * NSEC_PER_USEC;
 	t->win.size = window_us * NSEC_PER_USEC;
-	window_reset(&t->win, 0, 0, 0);
+	/*
+	 * Start the window from the current total, so that a trigger
+	 * added while the monitor is already active does not see all
+	 * stall time since boot as growth in its first update.
+	 */
+	window_reset(&t->win, sched_clock(),
+		     group->total[PSI_POLL][t->state], 0);
 
 	t->event = 0;
 	t->last_event_time = 0;
@@ -1164,11 +1271,11 @@ struct psi_trigger *psi_trigger_create(struct psi_group *group,
 		rcu_assign_pointer(group->poll_task, task);
 	}
 
-	list_add(&t->node, &group->triggers);
-	group->poll_min_period = min(group->poll_min_period,
-		div_u64(t->win.size, UPDATES_PER_WINDOW));
+	list_add_rcu(&t->node, &group->triggers);
+	WRITE_ONCE(group->poll_min_period, min(group->poll_min_period,
+		div_u64(t->win.size, UPDATES_PER_WINDOW)));
 	group->nr_triggers[t->state]++;
-	group->poll_states |= (1 << t->state);
+	WRITE_ONCE(group->poll_states, group->poll_states | (1 << t->state));
 
 	mutex_unlock(&group->trigger_lock);
 
@@ -1201,15 +1308,16 @@ void psi_trigger_destroy(struct psi_trigger *t)
 		struct psi_trigger *tmp;
 		u64 period = ULLONG_MAX;
 
-		list_del(&t->node);
+		list_del_rcu(&t->node);
 		group->nr_triggers[t->state]--;
 		if (!group->nr_triggers[t->state])
-			group->poll_states &= ~(1 << t->state);
+			WRITE_ONCE(group->poll_states,
+				   group->poll_states & ~(1 << t->state));
 		/* reset min update period for the remaining triggers */
 		list_for_each_entry(tmp, &group->triggers, node)
 			period = min(period, div_u64(tmp->win.size,
 					UPDATES_PER_WINDOW));
-		group->poll_min_period = period;
+		WRITE_ONCE(group->poll_min_period, period);
 		/* Destroy poll_task when the last trigger is destroyed */
 		if (group->poll_states == 0) {
 			group->polling_until = 0;
@@ -1217,21 +1325,22 @@ void psi_trigger_destroy(struct psi_trigger *t)
 					group->poll_task,
 					lockdep_is_held(&group->trigger_lock));
 			rcu_assign_pointer(group->poll_task, NULL);
-			del_timer(&group->poll_timer);
+			hrtimer_cancel(&group->poll_timer);
+			atomic_set(&group->poll_scheduled, 0);
 		}
 	}
 
 	mutex_unlock(&group->trigger_lock);
 
 	/*
-	 * Wait for psi_schedule_poll_work RCU to complete its read-side
-	 * critical section before destroying the trigger and optionally the
-	 * poll_task.
+	 * Wait for psi_schedule_poll_work and psi_poll_work to complete
+	 * their RCU read-side critical sections before destroying the
+	 * trigger and optionally the poll_task.
 	 */
 	synchronize_rcu();
 	/*
-	 * Stop kthread 'psimon' after releasing trigger_lock to prevent a
-	 * deadlock while waiting for psi_poll_work to acquire trigger_lock
+	 * Stop kthread 'psimon' after releasing trigger_lock, there is no
+	 * reason to hold it while waiting for the monitor to exit.
 	 */
 	if (task_to_destroy) {
 		/*
@@ -931,6 +931,22 @@ struct uclamp_rq {
 DECLARE_STATIC_KEY_FALSE(sched_uclamp_used);
 #endif /* CONFIG_UCLAMP_TASK */
 
+#ifdef CONFIG_SCHEDSTATS
+/*
+ * Wakeup-to-run latency histograms. Bucket 0 counts latencies below 1us,
+ * bucket i counts latencies in [2^(i-1), 2^i) us and the last bucket also
+ * counts everything above.
+ */
+#define WAKELAT_BUCKETS		20
+
+enum wakelat_class {
+	WAKELAT_DL,
+	WAKELAT_RT,
+	WAKELAT_FAIR,
+	NR_WAKELAT_CLASSES
+};
+#endif
+
 /*
  * This is the main, per-CPU runqueue data structure.
  *
@@ -1120,6 +1136,9 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int		ttwu_count;
 	unsigned int		ttwu_local;
+
+	/* wakeup-to-run latency, per class of the woken task */
+	unsigned int		wakelat[NR_WAKELAT_CLASSES][WAKELAT_BUCKETS];
 #endif
 
 #ifdef CONFIG_SMP
@@ -10,11 +10,17 @@
  * Bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
  */
-#define SCHEDSTAT_VERSION 15
+#define SCHEDSTAT_VERSION 16
+
+static const char * const wakelat_names[NR_WAKELAT_CLASSES] = {
+	[WAKELAT_DL]	= "dl",
+	[WAKELAT_RT]	= "rt",
+	[WAKELAT_FAIR]	= "fair",
+};
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
-	int cpu;
+	int cpu, class, i;
 
 	if (v == (void *)1) {
 		seq_printf(seq, "version %d\n", SCHEDSTAT_VERSION);
@@ -39,6 +45,14 @@ static int show_schedstat(struct seq_file *seq, void *v)
 
 		seq_printf(seq, "\n");
 
+		/* wakeup latency histograms, in log2 microsecond buckets */
+		for (class = 0; class < NR_WAKELAT_CLASSES; class++) {
+			seq_printf(seq, "wakelat_%s", wakelat_names[class]);
+			for (i = 0; i < WAKELAT_BUCKETS; i++)
+				seq_printf(seq, " %u", rq->wakelat[class][i]);
+			seq_printf(seq, "\n");
+		}
+
 #ifdef CONFIG_SMP
 		/* domain-specific stats */
 		rcu_read_lock();
@@ -30,6 +30,29 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 	if (rq)
 		rq->rq_sched_info.run_delay += delta;
 }
+
+/*
+ * Expects runqueue lock to be held for atomicity of update
+ */
+static inline void
+rq_sched_info_wakelat(struct rq *rq, struct task_struct *t, long long delta)
+{
+	int class, bucket = 0;
+
+	if (dl_task(t))
+		class = WAKELAT_DL;
+	else if (rt_task(t))
+		class = WAKELAT_RT;
+	else
+		class = WAKELAT_FAIR;
+
+	/* The clocks of the waking and running rqs may differ slightly */
+	if (delta > 0)
+		bucket = min(fls64(div_u64(delta, NSEC_PER_USEC)),
+			     WAKELAT_BUCKETS - 1);
+
+	rq->wakelat[class][bucket]++;
+}
 #define   schedstat_enabled()		static_branch_unlikely(&sched_schedstats)
 #define __schedstat_inc(var)		do { var++; } while (0)
 #define   schedstat_inc(var)		do { if (schedstat_enabled()) { var++; } } while (0)
@@ -44,6 +67,7 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 static inline void rq_sched_info_arrive  (struct rq *rq, unsigned long long delta) { }
 static inline void rq_sched_info_dequeued(struct rq *rq, unsigned long long delta) { }
 static inline void rq_sched_info_depart  (struct rq *rq, unsigned long long delta) { }
+static inline void rq_sched_info_wakelat (struct rq *rq, struct task_struct *t, long long delta) { }
 # define   schedstat_enabled()		0
 # define __schedstat_inc(var)		do { } while (0)
 # define   schedstat_inc(var)		do { } while (0)
@@ -194,6 +218,21 @@ static void sched_info_arrive(struct rq *rq, struct task_struct *t)
 	t->sched_info.pcount++;
 
 	rq_sched_info_arrive(rq, delta);
+
+	if (t->sched_info.last_wakeup) {
+		rq_sched_info_wakelat(rq, t, now - t->sched_info.last_wakeup);
+		t->sched_info.last_wakeup = 0;
+	}
+}
+
+/*
+ * Called when @t is woken up onto @rq, so that the next arrival can account
+ * the wakeup latency.
+ */
+static inline void sched_info_wakeup(struct rq *rq, struct task_struct *t)
+{
+	if (unlikely(sched_info_on()))
+		t->sched_info.last_wakeup = rq_clock(rq);
 }
 
 /*
@@ -260,5 +299,6 @@ sched_info_switch(struct rq *rq, struct task_struct *prev, struct task_struct *n
 # define sched_info_dequeued(rq, t)	do { } while (0)
 # define sched_info_depart(rq, t)	do { } while (0)
 # define sched_info_arrive(rq, next)	do { } while (0)
+# define sched_info_wakeup(rq, t)	do { } while (0)
 # define sched_info_switch(rq, t, next)	do { } while (0)
 #endif /* CONFIG_SCHED_INFO */
@@ -1879,6 +1879,8 @@ static void update_history(struct rq *rq, struct task_struct *p,
 		if (p->unfilter)
 			p->unfilter = max_t(int, 0,
 				p->unfilter - p->ravg.last_win_size);
+
+	walt_ring_task(rq, p, runtime, samples);
 done:
 	trace_sched_update_history(rq, p, runtime, samples, event);
 }
@@ -2088,6 +2090,7 @@ void update_task_ravg(struct task_struct *p, struct rq *rq, int event,
 						u64 wallclock, u64 irqtime)
 {
 	u64 old_window_start;
+	bool cpu_rollover;
 
 	if (!rq->window_start || sched_disable_window_stats ||
 	    p->ravg.mark_start == wallclock)
@@ -2102,11 +2105,17 @@ void update_task_ravg(struct task_struct *p, struct rq *rq, int event,
 		goto done;
 	}
 
+	/* Same condition update_cpu_busy_time() rolls the CPU window on */
+	cpu_rollover = p == rq->curr && p->ravg.mark_start < rq->window_start;
+
 	update_task_rq_cpu_cycles(p, rq, event, wallclock, irqtime);
 	update_task_demand(p, rq, event, wallclock);
 	update_cpu_busy_time(p, rq, event, wallclock, irqtime);
 	update_task_pred_demand(rq, p, event);
 
+	if (cpu_rollover)
+		walt_ring_cpu(rq);
+
 	if (exiting_task(p))
 		goto done;
 
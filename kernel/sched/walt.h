@@ -65,6 +65,24 @@ extern void update_task_ravg(struct task_struct *p, struct rq *rq, int event,
 
 extern unsigned int walt_big_tasks(int cpu);
 
+DECLARE_STATIC_KEY_FALSE(walt_ring_enabled);
+extern void __walt_ring_task(struct rq *rq, struct task_struct *p,
+			     u32 runtime, int samples);
+extern void __walt_ring_cpu(struct rq *rq);
+
+static inline void walt_ring_task(struct rq *rq, struct task_struct *p,
+				  u32 runtime, int samples)
+{
+	if (static_branch_unlikely(&walt_ring_enabled))
+		__walt_ring_task(rq, p, runtime, samples);
+}
+
+static inline void walt_ring_cpu(struct rq *rq)
+{
+	if (static_branch_unlikely(&walt_ring_enabled))
+		__walt_ring_cpu(rq);
+}
+
 static inline void
 inc_nr_big_task(struct walt_sched_stats *stats, struct task_struct *p)
 {
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Per-CPU ring of WALT window rollovers, mapped by userspace governors
+ * so that task demand and CPU busy time can be sampled without a
+ * syscall per window. See include/uapi/linux/sched/walt_ring.h for the
+ * layout and the consumer protocol.
+ *
+ * The rings are mapped through /dev/walt_ring, and for debugging also
+ * through <debugfs>/walt_ring/cpuN.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <uapi/linux/sched/walt_ring.h>
+
+#include "sched.h"
+#include "walt.h"
+
+#define WALT_RING_NR_RECORDS	1024
+#define WALT_RING_SIZE		(PAGE_SIZE + WALT_RING_NR_RECORDS * \
+				 sizeof(struct walt_ring_record))
+
+DEFINE_STATIC_KEY_FALSE(walt_ring_enabled);
+
+/*
+ * Buffers are allocated when a CPU's file is first opened and are never
+ * freed, so the writers only need the pointer to be published once.
+ * Each ring is written under the lock of its CPU's rq.
+ */
+static DEFINE_PER_CPU(struct walt_ring_header *, walt_ring);
+static DEFINE_MUTEX(walt_ring_mutex);
+
+static inline struct walt_ring_record *
+walt_ring_next(struct walt_ring_header *hdr, u64 *seq)
+{
+	struct walt_ring_record *rec;
+
+	*seq = hdr->head + 1;
+	rec = (void *)hdr + hdr->data_offset;
+	rec += hdr->head & (WALT_RING_NR_RECORDS - 1);
+
+	/* Invalidate the slot before overwriting it */
+	WRITE_ONCE(rec->seq, 0);
+	smp_wmb();
+
+	return rec;
+}
+
+static inline void walt_ring_commit(struct walt_ring_header *hdr,
+				    struct walt_ring_record *rec, u64 seq)
+{
+	smp_wmb();
+	WRITE_ONCE(rec->seq, seq);
+	smp_store_release(&hdr->head, seq);
+}
+
+void __walt_ring_task(struct rq *rq, struct task_struct *p,
+		      u32 runtime, int samples)
+{
+	struct walt_ring_header *hdr;
+	struct walt_ring_record *rec;
+	u64 seq;
+
+	lockdep_assert_held(&rq->lock);
+
+	hdr = READ_ONCE(per_cpu(walt_ring, cpu_of(rq)));
+	if (!hdr)
+		return;
+
+	rec = walt_ring_next(hdr, &seq);
+	rec->window_start = rq->window_start;
+	rec->type = WALT_RING_TASK;
+	rec->pid = p->pid;
+	rec->task.runtime = runtime;
+	rec->task.samples = samples;
+	rec->task.demand = p->ravg.demand;
+	rec->task.pred_demand = p->ravg.pred_demand;
+	rec->task.demand_scaled = p->ravg.demand_scaled;
+	rec->task.pred_demand_scaled = p->ravg.pred_demand_scaled;
+	walt_ring_commit(hdr, rec, seq);
+}
+
+void __walt_ring_cpu(struct rq *rq)
+{
+	struct walt_ring_header *hdr;
+	struct walt_ring_record *rec;
+	u64 seq;
+
+	lockdep_assert_held(&rq->lock);
+
+	hdr = READ_ONCE(per_cpu(walt_ring, cpu_of(rq)));
+	if (!hdr)
+		return;
+
+	rec = walt_ring_next(hdr, &seq);
+	rec->window_start = rq->window_start;
+	rec->type = WALT_RING_CPU;
+	rec->pid = 0;
+	rec->cpu.busy = rq->prev_runnable_sum;
+	rec->cpu.nt_busy = rq->nt_prev_runnable_sum;
+	rec->cpu.grp_busy = rq->grp_time.prev_runnable_sum;
+	rec->cpu.grp_nt_busy = rq->grp_time.nt_prev_runnable_sum;
+	rec->cpu.window_size = rq->prev_window_size;
+	walt_ring_commit(hdr, rec, seq);
+}
+
+/* Returns the ring of @cpu, allocating it on first use */
+static struct walt_ring_header *walt_ring_get(int cpu)
+{
+	struct walt_ring_header *hdr;
+
+	mutex_lock(&walt_ring_mutex);
+	hdr = per_cpu(walt_ring, cpu);
+	if (!hdr) {
+		hdr = vmalloc_user(WALT_RING_SIZE);
+		if (!hdr) {
+			mutex_unlock(&walt_ring_mutex);
+			return NULL;
+		}
+		hdr->magic = WALT_RING_MAGIC;
+		hdr->version = WALT_RING_VERSION;
+		hdr->cpu = cpu;
+		hdr->nr_records = WALT_RING_NR_RECORDS;
+		hdr->record_size = sizeof(struct walt_ring_record);
+		hdr->data_offset = PAGE_SIZE;
+		smp_store_release(&per_cpu(walt_ring, cpu), hdr);
+		static_branch_enable(&walt_ring_enabled);
+	}
+	mutex_unlock(&walt_ring_mutex);
+
+	return hdr;
+}
+
+/* Map the start of @hdr, read-only, into @vma */
+static int walt_ring_map(struct walt_ring_header *hdr,
+			 struct vm_area_struct *vma)
+{
+	if (vma->vm_end - vma->vm_start > WALT_RING_SIZE)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, hdr, 0);
+}
+
+/*
+ * /dev/walt_ring: the ring of CPU n is mapped at offset
+ * n << WALT_RING_MMAP_SHIFT.
+ */
+static int walt_ring_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned long shift = WALT_RING_MMAP_SHIFT - PAGE_SHIFT;
+	unsigned long cpu = vma->vm_pgoff >> shift;
+	struct walt_ring_header *hdr;
+
+	if (vma->vm_pgoff & ((1UL << shift) - 1))
+		return -EINVAL;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -ENODEV;
+
+	hdr = walt_ring_get(cpu);
+	if (!hdr)
+		return -ENOMEM;
+
+	return walt_ring_map(hdr, vma);
+}
+
+static const struct file_operations walt_ring_dev_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nonseekable_open,
+	.mmap		= walt_ring_dev_mmap,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice walt_ring_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "walt_ring",
+	.fops		= &walt_ring_dev_fops,
+	.mode		= 0400,
+};
+
+static int walt_ring_open(struct inode *inode, struct file *file)
+{
+	int cpu = (long)inode->i_private;
+
+	file->private_data = walt_ring_get(cpu);
+	if (!file->private_data)
+		return -ENOMEM;
+
+	return nonseekable_open(inode, file);
+}
+
+static int walt_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	return walt_ring_map(file->private_data, vma);
+}
+
+static const struct file_operations walt_ring_fops = {
+	.owner		= THIS_MODULE,
+	.open		= walt_ring_open,
+	.mmap		= walt_ring_mmap,
+	.llseek		= no_llseek,
+};
+
+static int __init walt_ring_init(void)
+{
+	struct dentry *dir;
+	char name[16];
+	int cpu;
+
+	BUILD_BUG_ON(sizeof(struct walt_ring_header) > PAGE_SIZE);
+	BUILD_BUG_ON_NOT_POWER_OF_2(WALT_RING_NR_RECORDS);
+	BUILD_BUG_ON(sizeof(struct walt_ring_record) != 64);
+	BUILD_BUG_ON(WALT_RING_SIZE > 1UL << WALT_RING_MMAP_SHIFT);
+
+	if (misc_register(&walt_ring_dev))
+		pr_warn("walt_ring: cannot register /dev/walt_ring\n");
+
+	/* Debugging only, the device is the interface */
+	dir = debugfs_create_dir("walt_ring", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		snprintf(name, sizeof(name), "cpu%d", cpu);
+		debugfs_create_file(name, 0400, dir, (void *)(long)cpu,
+				    &walt_ring_fops);
+	}
+
+	return 0;
+}
+late_initcall(walt_ring_init);
@@ -258,6 +258,7 @@ asmlinkage __visible void __softirq_entry __do_softirq(void)
 	__u32 deferred;
 	__u32 pending;
 	int softirq_bit;
+	u64 sbalance_start;
 
 	/*
 	 * Mask out PF_MEMALLOC s current task context is borrowed for the
@@ -271,6 +272,7 @@ asmlinkage __visible void __softirq_entry __do_softirq(void)
 	account_irq_enter_time(current);
 	__local_bh_disable_ip(_RET_IP_, SOFTIRQ_OFFSET);
 	in_hardirq = lockdep_softirq_start();
+	sbalance_start = sbalance_softirq_start();
 
 restart:
 	/* Reset the pending bitmask before enabling irqs */
@@ -320,6 +322,7 @@ asmlinkage __visible void __softirq_entry __do_softirq(void)
 
 	if (pending | deferred)
 		wakeup_softirqd();
+	sbalance_softirq_end(sbalance_start);
 	lockdep_softirq_end(in_hardirq);
 	account_irq_exit_time(current);
 	__local_bh_enable(SOFTIRQ_OFFSET);
@@ -4276,7 +4276,9 @@ static long get_nr_to_scan(struct lruvec *lruvec, struct scan_control *sc, int s
 	return walk_mm_list(lruvec, max_seq, sc, swappiness, NULL) ? nr_to_scan : 0;
 }
 
-static unsigned long lru_gen_shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
+/* A negative swappiness means the per-memcg one, unless swap is not allowed. */
+static unsigned long __lru_gen_shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc,
+					     int force_swappiness)
 {
 	struct blk_plug plug;
 	unsigned long eligible;
@@ -4288,7 +4290,8 @@ static unsigned long lru_gen_shrink_lruvec(struct lruvec *lruvec, struct scan_co
 
 	while (true) {
 		long nr_to_scan;
-		int swappiness = sc->may_swap ? get_swappiness(lruvec) : 0;
+		int swappiness = force_swappiness >= 0 ? force_swappiness :
+				 sc->may_swap ? get_swappiness(lruvec) : 0;
 
 		nr_to_scan = get_nr_to_scan(lruvec, sc, swappiness, &eligible) - scanned;
 		if (nr_to_scan < (long)SWAP_CLUSTER_MAX)
@@ -4312,6 +4315,11 @@ static unsigned long lru_gen_shrink_lruvec(struct lruvec *lruvec, struct scan_co
 	return eligible;
 }
 
+static unsigned long lru_gen_shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
+{
+	return __lru_gen_shrink_lruvec(lruvec, sc, -1);
+}
+
 /******************************************************************************
  *                          the background aging
  ******************************************************************************/
@@ -4821,6 +4829,7 @@ static const struct seq_operations lru_gen_seq_ops = {
 	.show = lru_gen_seq_show,
 };
 
+/* Ages the lruvec until max_seq is past seq, i.e., seq is no longer the youngest. */
 static int advance_max_seq(struct lruvec *lruvec, unsigned long seq, int swappiness)
 {
 	struct scan_control sc = {
@@ -4828,10 +4837,78 @@ static int advance_max_seq(struct lruvec *lruvec, unsigned long seq, int swappin
 	};
 	DEFINE_MAX_SEQ();
 
-	if (seq == max_seq)
+	if (seq >= max_seq + MAX_NR_GENS)
+		return -EINVAL;
+
+	while (seq >= max_seq) {
+		if (signal_pending(current))
+			return -EINTR;
+
 		walk_mm_list(lruvec, max_seq, &sc, swappiness, NULL);
+		cond_resched();
+
+		max_seq = READ_ONCE(lruvec->evictable.max_seq);
+	}
+
+	return 0;
+}
+
+/* The number of pages in the types that eviction at this swappiness can reclaim. */
+static unsigned long get_nr_evictable(struct lruvec *lruvec, int swappiness)
+{
+	int gen, type, zone;
+	long size = 0;
+	struct lrugen *lrugen = &lruvec->evictable;
+	DEFINE_MAX_SEQ();
+	DEFINE_MIN_SEQ();
+
+	for (type = !swappiness; type <= (swappiness < 200); type++) {
+		unsigned long seq;
+
+		for (seq = min_seq[type]; seq <= max_seq; seq++) {
+			gen = lru_gen_from_seq(seq);
+
+			for (zone = 0; zone < MAX_NR_ZONES; zone++)
+				size += READ_ONCE(lrugen->sizes[gen][type][zone]);
+		}
+	}
+
+	return max(size, 0L);
+}
 
-	return seq > max_seq ? -EINVAL : 0;
+/*
+ * Evicts from the oldest generations until the types allowed by swappiness take
+ * no more than the given number of bytes, aging the lruvec as necessary.
+ */
+static int shrink_to_bytes(struct lruvec *lruvec, unsigned long bytes, int swappiness)
+{
+	unsigned long nr_pages;
+	unsigned long target = bytes >> PAGE_SHIFT;
+	struct scan_control sc = {
+		.target_mem_cgroup = lruvec_memcg(lruvec),
+		.may_writepage = 1,
+		.may_unmap = 1,
+		.may_swap = 1,
+		.reclaim_idx = MAX_NR_ZONES - 1,
+		.gfp_mask = GFP_KERNEL,
+	};
+
+	while ((nr_pages = get_nr_evictable(lruvec, swappiness)) > target) {
+		if (signal_pending(current))
+			return -EINTR;
+
+		sc.nr_reclaimed = 0;
+		sc.nr_to_reclaim = nr_pages - target;
+		__lru_gen_shrink_lruvec(lruvec, &sc, swappiness);
+
+		/* the remaining pages are not reclaimable right now */
+		if (!sc.nr_reclaimed)
+			return -EAGAIN;
+
+		cond_resched();
+	}
+
+	return 0;
 }
 
 static int advance_min_seq(struct lruvec *lruvec, unsigned long seq, int swappiness,
@@ -4912,6 +4989,10 @@ static int advance_seq(char cmd, int memcg_id, int nid, unsigned long seq,
 	case '-':
 		err = advance_min_seq(lruvec, seq, swappiness, nr_to_reclaim);
 		break;
+	case '=':
+		/* seq is a size in bytes for this command */
+		err = shrink_to_bytes(lruvec, seq, swappiness);
+		break;
 	}
 done:
 	mem_cgroup_put(memcg);
@@ -4989,6 +5070,180 @@ static const struct file_operations lru_gen_ro_fops = {
 	.release = seq_release,
 };
 
+/*
+ * lru_gen_snapshot is a binary equivalent of lru_gen_full for tools that poll
+ * many memcgs: a header followed by one fixed-size record per lruvec, in the
+ * same order. Userspace sizes the arrays from the header and can read the
+ * whole file with a single pread().
+ */
+#define LRU_GEN_SNAPSHOT_MAGIC		0x4c525547	/* "LRUG" */
+#define LRU_GEN_SNAPSHOT_VERSION	1
+
+struct lru_gen_snapshot_hdr {
+	u32 magic;
+	u32 version;
+	u32 nr_gens;
+	u32 nr_tiers;
+	u32 nr_types;
+	u32 record_size;
+	/* jiffies_to_msecs(jiffies) when the header was generated */
+	u64 timestamp_ms;
+};
+
+struct lru_gen_snapshot {
+	u32 memcg_id;
+	u32 nid;
+	u64 max_seq;
+	u64 min_seq[ANON_AND_FILE];
+	/* gens[i] is max_seq - i; sizes below min_seq[type] are 0 */
+	struct {
+		u64 seq;
+		u64 age_ms;
+		u64 sizes[ANON_AND_FILE];
+	} gens[MAX_NR_GENS];
+	/* for the oldest generation of each type, as used by eviction */
+	struct {
+		u64 refaulted;
+		u64 evicted;
+		u64 activated;
+		u64 avg_refaulted;
+		u64 avg_total;
+	} tiers[MAX_NR_TIERS][ANON_AND_FILE];
+};
+
+static void *lru_gen_snapshot_start(struct seq_file *m, loff_t *pos)
+{
+	loff_t nr_to_skip = *pos - 1;
+
+	if (!*pos)
+		return SEQ_START_TOKEN;
+
+	/* m->private holds a record rather than a cgroup path */
+	return lru_gen_seq_start(m, &nr_to_skip);
+}
+
+static void lru_gen_snapshot_stop(struct seq_file *m, void *v)
+{
+	if (v != SEQ_START_TOKEN)
+		lru_gen_seq_stop(m, v);
+}
+
+static void *lru_gen_snapshot_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	if (v != SEQ_START_TOKEN)
+		return lru_gen_seq_next(m, v, pos);
+
+	++*pos;
+
+	m->private = kzalloc(PATH_MAX, GFP_KERNEL);
+	if (!m->private)
+		return ERR_PTR(-ENOMEM);
+
+	return mem_cgroup_lruvec(NODE_DATA(first_memory_node),
+				 mem_cgroup_iter(NULL, NULL, NULL));
+}
+
+static void lru_gen_snapshot_fill(struct lru_gen_snapshot *snap,
+				  struct lruvec *lruvec)
+{
+	int i, type, tier, zone;
+	struct lrugen *lrugen = &lruvec->evictable;
+	unsigned long now = jiffies;
+	DEFINE_MAX_SEQ();
+	DEFINE_MIN_SEQ();
+
+	memset(snap, 0, sizeof(*snap));
+
+	snap->memcg_id = mem_cgroup_id(lruvec_memcg(lruvec));
+	snap->nid = lruvec_pgdat(lruvec)->node_id;
+	snap->max_seq = max_seq;
+
+	for (type = 0; type < ANON_AND_FILE; type++)
+		snap->min_seq[type] = min_seq[type];
+
+	for (i = 0; i < MAX_NR_GENS && i <= max_seq; i++) {
+		unsigned long seq = max_seq - i;
+		int gen = lru_gen_from_seq(seq);
+
+		snap->gens[i].seq = seq;
+		snap->gens[i].age_ms = jiffies_to_msecs(now -
+					READ_ONCE(lrugen->timestamps[gen]));
+
+		for (type = 0; type < ANON_AND_FILE; type++) {
+			long size = 0;
+
+			if (seq < min_seq[type])
+				continue;
+
+			for (zone = 0; zone < MAX_NR_ZONES; zone++)
+				size += READ_ONCE(lrugen->sizes[gen][type][zone]);
+
+			snap->gens[i].sizes[type] = max(size, 0L);
+		}
+	}
+
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		int hist = hist_from_seq_or_gen(min_seq[type]);
+
+		for (tier = 0; tier < MAX_NR_TIERS; tier++) {
+			typeof(snap->tiers[0][0]) *t = &snap->tiers[tier][type];
+
+			t->refaulted = atomic_long_read(
+					&lrugen->refaulted[hist][type][tier]);
+			t->evicted = atomic_long_read(
+					&lrugen->evicted[hist][type][tier]);
+			if (tier)
+				t->activated = READ_ONCE(
+					lrugen->activated[hist][type][tier - 1]);
+			t->avg_refaulted =
+				READ_ONCE(lrugen->avg_refaulted[type][tier]);
+			t->avg_total = READ_ONCE(lrugen->avg_total[type][tier]);
+		}
+	}
+}
+
+static int lru_gen_snapshot_show(struct seq_file *m, void *v)
+{
+	if (v == SEQ_START_TOKEN) {
+		struct lru_gen_snapshot_hdr hdr = {
+			.magic = LRU_GEN_SNAPSHOT_MAGIC,
+			.version = LRU_GEN_SNAPSHOT_VERSION,
+			.nr_gens = MAX_NR_GENS,
+			.nr_tiers = MAX_NR_TIERS,
+			.nr_types = ANON_AND_FILE,
+			.record_size = sizeof(struct lru_gen_snapshot),
+			.timestamp_ms = jiffies_to_msecs(jiffies),
+		};
+
+		seq_write(m, &hdr, sizeof(hdr));
+		return 0;
+	}
+
+	lru_gen_snapshot_fill(m->private, v);
+	seq_write(m, m->private, sizeof(struct lru_gen_snapshot));
+
+	return 0;
+}
+
+static const struct seq_operations lru_gen_snapshot_ops = {
+	.start = lru_gen_snapshot_start,
+	.stop = lru_gen_snapshot_stop,
+	.next = lru_gen_snapshot_next,
+	.show = lru_gen_snapshot_show,
+};
+
+static int lru_gen_snapshot_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &lru_gen_snapshot_ops);
+}
+
+static const struct file_operations lru_gen_snapshot_fops = {
+	.open = lru_gen_snapshot_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
 /******************************************************************************
  *                          initialization
  ******************************************************************************/
@@ -5015,6 +5270,7 @@ static int __init init_lru_gen(void)
 	BUILD_BUG_ON(MIN_NR_GENS + 1 >= MAX_NR_GENS);
 	BUILD_BUG_ON(BIT(LRU_GEN_WIDTH) <= MAX_NR_GENS);
 	BUILD_BUG_ON(sizeof(MM_STAT_CODES) != NR_MM_STATS + 1);
+	BUILD_BUG_ON(sizeof(struct lru_gen_snapshot) > PATH_MAX);
 
 	VM_BUG_ON(PMD_SIZE / PAGE_SIZE != PTRS_PER_PTE);
 	VM_BUG_ON(PUD_SIZE / PMD_SIZE != PTRS_PER_PMD);
@@ -5034,6 +5290,8 @@ static int __init init_lru_gen(void)
 
 	debugfs_create_file("lru_gen", 0644, NULL, NULL, &lru_gen_rw_fops);
 	debugfs_create_file("lru_gen_full", 0444, NULL, NULL, &lru_gen_ro_fops);
+	debugfs_create_file("lru_gen_snapshot", 0444, NULL, NULL,
+			    &lru_gen_snapshot_fops);
 
 	return 0;
 };
@@ -54,8 +54,11 @@
 #include <linux/mount.h>
 #include <linux/migrate.h>
 #include <linux/wait.h>
+#include <linux/wait_bit.h>
 #include <linux/pagemap.h>
 #include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 #define ZSPAGE_MAGIC	0x58
 
@@ -196,6 +199,66 @@ static struct vfsmount *zsmalloc_mnt;
 static const int fullness_threshold_frac = 4;
 static size_t huge_class_size;
 
+/*
+ * Per-CPU magazine of allocated objects of a size_class, so that bursts
+ * of zs_malloc/zs_free don't take class->lock for every object. Objects
+ * keep their handle while cached. An empty magazine is refilled and a
+ * full one flushed ZS_MAGAZINE_BATCH objects at a time.
+ */
+#define ZS_MAGAZINE_SIZE	16
+#define ZS_MAGAZINE_BATCH	(ZS_MAGAZINE_SIZE / 2)
+
+struct zs_magazine {
+	spinlock_t lock;
+	unsigned int nr;
+	unsigned long handles[ZS_MAGAZINE_SIZE];
+	unsigned long alloc_hit;
+	unsigned long alloc_miss;
+	unsigned long free_hit;
+	unsigned long flush;
+};
+
+static bool zs_magazine_enabled __read_mostly = true;
+module_param_named(magazine, zs_magazine_enabled, bool, 0644);
+
+/*
+ * Background compaction: every compact_interval_ms, zs_compactd walks
+ * the pools and compacts the classes whose freeable pages reach
+ * compact_frag_pct percent of their pages, moving at most
+ * compact_batch source zspages per class and round. An interval of 0
+ * disables it, and zs_compactd then sleeps until it is set again.
+ */
+static unsigned int zs_compact_interval_ms __read_mostly = 1000;
+static unsigned int zs_compact_frag_pct __read_mostly = 25;
+module_param_named(compact_frag_pct, zs_compact_frag_pct, uint, 0644);
+static unsigned int zs_compact_batch __read_mostly = 16;
+module_param_named(compact_batch, zs_compact_batch, uint, 0644);
+
+static LIST_HEAD(zs_pools);
+static DEFINE_MUTEX(zs_pools_lock);
+static struct task_struct *zs_compactd;
+/* Bumped for every pass of zs_compactd over zs_pools */
+static unsigned long zs_compactd_seq;
+
+static int zs_compact_interval_set(const char *val,
+				   const struct kernel_param *kp)
+{
+	int ret;
+
+	ret = param_set_uint(val, kp);
+	if (!ret && zs_compactd)
+		wake_up_process(zs_compactd);
+
+	return ret;
+}
+
+static const struct kernel_param_ops zs_compact_interval_ops = {
+	.set = zs_compact_interval_set,
+	.get = param_get_uint,
+};
+module_param_cb(compact_interval_ms, &zs_compact_interval_ops,
+		&zs_compact_interval_ms, 0644);
+
 struct size_class {
 	spinlock_t lock;
 	struct list_head fullness_list[NR_ZS_FULLNESS];
@@ -210,6 +273,8 @@ struct size_class {
 
 	unsigned int index;
 	struct zs_size_stat stats;
+	/* NULL for huge classes */
+	struct zs_magazine __percpu *mag;
 };
 
 /* huge object: pages_per_zspage == 1 && maxobj_per_zspage == 1 */
@@ -261,6 +326,12 @@ struct zs_pool {
 
 	/* Compact classes */
 	struct shrinker shrinker;
+	/* Entry in zs_pools, walked by zs_compactd */
+	struct list_head list;
+	/* Last pass of zs_compactd over the pool, under zs_pools_lock */
+	unsigned long compactd_seq;
+	/* Held by zs_compactd while it works on the pool unlocked */
+	atomic_t compactd_refs;
 
 #ifdef CONFIG_ZSMALLOC_STAT
 	struct dentry *stat_dentry;
@@ -306,6 +377,7 @@ static int zs_register_migration(struct zs_pool *pool);
 static void zs_unregister_migration(struct zs_pool *pool);
 static void migrate_lock_init(struct zspage *zspage);
 static void migrate_read_lock(struct zspage *zspage);
+static bool migrate_read_trylock(struct zspage *zspage);
 static void migrate_read_unlock(struct zspage *zspage);
 static void kick_deferred_free(struct zs_pool *pool);
 static void init_deferred_free(struct zs_pool *pool);
@@ -317,6 +389,7 @@ static int zs_register_migration(struct zs_pool *pool) { return 0; }
 static void zs_unregister_migration(struct zs_pool *pool) {}
 static void migrate_lock_init(struct zspage *zspage) {}
 static void migrate_read_lock(struct zspage *zspage) {}
+static bool migrate_read_trylock(struct zspage *zspage) { return true; }
 static void migrate_read_unlock(struct zspage *zspage) {}
 static void kick_deferred_free(struct zs_pool *pool) {}
 static void init_deferred_free(struct zs_pool *pool) {}
@@ -650,6 +723,77 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 }
 DEFINE_SHOW_ATTRIBUTE(zs_stats_size);
 
+static int zs_stats_magazine_show(struct seq_file *s, void *v)
+{
+	int i, cpu;
+	struct zs_pool *pool = s->private;
+	struct size_class *class;
+	struct zs_magazine *mag;
+	unsigned long alloc_hit, alloc_miss, free_hit, flush, cached;
+	unsigned long total_alloc_hit = 0, total_alloc_miss = 0;
+	unsigned long total_free_hit = 0, total_flush = 0, total_cached = 0;
+
+	seq_printf(s, "magazine: %s\n",
+			zs_magazine_enabled ? "enabled" : "disabled");
+	seq_printf(s, " %5s %5s %10s %10s %10s %10s %8s\n",
+			"class", "size", "alloc_hit", "alloc_miss",
+			"free_hit", "flush", "cached");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = pool->size_class[i];
+
+		if (class->index != i || !class->mag)
+			continue;
+
+		alloc_hit = alloc_miss = free_hit = flush = cached = 0;
+		for_each_possible_cpu(cpu) {
+			mag = per_cpu_ptr(class->mag, cpu);
+			spin_lock(&mag->lock);
+			alloc_hit += mag->alloc_hit;
+			alloc_miss += mag->alloc_miss;
+			free_hit += mag->free_hit;
+			flush += mag->flush;
+			cached += mag->nr;
+			spin_unlock(&mag->lock);
+		}
+
+		seq_printf(s, " %5u %5u %10lu %10lu %10lu %10lu %8lu\n",
+			i, class->size, alloc_hit, alloc_miss, free_hit,
+			flush, cached);
+
+		total_alloc_hit += alloc_hit;
+		total_alloc_miss += alloc_miss;
+		total_free_hit += free_hit;
+		total_flush += flush;
+		total_cached += cached;
+	}
+
+	seq_puts(s, "\n");
+	seq_printf(s, " %5s %5s %10lu %10lu %10lu %10lu %8lu\n",
+			"Total", "", total_alloc_hit, total_alloc_miss,
+			total_free_hit, total_flush, total_cached);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zs_stats_magazine);
+
+static int zs_stats_compaction_show(struct seq_file *s, void *v)
+{
+	struct zs_pool *pool = s->private;
+
+	seq_printf(s, "pages_compacted %lu\n",
+		atomic_long_read(&pool->stats.pages_compacted));
+	seq_printf(s, "bg_pages_compacted %lu\n",
+		atomic_long_read(&pool->stats.bg_pages_compacted));
+	seq_printf(s, "bg_objs_migrated %lu\n",
+		atomic_long_read(&pool->stats.bg_objs_migrated));
+	seq_printf(s, "bg_compact_us %lu\n",
+		atomic_long_read(&pool->stats.bg_compact_us));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zs_stats_compaction);
+
 static void zs_pool_stat_create(struct zs_pool *pool, const char *name)
 {
 	struct dentry *entry;
@@ -674,7 +818,22 @@ static void zs_pool_stat_create(struct zs_pool *pool, const char *name)
 				name, "classes");
 		debugfs_remove_recursive(pool->stat_dentry);
 		pool->stat_dentry = NULL;
+		return;
 	}
+
+	entry = debugfs_create_file("magazine", S_IFREG | 0444,
+				    pool->stat_dentry, pool,
+				    &zs_stats_magazine_fops);
+	if (!entry)
+		pr_warn("%s: debugfs file entry <%s> creation failed\n",
+				name, "magazine");
+
+	entry = debugfs_create_file("compaction", S_IFREG | 0444,
+				    pool->stat_dentry, pool,
+				    &zs_stats_compaction_fops);
+	if (!entry)
+		pr_warn("%s: debugfs file entry <%s> creation failed\n",
+				name, "compaction");
 }
 
 static void zs_pool_stat_destroy(struct zs_pool *pool)
@@ -1422,6 +1581,27 @@ size_t zs_huge_class_size(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_huge_class_size);
 
+/**
+ * zs_lookup_class_index() - Returns index of the zsmalloc &size_class
+ * that hold objects of the provided size.
+ * @pool: zsmalloc pool to use
+ * @size: object size
+ *
+ * Context: Any context.
+ *
+ * Return: the index of the zsmalloc &size_class that hold objects of the
+ * provided size.
+ */
+unsigned int zs_lookup_class_index(struct zs_pool *pool, unsigned int size)
+{
+	struct size_class *class;
+
+	class = pool->size_class[get_size_class_index(size)];
+
+	return class->index;
+}
+EXPORT_SYMBOL_GPL(zs_lookup_class_index);
+
 static unsigned long obj_malloc(struct size_class *class,
 				struct zspage *zspage, unsigned long handle)
 {
@@ -1463,6 +1643,34 @@ static unsigned long obj_malloc(struct size_class *class,
 	return obj;
 }
 
+/*
+ * Allocate the first object of a freshly allocated zspage and make the
+ * zspage visible to the class. Called with class->lock held.
+ */
+static void obj_malloc_new_zspage(struct zs_pool *pool,
+		struct size_class *class, struct zspage *zspage,
+		unsigned long handle)
+{
+	enum fullness_group newfg;
+	unsigned long obj;
+
+	obj = obj_malloc(class, zspage, handle);
+	newfg = get_fullness_group(class, zspage);
+	insert_zspage(class, zspage, newfg);
+	set_zspage_mapping(zspage, class->index, newfg);
+	record_obj(handle, obj);
+	atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+	zs_stat_inc(class, OBJ_ALLOCATED, class->objs_per_zspage);
+
+	/* We completely set up zspage so mark them as movable */
+	SetZsPageMovable(pool, zspage);
+}
+
+static unsigned long zs_magazine_alloc(struct zs_pool *pool,
+				       struct size_class *class);
+static void zs_magazine_free(struct zs_pool *pool, struct size_class *class,
+			     unsigned long handle);
 
 /**
  * zs_malloc - Allocate block of given size from pool.
@@ -1478,20 +1686,25 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t gfp)
 {
 	unsigned long handle, obj;
 	struct size_class *class;
-	enum fullness_group newfg;
 	struct zspage *zspage;
 
 	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
 		return 0;
 
-	handle = cache_alloc_handle(pool, gfp);
-	if (!handle)
-		return 0;
-
 	/* extra space in chunk to keep the handle */
 	size += ZS_HANDLE_SIZE;
 	class = pool->size_class[get_size_class_index(size)];
 
+	if (class->mag && READ_ONCE(zs_magazine_enabled)) {
+		handle = zs_magazine_alloc(pool, class);
+		if (handle)
+			return handle;
+	}
+
+	handle = cache_alloc_handle(pool, gfp);
+	if (!handle)
+		return 0;
+
 	spin_lock(&class->lock);
 	zspage = find_get_zspage(class);
 	if (likely(zspage)) {
@@ -1513,23 +1726,94 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t gfp)
 	}
 
 	spin_lock(&class->lock);
-	obj = obj_malloc(class, zspage, handle);
-	newfg = get_fullness_group(class, zspage);
-	insert_zspage(class, zspage, newfg);
-	set_zspage_mapping(zspage, class->index, newfg);
-	record_obj(handle, obj);
-	atomic_long_add(class->pages_per_zspage,
-				&pool->pages_allocated);
-	zs_stat_inc(class, OBJ_ALLOCATED, class->objs_per_zspage);
-
-	/* We completely set up zspage so mark them as movable */
-	SetZsPageMovable(pool, zspage);
+	obj_malloc_new_zspage(pool, class, zspage, handle);
 	spin_unlock(&class->lock);
 
 	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
+/**
+ * zs_malloc_bulk - Allocate several blocks from pool at once.
+ * @pool: pool to allocate from
+ * @sizes: sizes of the blocks to allocate
+ * @handles: array receiving the handles
+ * @nr: number of blocks
+ * @gfp: gfp flags when allocating objects
+ *
+ * Handles are taken from the handle cache in one go and consecutive
+ * blocks falling into the same size class are carved out under a single
+ * class->lock acquisition, so callers should pass blocks sorted by size.
+ *
+ * Returns the number of blocks allocated, in order. The remaining
+ * entries of @handles are set to 0 and the caller may fall back to
+ * zs_malloc() for them.
+ */
+int zs_malloc_bulk(struct zs_pool *pool, const size_t *sizes,
+		   unsigned long *handles, int nr, gfp_t gfp)
+{
+	struct size_class *class = NULL;
+	struct size_class *next;
+	struct zspage *zspage;
+	unsigned long obj;
+	int i;
+
+	if (!kmem_cache_alloc_bulk(pool->handle_cachep,
+			gfp & ~(__GFP_HIGHMEM|__GFP_MOVABLE|__GFP_CMA),
+			nr, (void **)handles)) {
+		memset(handles, 0, nr * sizeof(*handles));
+		return 0;
+	}
+
+	for (i = 0; i < nr; i++) {
+		size_t size = sizes[i];
+
+		if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+			break;
+
+		/* extra space in chunk to keep the handle */
+		size += ZS_HANDLE_SIZE;
+		next = pool->size_class[get_size_class_index(size)];
+		if (next != class) {
+			if (class)
+				spin_unlock(&class->lock);
+			class = next;
+			spin_lock(&class->lock);
+		}
+
+		zspage = find_get_zspage(class);
+		if (likely(zspage)) {
+			obj = obj_malloc(class, zspage, handles[i]);
+			/* Now move the zspage to another fullness group */
+			fix_fullness_group(class, zspage);
+			record_obj(handles[i], obj);
+			continue;
+		}
+
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, gfp);
+		if (!zspage) {
+			class = NULL;
+			break;
+		}
+
+		spin_lock(&class->lock);
+		obj_malloc_new_zspage(pool, class, zspage, handles[i]);
+	}
+
+	if (class)
+		spin_unlock(&class->lock);
+
+	if (i < nr) {
+		kmem_cache_free_bulk(pool->handle_cachep, nr - i,
+				(void **)&handles[i]);
+		memset(&handles[i], 0, (nr - i) * sizeof(*handles));
+	}
+
+	return i;
+}
+EXPORT_SYMBOL_GPL(zs_malloc_bulk);
+
 static void obj_free(struct size_class *class, unsigned long obj)
 {
 	struct link_free *link;
@@ -1555,7 +1839,7 @@ static void obj_free(struct size_class *class, unsigned long obj)
 	zs_stat_dec(class, OBJ_USED, 1);
 }
 
-void zs_free(struct zs_pool *pool, unsigned long handle)
+static void __zs_free(struct zs_pool *pool, unsigned long handle, bool cache)
 {
 	struct zspage *zspage;
 	struct page *f_page;
@@ -1574,10 +1858,19 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	obj_to_location(obj, &f_page, &f_objidx);
 	zspage = get_zspage(f_page);
 
-	migrate_read_lock(zspage);
-
+	/*
+	 * The pinned object can't leave the zspage, and a zspage never
+	 * changes class, so the class is stable without the zspage lock.
+	 */
 	get_zspage_mapping(zspage, &class_idx, &fullness);
 	class = pool->size_class[class_idx];
+	if (cache && class->mag && READ_ONCE(zs_magazine_enabled)) {
+		unpin_tag(handle);
+		zs_magazine_free(pool, class, handle);
+		return;
+	}
+
+	migrate_read_lock(zspage);
 
 	spin_lock(&class->lock);
 	obj_free(class, obj);
@@ -1598,8 +1891,194 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	unpin_tag(handle);
 	cache_free_handle(pool, handle);
 }
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	__zs_free(pool, handle, true);
+}
 EXPORT_SYMBOL_GPL(zs_free);
 
+/*
+ * Free @nr cached objects of @class, together with their handles,
+ * under a single class->lock acquisition.
+ */
+static void zs_free_batch(struct zs_pool *pool, struct size_class *class,
+			  unsigned long *handles, int nr)
+{
+	unsigned long slow[ZS_MAGAZINE_SIZE];
+	enum fullness_group fullness;
+	struct zspage *zspage;
+	struct page *f_page;
+	unsigned int f_objidx;
+	unsigned long obj;
+	int i, nr_freed = 0, nr_slow = 0;
+	bool isolated;
+
+	for (i = 0; i < nr; i++)
+		pin_tag(handles[i]);
+
+	spin_lock(&class->lock);
+	for (i = 0; i < nr; i++) {
+		obj = handle_to_obj(handles[i]);
+		obj_to_location(obj, &f_page, &f_objidx);
+		zspage = get_zspage(f_page);
+
+		/*
+		 * Migration takes the zspage lock before class->lock, so
+		 * leave objects of a zspage under migration to zs_free.
+		 */
+		if (!migrate_read_trylock(zspage)) {
+			slow[nr_slow++] = handles[i];
+			continue;
+		}
+
+		obj_free(class, obj);
+		fullness = fix_fullness_group(class, zspage);
+		if (fullness != ZS_EMPTY) {
+			migrate_read_unlock(zspage);
+		} else {
+			isolated = is_zspage_isolated(zspage);
+			migrate_read_unlock(zspage);
+			/*
+			 * If zspage is isolated, zs_page_putback will free
+			 * the zspage
+			 */
+			if (likely(!isolated))
+				free_zspage(pool, class, zspage);
+		}
+		handles[nr_freed++] = handles[i];
+	}
+	spin_unlock(&class->lock);
+
+	for (i = 0; i < nr_freed; i++)
+		unpin_tag(handles[i]);
+	for (i = 0; i < nr_slow; i++)
+		unpin_tag(slow[i]);
+	kmem_cache_free_bulk(pool->handle_cachep, nr_freed, (void **)handles);
+
+	for (i = 0; i < nr_slow; i++)
+		__zs_free(pool, slow[i], false);
+}
+
+/*
+ * Allocate up to ZS_MAGAZINE_BATCH objects from the zspages @class
+ * already has. Called with mag->lock held. Never allocates zspages:
+ * zs_malloc does that when the magazine can't be refilled.
+ */
+static void zs_magazine_refill(struct zs_pool *pool, struct size_class *class,
+			       struct zs_magazine *mag)
+{
+	unsigned long handles[ZS_MAGAZINE_BATCH];
+	struct zspage *zspage;
+	unsigned long obj;
+	int i;
+
+	if (!kmem_cache_alloc_bulk(pool->handle_cachep,
+			GFP_NOWAIT | __GFP_NOWARN, ZS_MAGAZINE_BATCH,
+			(void **)handles))
+		return;
+
+	spin_lock(&class->lock);
+	for (i = 0; i < ZS_MAGAZINE_BATCH; i++) {
+		zspage = find_get_zspage(class);
+		if (!zspage)
+			break;
+
+		obj = obj_malloc(class, zspage, handles[i]);
+		fix_fullness_group(class, zspage);
+		record_obj(handles[i], obj);
+		mag->handles[mag->nr++] = handles[i];
+	}
+	spin_unlock(&class->lock);
+
+	if (i < ZS_MAGAZINE_BATCH)
+		kmem_cache_free_bulk(pool->handle_cachep, ZS_MAGAZINE_BATCH - i,
+				(void **)&handles[i]);
+}
+
+static unsigned long zs_magazine_alloc(struct zs_pool *pool,
+				       struct size_class *class)
+{
+	struct zs_magazine *mag = raw_cpu_ptr(class->mag);
+	unsigned long handle = 0;
+
+	spin_lock(&mag->lock);
+	if (!mag->nr) {
+		mag->alloc_miss++;
+		zs_magazine_refill(pool, class, mag);
+	} else {
+		mag->alloc_hit++;
+	}
+	if (mag->nr)
+		handle = mag->handles[--mag->nr];
+	spin_unlock(&mag->lock);
+
+	return handle;
+}
+
+static void zs_magazine_free(struct zs_pool *pool, struct size_class *class,
+			     unsigned long handle)
+{
+	struct zs_magazine *mag = raw_cpu_ptr(class->mag);
+	unsigned long handles[ZS_MAGAZINE_BATCH];
+	int nr = 0;
+
+	spin_lock(&mag->lock);
+	if (mag->nr == ZS_MAGAZINE_SIZE) {
+		/* Flush the oldest objects, the newest are cache hot */
+		nr = ZS_MAGAZINE_BATCH;
+		memcpy(handles, mag->handles, nr * sizeof(*handles));
+		memmove(mag->handles, mag->handles + nr,
+			(mag->nr - nr) * sizeof(*handles));
+		mag->nr -= nr;
+		mag->flush++;
+	}
+	mag->handles[mag->nr++] = handle;
+	mag->free_hit++;
+	spin_unlock(&mag->lock);
+
+	if (nr)
+		zs_free_batch(pool, class, handles, nr);
+}
+
+static void zs_magazine_drain_class(struct zs_pool *pool,
+				    struct size_class *class)
+{
+	unsigned long handles[ZS_MAGAZINE_SIZE];
+	struct zs_magazine *mag;
+	int cpu, nr;
+
+	if (!class->mag)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(class->mag, cpu);
+		spin_lock(&mag->lock);
+		nr = mag->nr;
+		memcpy(handles, mag->handles, nr * sizeof(*handles));
+		mag->nr = 0;
+		spin_unlock(&mag->lock);
+
+		if (nr)
+			zs_free_batch(pool, class, handles, nr);
+	}
+}
+
+/* Give every cached object back to its zspage */
+static void zs_magazine_drain(struct zs_pool *pool)
+{
+	struct size_class *class;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = pool->size_class[i];
+		if (!class || class->index != i)
+			continue;
+
+		zs_magazine_drain_class(pool, class);
+	}
+}
+
 static void zs_object_copy(struct size_class *class, unsigned long dst,
 				unsigned long src)
 {
@@ -1708,6 +2187,8 @@ struct zs_compact_control {
 	 /* Starting object index within @s_page which used for live object
 	  * in the subpage. */
 	int obj_idx;
+	/* Number of objects moved so far */
+	unsigned long nr_migrated;
 };
 
 static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
@@ -1751,6 +2232,7 @@ static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
 		record_obj(handle, free_obj);
 		unpin_tag(handle);
 		obj_free(class, used_obj);
+		cc->nr_migrated++;
 	}
 
 	/* Remember last position in this iteration */
@@ -1890,6 +2372,11 @@ static void migrate_read_lock(struct zspage *zspage)
 	read_lock(&zspage->lock);
 }
 
+static bool migrate_read_trylock(struct zspage *zspage)
+{
+	return read_trylock(&zspage->lock);
+}
+
 static void migrate_read_unlock(struct zspage *zspage)
 {
 	read_unlock(&zspage->lock);
@@ -2315,20 +2802,32 @@ static unsigned long zs_can_compact(struct size_class *class)
 	return obj_wasted * class->pages_per_zspage;
 }
 
+/*
+ * Compact @class, moving at most @max_zspages source zspages (0 means
+ * no limit). The class lock is dropped between zspages. The number of
+ * objects moved is added to @nr_migrated.
+ */
 static unsigned long __zs_compact(struct zs_pool *pool,
-				  struct size_class *class)
+				  struct size_class *class,
+				  unsigned int max_zspages,
+				  unsigned long *nr_migrated)
 {
 	struct zs_compact_control cc;
 	struct zspage *src_zspage;
 	struct zspage *dst_zspage = NULL;
 	unsigned long pages_freed = 0;
+	unsigned int nr_zspages = 0;
 
+	cc.nr_migrated = 0;
 	spin_lock(&class->lock);
 	while ((src_zspage = isolate_zspage(class, true))) {
 
 		if (!zs_can_compact(class))
 			break;
 
+		if (max_zspages && nr_zspages++ == max_zspages)
+			break;
+
 		cc.obj_idx = 0;
 		cc.s_page = get_first_page(src_zspage);
 
@@ -2363,6 +2862,9 @@ static unsigned long __zs_compact(struct zs_pool *pool,
 
 	spin_unlock(&class->lock);
 
+	if (nr_migrated)
+		*nr_migrated += cc.nr_migrated;
+
 	return pages_freed;
 }
 
@@ -2372,13 +2874,15 @@ unsigned long zs_compact(struct zs_pool *pool)
 	struct size_class *class;
 	unsigned long pages_freed = 0;
 
+	/* Cached objects would pin their zspages */
+	zs_magazine_drain(pool);
 	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
 		class = pool->size_class[i];
 		if (!class)
 			continue;
 		if (class->index != i)
 			continue;
-		pages_freed += __zs_compact(pool, class);
+		pages_freed += __zs_compact(pool, class, 0, NULL);
 	}
 	atomic_long_add(pages_freed, &pool->stats.pages_compacted);
 
@@ -2431,6 +2935,121 @@ static unsigned long zs_shrinker_count(struct shrinker *shrinker,
 	return pages_to_free;
 }
 
+static bool zs_class_fragmented(struct size_class *class)
+{
+	unsigned long pages, freeable;
+
+	spin_lock(&class->lock);
+	freeable = zs_can_compact(class);
+	pages = zs_stat_get(class, OBJ_ALLOCATED) / class->objs_per_zspage *
+			class->pages_per_zspage;
+	spin_unlock(&class->lock);
+
+	return freeable &&
+		freeable * 100 >= pages * READ_ONCE(zs_compact_frag_pct);
+}
+
+static void zs_compactd_pool(struct zs_pool *pool)
+{
+	unsigned long pages_freed = 0, nr_migrated = 0;
+	struct size_class *class;
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		if (kthread_should_stop())
+			break;
+
+		class = pool->size_class[i];
+		if (!class || class->index != i)
+			continue;
+
+		if (!zs_class_fragmented(class))
+			continue;
+
+		/* Cached objects would pin their zspages */
+		zs_magazine_drain_class(pool, class);
+		pages_freed += __zs_compact(pool, class,
+				max(READ_ONCE(zs_compact_batch), 1U),
+				&nr_migrated);
+		cond_resched();
+	}
+
+	atomic_long_add(pages_freed, &pool->stats.pages_compacted);
+	atomic_long_add(pages_freed, &pool->stats.bg_pages_compacted);
+	atomic_long_add(nr_migrated, &pool->stats.bg_objs_migrated);
+	atomic_long_add(ktime_us_delta(ktime_get(), start),
+			&pool->stats.bg_compact_us);
+}
+
+/*
+ * Pick the next pool not yet visited in this pass and pin it, so that
+ * zs_pools_lock is only held while walking the list and not while
+ * compacting: zs_create_pool() and zs_destroy_pool() must not wait for
+ * a whole pass.
+ */
+static struct zs_pool *zs_compactd_next_pool(void)
+{
+	struct zs_pool *pool;
+
+	mutex_lock(&zs_pools_lock);
+	list_for_each_entry(pool, &zs_pools, list) {
+		if (pool->compactd_seq == zs_compactd_seq)
+			continue;
+
+		pool->compactd_seq = zs_compactd_seq;
+		atomic_inc(&pool->compactd_refs);
+		mutex_unlock(&zs_pools_lock);
+		return pool;
+	}
+	mutex_unlock(&zs_pools_lock);
+
+	return NULL;
+}
+
+static void zs_compactd_put_pool(struct zs_pool *pool)
+{
+	if (atomic_dec_and_test(&pool->compactd_refs))
+		wake_up_var(&pool->compactd_refs);
+}
+
+static int zs_compactd_fn(void *data)
+{
+	struct zs_pool *pool;
+	unsigned int interval;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		interval = READ_ONCE(zs_compact_interval_ms);
+		if (!interval) {
+			/* Disabled, zs_compact_interval_set() wakes us up */
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!READ_ONCE(zs_compact_interval_ms) &&
+			    !kthread_should_stop())
+				freezable_schedule();
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+
+		mutex_lock(&zs_pools_lock);
+		zs_compactd_seq++;
+		mutex_unlock(&zs_pools_lock);
+
+		while (!kthread_should_stop() &&
+		       (pool = zs_compactd_next_pool())) {
+			zs_compactd_pool(pool);
+			zs_compactd_put_pool(pool);
+			cond_resched();
+		}
+
+		freezable_schedule_timeout_interruptible(
+				msecs_to_jiffies(interval));
+	}
+
+	return 0;
+}
+
 static void zs_unregister_shrinker(struct zs_pool *pool)
 {
 	unregister_shrinker(&pool->shrinker);
@@ -2466,6 +3085,7 @@ struct zs_pool *zs_create_pool(const char *name)
 	if (!pool)
 		return NULL;
 
+	INIT_LIST_HEAD(&pool->list);
 	init_deferred_free(pool);
 
 	pool->name = kstrdup(name, GFP_KERNEL);
@@ -2543,6 +3163,16 @@ struct zs_pool *zs_create_pool(const char *name)
 		class->objs_per_zspage = objs_per_zspage;
 		spin_lock_init(&class->lock);
 		pool->size_class[i] = class;
+		if (objs_per_zspage != 1) {
+			int cpu;
+
+			class->mag = alloc_percpu(struct zs_magazine);
+			if (!class->mag)
+				goto err;
+			for_each_possible_cpu(cpu)
+				spin_lock_init(&per_cpu_ptr(class->mag,
+							    cpu)->lock);
+		}
 		for (fullness = ZS_EMPTY; fullness < NR_ZS_FULLNESS;
 							fullness++)
 			INIT_LIST_HEAD(&class->fullness_list[fullness]);
@@ -2564,6 +3194,10 @@ struct zs_pool *zs_create_pool(const char *name)
 	 */
 	zs_register_shrinker(pool);
 
+	mutex_lock(&zs_pools_lock);
+	list_add(&pool->list, &zs_pools);
+	mutex_unlock(&zs_pools_lock);
+
 	return pool;
 
 err:
@@ -2576,7 +3210,15 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	mutex_lock(&zs_pools_lock);
+	list_del(&pool->list);
+	mutex_unlock(&zs_pools_lock);
+	/* No new refs once off the list, wait for zs_compactd to let go */
+	wait_var_event(&pool->compactd_refs,
+		       !atomic_read(&pool->compactd_refs));
+
 	zs_unregister_shrinker(pool);
+	zs_magazine_drain(pool);
 	zs_unregister_migration(pool);
 	zs_pool_stat_destroy(pool);
 
@@ -2596,6 +3238,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 					class->size, fg);
 			}
 		}
+		free_percpu(class->mag);
 		kfree(class);
 	}
 
@@ -2624,6 +3267,13 @@ static int __init zs_init(void)
 
 	zs_stat_init();
 
+	/* Optional, pools can still be compacted on demand without it */
+	zs_compactd = kthread_run(zs_compactd_fn, NULL, "zs_compactd");
+	if (IS_ERR(zs_compactd)) {
+		pr_warn("failed to start zs_compactd\n");
+		zs_compactd = NULL;
+	}
+
 	return 0;
 
 hp_setup_fail:
@@ -2634,6 +3284,8 @@ static int __init zs_init(void)
 
 static void __exit zs_exit(void)
 {
+	if (zs_compactd)
+		kthread_stop(zs_compactd);
 #ifdef CONFIG_ZPOOL
 	zpool_unregister_driver(&zs_zpool_driver);
 #endif
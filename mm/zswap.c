@@ -39,8 +39,10 @@
 #include <linux/mm_types.h>
 #include <linux/page-flags.h>
 #include <linux/swapops.h>
+#include <linux/swapfile.h>
 #include <linux/writeback.h>
 #include <linux/pagemap.h>
+#include <linux/blkdev.h>
 
 /*********************************
 * statistics
@@ -63,6 +65,8 @@ static atomic_t zswap_same_filled_pages = ATOMIC_INIT(0);
 static u64 zswap_pool_limit_hit;
 /* Pages written back when pool limit was reached */
 static u64 zswap_written_back_pages;
+/* Batches of LRU entries written back when pool limit was reached */
+static u64 zswap_writeback_batches;
 /* Store failed due to a reclaim failure after pool limit was reached */
 static u64 zswap_reject_reclaim_fail;
 /* Compressed page was too big for the allocator to (optimally) store */
@@ -73,6 +77,12 @@ static u64 zswap_reject_alloc_fail;
 static u64 zswap_reject_kmemcache_fail;
 /* Duplicate store was encountered (rare) */
 static u64 zswap_duplicate_entry;
+/* Same-value filled pages stored without touching the compressor or pool */
+static u64 zswap_same_filled_stores;
+/* Same-value filled pages filled back in on load */
+static u64 zswap_same_filled_loads;
+/* A tree lock was found held by another CPU and had to be waited for */
+static u64 zswap_tree_lock_contended;
 
 /*********************************
 * tunables
@@ -123,6 +133,18 @@ static bool zswap_same_filled_pages_enabled = true;
 module_param_named(same_filled_pages_enabled, zswap_same_filled_pages_enabled,
 		   bool, 0644);
 
+/* Number of the oldest entries written back each time the pool is full */
+#define ZSWAP_WB_BATCH_MAX 32
+static unsigned int zswap_writeback_batch = 16;
+static int zswap_writeback_batch_param_set(const char *,
+					   const struct kernel_param *);
+static struct kernel_param_ops zswap_writeback_batch_param_ops = {
+	.set =		zswap_writeback_batch_param_set,
+	.get =		param_get_uint,
+};
+module_param_cb(writeback_batch, &zswap_writeback_batch_param_ops,
+		&zswap_writeback_batch, 0644);
+
 /*********************************
 * data structures
 **********************************/
@@ -144,7 +166,10 @@ struct zswap_pool {
  * page within zswap.
  *
  * rbnode - links the entry into red-black tree for the appropriate swap type
+ * lru - links the entry into the zswap LRU, oldest first.  Same-value filled
+ *       entries take no pool space and are never put on it.
  * offset - the swap offset for the entry.  Index into the red-black tree.
+ * type - the swap type of the entry, needed to write it back from the LRU
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
  *            concurrent calls to load, invalidate, and writeback.  The lock
@@ -159,7 +184,9 @@ struct zswap_pool {
  */
 struct zswap_entry {
 	struct rb_node rbnode;
+	struct list_head lru;
 	pgoff_t offset;
+	unsigned int type;
 	int refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
@@ -177,6 +204,11 @@ struct zswap_header {
  * The tree lock in the zswap_tree struct protects a few things:
  * - the rbtree
  * - the refcount field of each entry in the tree
+ *
+ * Each swap type is split into one tree per SWAP_ADDRESS_SPACE_PAGES
+ * range of offsets, matching the swap cache address spaces, so that
+ * stores and loads to different parts of a swap device do not serialize
+ * on a single lock.
  */
 struct zswap_tree {
 	struct rb_root rbroot;
@@ -184,6 +216,14 @@ struct zswap_tree {
 };
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+static unsigned int nr_zswap_trees[MAX_SWAPFILES];
+
+/*
+ * Compressed entries of all pools in store order.  zswap_lru_lock nests
+ * inside the tree locks; an entry stays on the list until it is freed.
+ */
+static LIST_HEAD(zswap_lru);
+static DEFINE_SPINLOCK(zswap_lru_lock);
 
 /* RCU-protected iteration */
 static LIST_HEAD(zswap_pools);
@@ -238,6 +278,19 @@ static void zswap_update_total_size(void)
 	zswap_pool_total_size = total;
 }
 
+static struct zswap_tree *zswap_tree_of(unsigned type, pgoff_t offset)
+{
+	return &zswap_trees[type][offset >> SWAP_ADDRESS_SPACE_SHIFT];
+}
+
+static void zswap_tree_lock(struct zswap_tree *tree)
+{
+	if (!spin_trylock(&tree->lock)) {
+		zswap_tree_lock_contended++;
+		spin_lock(&tree->lock);
+	}
+}
+
 /*********************************
 * zswap entry functions
 **********************************/
@@ -262,6 +315,7 @@ static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
 		return NULL;
 	entry->refcount = 1;
 	RB_CLEAR_NODE(&entry->rbnode);
+	INIT_LIST_HEAD(&entry->lru);
 	return entry;
 }
 
@@ -331,6 +385,11 @@ static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
  */
 static void zswap_free_entry(struct zswap_entry *entry)
 {
+	if (!list_empty(&entry->lru)) {
+		spin_lock(&zswap_lru_lock);
+		list_del(&entry->lru);
+		spin_unlock(&zswap_lru_lock);
+	}
 	if (!entry->length)
 		atomic_dec(&zswap_same_filled_pages);
 	else {
@@ -471,24 +530,6 @@ static struct zswap_pool *zswap_pool_current_get(void)
 	return pool;
 }
 
-static struct zswap_pool *zswap_pool_last_get(void)
-{
-	struct zswap_pool *pool, *last = NULL;
-
-	rcu_read_lock();
-
-	list_for_each_entry_rcu(pool, &zswap_pools, list)
-		last = pool;
-	WARN_ONCE(!last && zswap_has_pool,
-		  "%s: no page storage pool!\n", __func__);
-	if (!zswap_pool_get(last))
-		last = NULL;
-
-	rcu_read_unlock();
-
-	return last;
-}
-
 /* type and compressor must be null-terminated */
 static struct zswap_pool *zswap_pool_find_get(char *type, char *compressor)
 {
@@ -794,6 +835,21 @@ static int zswap_enabled_param_set(const char *val,
 	return param_set_bool(val, kp);
 }
 
+static int zswap_writeback_batch_param_set(const char *val,
+					   const struct kernel_param *kp)
+{
+	unsigned int batch;
+	int ret;
+
+	ret = kstrtouint(val, 10, &batch);
+	if (ret)
+		return ret;
+	if (!batch || batch > ZSWAP_WB_BATCH_MAX)
+		return -EINVAL;
+
+	return param_set_uint(val, kp);
+}
+
 /*********************************
 * writeback code
 **********************************/
@@ -834,138 +890,202 @@ static int zswap_get_swap_cache_page(swp_entry_t entry,
 	return ZSWAP_SWAPCACHE_EXIST;
 }
 
+/* one entry being written back by zswap_writeback_entries() */
+struct zswap_wb_item {
+	swp_entry_t swpentry;
+	struct zswap_tree *tree;
+	struct zswap_entry *entry;
+	struct page *page;
+};
+
+static void zswap_wb_decompress(struct zswap_entry *entry, struct page *page)
+{
+	struct crypto_comp *tfm;
+	unsigned int dlen = PAGE_SIZE;
+	u8 *src, *dst;
+	int ret;
+
+	src = zpool_map_handle(entry->pool->zpool, entry->handle, ZPOOL_MM_RO);
+	if (zpool_evictable(entry->pool->zpool))
+		src += sizeof(struct zswap_header);
+	dst = kmap_atomic(page);
+	tfm = *get_cpu_ptr(entry->pool->tfm);
+	ret = crypto_comp_decompress(tfm, src, entry->length, dst, &dlen);
+	put_cpu_ptr(entry->pool->tfm);
+	kunmap_atomic(dst);
+	zpool_unmap_handle(entry->pool->zpool, entry->handle);
+	BUG_ON(ret);
+	BUG_ON(dlen != PAGE_SIZE);
+}
+
 /*
- * Attempts to free an entry by adding a page to the swap cache,
- * decompressing the entry data into the page, and issuing a
- * bio write to write the page back to the swap device.
+ * Attempts to free entries by adding pages to the swap cache,
+ * decompressing the entry data into the pages, and issuing bio
+ * writes to write the pages back to the swap device.
  *
- * This can be thought of as a "resumed writeback" of the page
+ * This can be thought of as a "resumed writeback" of the pages
  * to the swap device.  We are basically resuming the same swap
  * writeback path that was intercepted with the frontswap_store()
- * in the first place.  After the page has been decompressed into
+ * in the first place.  After a page has been decompressed into
  * the swap cache, the compressed version stored by zswap can be
  * freed.
+ *
+ * All swap cache pages are populated before the first write is
+ * issued, and the writes go out under one plug so that neighbouring
+ * offsets are merged into multi-page bios.
+ *
+ * Returns the number of entries written back.
  */
-static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
+static int zswap_writeback_entries(struct zswap_wb_item *items, int nr)
 {
-	struct zswap_header *zhdr;
-	swp_entry_t swpentry;
-	struct zswap_tree *tree;
-	pgoff_t offset;
-	struct zswap_entry *entry;
-	struct page *page;
-	struct crypto_comp *tfm;
-	u8 *src, *dst;
-	unsigned int dlen;
-	int ret;
 	struct writeback_control wbc = {
 		.sync_mode = WB_SYNC_NONE,
 	};
-
-	/* extract swpentry from data */
-	zhdr = zpool_map_handle(pool, handle, ZPOOL_MM_RO);
-	swpentry = zhdr->swpentry; /* here */
-	zpool_unmap_handle(pool, handle);
-	tree = zswap_trees[swp_type(swpentry)];
-	offset = swp_offset(swpentry);
-
-	/* find and ref zswap entry */
-	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
-	if (!entry) {
+	struct zswap_wb_item *item;
+	struct blk_plug plug;
+	pgoff_t offset;
+	int i, ret, written = 0;
+
+	/* find and ref the zswap entries, and populate swap cache pages */
+	for (i = 0; i < nr; i++) {
+		item = &items[i];
+		offset = swp_offset(item->swpentry);
+		item->tree = zswap_tree_of(swp_type(item->swpentry), offset);
+		item->page = NULL;
+
+		zswap_tree_lock(item->tree);
+		item->entry = zswap_entry_find_get(&item->tree->rbroot, offset);
+		spin_unlock(&item->tree->lock);
 		/* entry was invalidated */
-		spin_unlock(&tree->lock);
-		return 0;
+		if (!item->entry)
+			continue;
+		BUG_ON(offset != item->entry->offset);
+
+		/* try to allocate swap cache page */
+		ret = zswap_get_swap_cache_page(item->swpentry, &item->page);
+		switch (ret) {
+		case ZSWAP_SWAPCACHE_FAIL: /* no memory or invalidated */
+			item->page = NULL;
+			break;
+
+		case ZSWAP_SWAPCACHE_EXIST:
+			/* page is already in the swap cache, ignore for now */
+			put_page(item->page);
+			item->page = NULL;
+			break;
+
+		case ZSWAP_SWAPCACHE_NEW: /* page is locked */
+			zswap_wb_decompress(item->entry, item->page);
+			/* page is up to date */
+			SetPageUptodate(item->page);
+			break;
+		}
 	}
-	spin_unlock(&tree->lock);
-	BUG_ON(offset != entry->offset);
 
-	/* try to allocate swap cache page */
-	switch (zswap_get_swap_cache_page(swpentry, &page)) {
-	case ZSWAP_SWAPCACHE_FAIL: /* no memory or invalidate happened */
-		ret = -ENOMEM;
-		goto fail;
-
-	case ZSWAP_SWAPCACHE_EXIST:
-		/* page is already in the swap cache, ignore for now */
-		put_page(page);
-		ret = -EEXIST;
-		goto fail;
-
-	case ZSWAP_SWAPCACHE_NEW: /* page is locked */
-		/* decompress */
-		dlen = PAGE_SIZE;
-		src = (u8 *)zpool_map_handle(entry->pool->zpool, entry->handle,
-				ZPOOL_MM_RO) + sizeof(struct zswap_header);
-		dst = kmap_atomic(page);
-		tfm = *get_cpu_ptr(entry->pool->tfm);
-		ret = crypto_comp_decompress(tfm, src, entry->length,
-					     dst, &dlen);
-		put_cpu_ptr(entry->pool->tfm);
-		kunmap_atomic(dst);
-		zpool_unmap_handle(entry->pool->zpool, entry->handle);
-		BUG_ON(ret);
-		BUG_ON(dlen != PAGE_SIZE);
+	/* start writeback */
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		item = &items[i];
+		if (!item->page)
+			continue;
 
-		/* page is up to date */
-		SetPageUptodate(page);
+		/* move it to the tail of the inactive list after writeback */
+		SetPageReclaim(item->page);
+		__swap_writepage(item->page, &wbc, end_swap_bio_write);
+		put_page(item->page);
+		written++;
 	}
+	blk_finish_plug(&plug);
+	zswap_written_back_pages += written;
 
-	/* move it to the tail of the inactive list after end_writeback */
-	SetPageReclaim(page);
-
-	/* start writeback */
-	__swap_writepage(page, &wbc, end_swap_bio_write);
-	put_page(page);
-	zswap_written_back_pages++;
+	for (i = 0; i < nr; i++) {
+		item = &items[i];
+		if (!item->entry)
+			continue;
 
-	spin_lock(&tree->lock);
-	/* drop local reference */
-	zswap_entry_put(tree, entry);
+		zswap_tree_lock(item->tree);
+		/* drop local reference */
+		zswap_entry_put(item->tree, item->entry);
+
+		/*
+		 * There are two possible situations for a written back
+		 * entry here:
+		 * (1) refcount is 1(normal case), entry is valid and on tree
+		 * (2) refcount is 0, entry is freed and not on the tree
+		 *     because invalidate happened during writeback
+		 * search the tree and free the entry if find entry
+		 *
+		 * If the page was already in the swap cache a load may be
+		 * happening concurrently, so it is okay to keep the entry.
+		 */
+		offset = swp_offset(item->swpentry);
+		if (item->page &&
+		    item->entry == zswap_rb_search(&item->tree->rbroot, offset))
+			zswap_entry_put(item->tree, item->entry);
+		spin_unlock(&item->tree->lock);
+	}
 
-	/*
-	* There are two possible situations for entry here:
-	* (1) refcount is 1(normal case),  entry is valid and on the tree
-	* (2) refcount is 0, entry is freed and not on the tree
-	*     because invalidate happened during writeback
-	*  search the tree and free the entry if find entry
-	*/
-	if (entry == zswap_rb_search(&tree->rbroot, offset))
-		zswap_entry_put(tree, entry);
-	spin_unlock(&tree->lock);
+	return written;
+}
 
-	goto end;
+/* zpool eviction callback, for drivers that shrink on their own */
+static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
+{
+	struct zswap_header *zhdr;
+	struct zswap_wb_item item;
 
-	/*
-	* if we get here due to ZSWAP_SWAPCACHE_EXIST
-	* a load may happening concurrently
-	* it is safe and okay to not free the entry
-	* if we free the entry in the following put
-	* it it either okay to return !0
-	*/
-fail:
-	spin_lock(&tree->lock);
-	zswap_entry_put(tree, entry);
-	spin_unlock(&tree->lock);
+	/* extract swpentry from data */
+	zhdr = zpool_map_handle(pool, handle, ZPOOL_MM_RO);
+	item.swpentry = zhdr->swpentry; /* here */
+	zpool_unmap_handle(pool, handle);
 
-end:
-	return ret;
+	return zswap_writeback_entries(&item, 1) ? 0 : -EAGAIN;
 }
 
+static struct zswap_wb_item zswap_wb_items[ZSWAP_WB_BATCH_MAX];
+/* protects zswap_wb_items */
+static DEFINE_MUTEX(zswap_wb_mutex);
+
+/*
+ * Writes back the oldest zswap_writeback_batch entries, whichever pool
+ * they are in.  The selected entries are rotated to the tail of the LRU
+ * so that an entry that cannot be written back now is not picked again
+ * by the next shrinker.
+ */
 static int zswap_shrink(void)
 {
-	struct zswap_pool *pool;
-	int ret;
+	struct zswap_entry *entry, *n;
+	int nr = 0, written;
 
-	pool = zswap_pool_last_get();
-	if (!pool)
-		return -ENOENT;
+	/*
+	 * Allocating the swap cache pages may recurse into reclaim and
+	 * back into a store, so never wait for another shrinker: the
+	 * store is rejected and goes straight to the swap device instead.
+	 */
+	if (!mutex_trylock(&zswap_wb_mutex))
+		return -EBUSY;
+
+	spin_lock(&zswap_lru_lock);
+	list_for_each_entry_safe(entry, n, &zswap_lru, lru) {
+		if (nr == zswap_writeback_batch)
+			break;
+		/* the entry may be freed once the lock is dropped */
+		zswap_wb_items[nr++].swpentry = swp_entry(entry->type,
+							  entry->offset);
+		list_move_tail(&entry->lru, &zswap_lru);
+	}
+	spin_unlock(&zswap_lru_lock);
 
-	ret = zpool_shrink(pool->zpool, 1, NULL);
+	if (!nr) {
+		mutex_unlock(&zswap_wb_mutex);
+		return -ENOENT;
+	}
 
-	zswap_pool_put(pool);
+	written = zswap_writeback_entries(zswap_wb_items, nr);
+	zswap_writeback_batches++;
+	mutex_unlock(&zswap_wb_mutex);
 
-	return ret;
+	return written ? 0 : -EAGAIN;
 }
 
 static int zswap_is_page_same_filled(void *ptr, unsigned long *value)
@@ -997,12 +1117,13 @@ static void zswap_fill_page(void *ptr, unsigned long value)
 static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree;
 	struct zswap_entry *entry, *dupentry;
 	struct crypto_comp *tfm;
 	int ret;
 	unsigned int hlen, dlen = PAGE_SIZE;
 	unsigned long handle, value;
+	bool same_filled = false;
 	char *buf;
 	u8 *src, *dst;
 	struct zswap_header zhdr = { .swpentry = swp_entry(type, offset) };
@@ -1013,13 +1134,25 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
-	if (!zswap_enabled || !tree) {
+	if (!zswap_enabled || !zswap_trees[type]) {
 		ret = -ENODEV;
 		goto reject;
 	}
+	tree = zswap_tree_of(type, offset);
+
+	/*
+	 * Same-value filled pages take no space in the pool, so check for
+	 * them before the pool limit: they must neither be rejected nor
+	 * force writeback of other entries.
+	 */
+	if (zswap_same_filled_pages_enabled) {
+		src = kmap_atomic(page);
+		same_filled = zswap_is_page_same_filled(src, &value);
+		kunmap_atomic(src);
+	}
 
 	/* reclaim space if needed */
-	if (zswap_is_full()) {
+	if (!same_filled && zswap_is_full()) {
 		zswap_pool_limit_hit++;
 		if (zswap_shrink()) {
 			zswap_reject_reclaim_fail++;
@@ -1045,17 +1178,14 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
-	if (zswap_same_filled_pages_enabled) {
-		src = kmap_atomic(page);
-		if (zswap_is_page_same_filled(src, &value)) {
-			kunmap_atomic(src);
-			entry->offset = offset;
-			entry->length = 0;
-			entry->value = value;
-			atomic_inc(&zswap_same_filled_pages);
-			goto insert_entry;
-		}
-		kunmap_atomic(src);
+	if (same_filled) {
+		entry->offset = offset;
+		entry->type = type;
+		entry->length = 0;
+		entry->value = value;
+		atomic_inc(&zswap_same_filled_pages);
+		zswap_same_filled_stores++;
+		goto insert_entry;
 	}
 
 	/* if entry is successfully added, it keeps the reference */
@@ -1098,12 +1228,13 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 
 	/* populate entry */
 	entry->offset = offset;
+	entry->type = type;
 	entry->handle = handle;
 	entry->length = dlen;
 
 insert_entry:
 	/* map */
-	spin_lock(&tree->lock);
+	zswap_tree_lock(tree);
 	do {
 		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
 		if (ret == -EEXIST) {
@@ -1113,6 +1244,11 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 			zswap_entry_put(tree, dupentry);
 		}
 	} while (ret == -EEXIST);
+	if (entry->length) {
+		spin_lock(&zswap_lru_lock);
+		list_add_tail(&entry->lru, &zswap_lru);
+		spin_unlock(&zswap_lru_lock);
+	}
 	spin_unlock(&tree->lock);
 
 	/* update stats */
@@ -1137,7 +1273,7 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree_of(type, offset);
 	struct zswap_entry *entry;
 	struct crypto_comp *tfm;
 	u8 *src, *dst;
@@ -1145,7 +1281,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	int ret;
 
 	/* find */
-	spin_lock(&tree->lock);
+	zswap_tree_lock(tree);
 	entry = zswap_entry_find_get(&tree->rbroot, offset);
 	if (!entry) {
 		/* entry was written back */
@@ -1158,6 +1294,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 		dst = kmap_atomic(page);
 		zswap_fill_page(dst, entry->value);
 		kunmap_atomic(dst);
+		zswap_same_filled_loads++;
 		goto freeentry;
 	}
 
@@ -1175,7 +1312,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	BUG_ON(ret);
 
 freeentry:
-	spin_lock(&tree->lock);
+	zswap_tree_lock(tree);
 	zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
 
@@ -1185,11 +1322,11 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 /* frees an entry in zswap */
 static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree_of(type, offset);
 	struct zswap_entry *entry;
 
 	/* find */
-	spin_lock(&tree->lock);
+	zswap_tree_lock(tree);
 	entry = zswap_rb_search(&tree->rbroot, offset);
 	if (!entry) {
 		/* entry was written back */
@@ -1209,35 +1346,46 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 /* frees all zswap entries for the given swap type */
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *trees = zswap_trees[type], *tree;
 	struct zswap_entry *entry, *n;
+	unsigned int i;
 
-	if (!tree)
+	if (!trees)
 		return;
 
-	/* walk the tree and free everything */
-	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
-		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
-	spin_unlock(&tree->lock);
-	kfree(tree);
+	/* walk the trees and free everything */
+	for (i = 0; i < nr_zswap_trees[type]; i++) {
+		tree = &trees[i];
+		spin_lock(&tree->lock);
+		rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot,
+						     rbnode)
+			zswap_free_entry(entry);
+		tree->rbroot = RB_ROOT;
+		spin_unlock(&tree->lock);
+	}
+	kvfree(trees);
+	nr_zswap_trees[type] = 0;
 	zswap_trees[type] = NULL;
 }
 
 static void zswap_frontswap_init(unsigned type)
 {
-	struct zswap_tree *tree;
+	struct zswap_tree *trees;
+	unsigned int i, nr;
 
-	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
-	if (!tree) {
+	nr = DIV_ROUND_UP(swap_info[type]->max, SWAP_ADDRESS_SPACE_PAGES);
+	trees = kvcalloc(nr, sizeof(*trees), GFP_KERNEL);
+	if (!trees) {
 		pr_err("alloc failed, zswap disabled for swap type %d\n", type);
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
-	spin_lock_init(&tree->lock);
-	zswap_trees[type] = tree;
+	for (i = 0; i < nr; i++) {
+		trees[i].rbroot = RB_ROOT;
+		spin_lock_init(&trees[i].lock);
+	}
+	nr_zswap_trees[type] = nr;
+	zswap_trees[type] = trees;
 }
 
 static struct frontswap_ops zswap_frontswap_ops = {
@@ -1277,8 +1425,16 @@ static int __init zswap_debugfs_init(void)
 			   zswap_debugfs_root, &zswap_reject_compress_poor);
 	debugfs_create_u64("written_back_pages", 0444,
 			   zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("writeback_batches", 0444,
+			   zswap_debugfs_root, &zswap_writeback_batches);
 	debugfs_create_u64("duplicate_entry", 0444,
 			   zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_u64("same_filled_stores", 0444,
+			   zswap_debugfs_root, &zswap_same_filled_stores);
+	debugfs_create_u64("same_filled_loads", 0444,
+			   zswap_debugfs_root, &zswap_same_filled_loads);
+	debugfs_create_u64("tree_lock_contended", 0444,
+			   zswap_debugfs_root, &zswap_tree_lock_contended);
 	debugfs_create_u64("pool_total_size", 0444,
 			   zswap_debugfs_root, &zswap_pool_total_size);
 	debugfs_create_atomic_t("stored_pages", 0444,
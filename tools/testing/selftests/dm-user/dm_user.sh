@@ -0,0 +1,41 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# Checks both dm-user transports with a memory-backed test daemon and
+# compares their throughput.  Extra arguments are passed to dm_user_test,
+# e.g. "-t 10 -c 8 -d 2".
+
+ksft_skip=4
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "dm_user: must be run as root [SKIP]"
+	exit $ksft_skip
+fi
+
+if ! command -v dmsetup > /dev/null; then
+	echo "dm_user: dmsetup not found [SKIP]"
+	exit $ksft_skip
+fi
+
+modprobe dm-user 2> /dev/null
+if ! dmsetup targets | grep -q "^user "; then
+	echo "dm_user: dm-user target not available [SKIP]"
+	exit $ksft_skip
+fi
+
+ret=0
+for bs in 4096 65536; do
+	for mode in rw ring; do
+		./dm_user_test -m $mode -b $bs "$@"
+		rc=$?
+		if [ $rc -eq $ksft_skip ]; then
+			exit $ksft_skip
+		elif [ $rc -ne 0 ]; then
+			echo "dm_user: $mode transport, $bs byte I/O [FAIL]"
+			ret=1
+		fi
+	done
+done
+
+[ $ret -eq 0 ] && echo "dm_user: [PASS]"
+exit $ret
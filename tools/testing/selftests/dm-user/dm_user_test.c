@@ -0,0 +1,621 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Test daemon and throughput benchmark for dm-user.
+ *
+ * Creates a dm-user device backed by memory and serves it from this process,
+ * either with the read()/write() protocol or with the ring transport.  It
+ * first checks that data written through the device reads back intact, then
+ * runs random direct I/O against the device for a while and reports the
+ * throughput along with how many syscalls the daemon needed per request.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <linux/dm-user.h>
+
+#define KSFT_SKIP	4
+
+#define SECTOR_SHIFT	9
+#define MAX_CHANNELS	16
+#define MAX_CLIENTS	64
+
+enum transport {
+	TRANSPORT_RW,
+	TRANSPORT_RING,
+};
+
+static enum transport transport = TRANSPORT_RING;
+static size_t dev_size = 64 << 20;
+static size_t block_size = 4096;
+static unsigned int seconds = 5;
+static unsigned int nr_channels = 1;
+static unsigned int nr_clients = 4;
+static unsigned int write_pct = 30;
+static unsigned int ring_entries = 256;
+static size_t arena_size = 8 << 20;
+static char name[64];
+
+static uint8_t *backing;
+static size_t max_io;
+
+struct channel {
+	pthread_t thread;
+	int fd;
+	unsigned long requests;
+	unsigned long syscalls;
+	int error;
+};
+
+static struct channel channels[MAX_CHANNELS];
+
+struct client {
+	pthread_t thread;
+	int fd;
+	unsigned int seed;
+	unsigned long ops;
+	int error;
+};
+
+static struct client clients[MAX_CLIENTS];
+static volatile bool stop;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Carries out one request against the backing memory and returns the
+ * DM_USER_RESP_* code for it.  buf is where the payload is or goes.
+ */
+static uint64_t do_request(uint64_t type, uint64_t sector, uint64_t len,
+			   void *buf)
+{
+	uint64_t off = sector << SECTOR_SHIFT;
+
+	if (type != DM_USER_REQ_MAP_FLUSH &&
+	    (off > dev_size || len > dev_size - off))
+		return DM_USER_RESP_ERROR;
+
+	switch (type) {
+	case DM_USER_REQ_MAP_READ:
+		memcpy(buf, backing + off, len);
+		return DM_USER_RESP_SUCCESS;
+	case DM_USER_REQ_MAP_WRITE:
+		memcpy(backing + off, buf, len);
+		return DM_USER_RESP_SUCCESS;
+	case DM_USER_REQ_MAP_DISCARD:
+	case DM_USER_REQ_MAP_SECURE_ERASE:
+	case DM_USER_REQ_MAP_WRITE_ZEROES:
+		memset(backing + off, 0, len);
+		return DM_USER_RESP_SUCCESS;
+	case DM_USER_REQ_MAP_FLUSH:
+		return DM_USER_RESP_SUCCESS;
+	default:
+		return DM_USER_RESP_UNSUPPORTED;
+	}
+}
+
+static int read_full(struct channel *ch, void *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = read(ch->fd, buf, len);
+
+		ch->syscalls++;
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? -errno : -EIO;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * The read()/write() protocol: one read() for the header of each request,
+ * another for the payload of writes, and one write() for the response.
+ */
+static void *rw_daemon(void *arg)
+{
+	struct channel *ch = arg;
+	struct dm_user_message *msg;
+	size_t resp_len;
+	int err;
+
+	msg = malloc(sizeof(*msg) + max_io);
+	if (!msg) {
+		ch->error = -ENOMEM;
+		return NULL;
+	}
+
+	for (;;) {
+		err = read_full(ch, msg, sizeof(*msg));
+		if (err)
+			break;
+
+		if (msg->len > max_io) {
+			err = -EFBIG;
+			break;
+		}
+
+		if (msg->type == DM_USER_REQ_MAP_WRITE) {
+			err = read_full(ch, msg->buf, msg->len);
+			if (err)
+				break;
+		}
+
+		/* Only successful reads carry data back */
+		resp_len = msg->type == DM_USER_REQ_MAP_READ ? msg->len : 0;
+		msg->type = do_request(msg->type, msg->sector, msg->len,
+				       msg->buf);
+		if (msg->type != DM_USER_RESP_SUCCESS)
+			resp_len = 0;
+		ch->requests++;
+
+		if (write(ch->fd, msg, sizeof(*msg) + resp_len) < 0) {
+			err = -errno;
+			break;
+		}
+		ch->syscalls++;
+	}
+
+	free(msg);
+	/* The device going away is how we are told to exit */
+	if (err != -ENOTBLK)
+		ch->error = err;
+	return NULL;
+}
+
+/*
+ * Publishes how far we got with the SQ and the CQ, then lets the kernel
+ * complete those requests and hand out new ones.
+ */
+static int ring_enter(struct channel *ch, struct dm_user_ring_header *hdr,
+		      uint32_t sq_head, uint32_t cq_tail, unsigned long flags)
+{
+	__atomic_store_n(&hdr->sq_head, sq_head, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->cq_tail, cq_tail, __ATOMIC_RELEASE);
+
+	for (;;) {
+		ch->syscalls++;
+		if (ioctl(ch->fd, DM_USER_IOC_RING_ENTER, flags) >= 0)
+			return 0;
+		if (errno != EINTR)
+			return -errno;
+	}
+}
+
+/*
+ * The ring transport: one RING_ENTER per batch of requests, which returns
+ * the results of the previous batch and fetches the next one.
+ */
+static void *ring_daemon(void *arg)
+{
+	struct channel *ch = arg;
+	struct dm_user_ring_params params = {
+		.sq_entries = ring_entries,
+		.cq_entries = ring_entries,
+		.arena_size = arena_size,
+	};
+	struct dm_user_ring_header *hdr;
+	struct dm_user_sqe *sqes;
+	struct dm_user_cqe *cqes;
+	uint8_t *arena;
+	uint32_t sq_head, sq_tail, cq_tail, sq_mask, cq_mask;
+	void *base;
+	int err;
+
+	if (ioctl(ch->fd, DM_USER_IOC_SETUP_RING, &params) < 0) {
+		ch->error = -errno;
+		return NULL;
+	}
+
+	base = mmap(NULL, params.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    ch->fd, 0);
+	if (base == MAP_FAILED) {
+		ch->error = -errno;
+		return NULL;
+	}
+
+	hdr = base;
+	if (hdr->magic != DM_USER_RING_MAGIC ||
+	    hdr->version != DM_USER_RING_VERSION) {
+		err = -EPROTO;
+		goto out;
+	}
+	sqes = base + hdr->sq_offset;
+	cqes = base + hdr->cq_offset;
+	arena = base + hdr->arena_offset;
+	sq_mask = hdr->sq_entries - 1;
+	cq_mask = hdr->cq_entries - 1;
+	sq_head = hdr->sq_head;
+	cq_tail = hdr->cq_tail;
+
+	for (;;) {
+		err = ring_enter(ch, hdr, sq_head, cq_tail,
+				 DM_USER_RING_ENTER_WAIT);
+		if (err)
+			break;
+
+		sq_tail = __atomic_load_n(&hdr->sq_tail, __ATOMIC_ACQUIRE);
+		while (sq_head != sq_tail) {
+			struct dm_user_sqe *sqe = &sqes[sq_head & sq_mask];
+			struct dm_user_cqe *cqe;
+
+			/* Let the kernel reap the CQ if it is full */
+			while (cq_tail - __atomic_load_n(&hdr->cq_head,
+							 __ATOMIC_ACQUIRE) >
+			       cq_mask) {
+				err = ring_enter(ch, hdr, sq_head, cq_tail, 0);
+				if (err)
+					goto out;
+			}
+
+			cqe = &cqes[cq_tail & cq_mask];
+			cqe->seq = sqe->seq;
+			cqe->type = do_request(sqe->type, sqe->sector,
+					       sqe->len, arena + sqe->buf);
+			sq_head++;
+			cq_tail++;
+			ch->requests++;
+		}
+	}
+
+out:
+	munmap(base, params.ring_size);
+	/* The device going away is how we are told to exit */
+	if (err != -ENOTBLK)
+		ch->error = err;
+	return NULL;
+}
+
+static int run(char *const argv[])
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -errno;
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -EIO;
+	return 0;
+}
+
+/*
+ * The misc device only appears once the target has been constructed, and
+ * creating the device may already issue I/O (partition scanning), so the
+ * channels are opened from here while dmsetup is still running.
+ */
+static int create_device(void)
+{
+	char table[128], path[128];
+	char *argv[] = { "dmsetup", "create", name, "--table", table, NULL };
+	unsigned long sectors = dev_size >> SECTOR_SHIFT;
+	int status, i, tries;
+	pid_t pid;
+
+	snprintf(table, sizeof(table), "0 %lu user 0 %lu %s", sectors, sectors,
+		 name);
+	snprintf(path, sizeof(path), "/dev/dm-user/%s", name);
+
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	for (tries = 0; tries < 1000 && access(path, F_OK); tries++)
+		usleep(10000);
+
+	for (i = 0; i < nr_channels; i++) {
+		struct channel *ch = &channels[i];
+
+		ch->fd = open(path, O_RDWR);
+		if (ch->fd < 0) {
+			perror(path);
+			break;
+		}
+		pthread_create(&ch->thread, NULL,
+			       transport == TRANSPORT_RING ? ring_daemon :
+							     rw_daemon, ch);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -errno;
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -EIO;
+	return i == nr_channels ? 0 : -ENODEV;
+}
+
+static void remove_device(void)
+{
+	char *argv[] = { "dmsetup", "remove", name, NULL };
+	int i;
+
+	if (run(argv))
+		fprintf(stderr, "dmsetup remove %s failed\n", name);
+
+	for (i = 0; i < nr_channels; i++) {
+		if (channels[i].fd < 0)
+			continue;
+		pthread_join(channels[i].thread, NULL);
+		close(channels[i].fd);
+	}
+}
+
+static void fill_block(uint8_t *buf, uint64_t block, unsigned int pass)
+{
+	size_t i;
+
+	for (i = 0; i < block_size; i += sizeof(uint64_t))
+		*(uint64_t *)(buf + i) = (block << 32) ^ (pass << 24) ^ i;
+}
+
+/*
+ * Writes every block of the device with a pattern and reads it all back,
+ * in I/Os of varying size, checking both the device and the backing store.
+ */
+static int check_device(int fd)
+{
+	size_t io = block_size * 16, off, i;
+	uint8_t *buf, *want;
+	int err = 0;
+
+	if (posix_memalign((void **)&buf, 4096, io) ||
+	    posix_memalign((void **)&want, 4096, io))
+		return -ENOMEM;
+
+	for (off = 0; off < dev_size; off += io) {
+		for (i = 0; i < io; i += block_size)
+			fill_block(buf + i, (off + i) / block_size, 1);
+		if (pwrite(fd, buf, io, off) != io) {
+			err = -EIO;
+			goto out;
+		}
+	}
+	if (fsync(fd)) {
+		err = -errno;
+		goto out;
+	}
+
+	for (off = 0; off < dev_size; off += io) {
+		size_t len = block_size << (off / io % 5);
+
+		len = len < io ? len : io;
+		for (i = 0; i < io; i += block_size)
+			fill_block(want + i, (off + i) / block_size, 1);
+		for (i = 0; i < io; i += len) {
+			if (pread(fd, buf + i, len, off + i) != len) {
+				err = -EIO;
+				goto out;
+			}
+		}
+		if (memcmp(buf, want, io) || memcmp(backing + off, want, io)) {
+			fprintf(stderr, "mismatch at offset %zu\n", off);
+			err = -EILSEQ;
+			goto out;
+		}
+	}
+
+out:
+	free(buf);
+	free(want);
+	return err;
+}
+
+static void *client(void *arg)
+{
+	struct client *cl = arg;
+	size_t nr_blocks = dev_size / block_size;
+	uint8_t *buf;
+
+	if (posix_memalign((void **)&buf, 4096, block_size)) {
+		cl->error = -ENOMEM;
+		return NULL;
+	}
+	memset(buf, 0x5a, block_size);
+
+	while (!stop) {
+		off_t off = (rand_r(&cl->seed) % nr_blocks) * block_size;
+		ssize_t n;
+
+		if (rand_r(&cl->seed) % 100 < write_pct)
+			n = pwrite(cl->fd, buf, block_size, off);
+		else
+			n = pread(cl->fd, buf, block_size, off);
+		if (n != block_size) {
+			cl->error = n < 0 ? -errno : -EIO;
+			break;
+		}
+		cl->ops++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int bench_device(const char *path)
+{
+	unsigned long ops = 0, requests = 0, syscalls = 0;
+	double start, elapsed;
+	int i, err = 0;
+
+	for (i = 0; i < nr_clients; i++) {
+		clients[i].fd = open(path, O_RDWR | O_DIRECT);
+		if (clients[i].fd < 0)
+			return -errno;
+		clients[i].seed = i + 1;
+	}
+
+	for (i = 0; i < nr_channels; i++) {
+		channels[i].requests = 0;
+		channels[i].syscalls = 0;
+	}
+
+	start = now();
+	for (i = 0; i < nr_clients; i++)
+		pthread_create(&clients[i].thread, NULL, client, &clients[i]);
+	sleep(seconds);
+	stop = true;
+	for (i = 0; i < nr_clients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		close(clients[i].fd);
+		ops += clients[i].ops;
+		if (clients[i].error)
+			err = clients[i].error;
+	}
+	elapsed = now() - start;
+
+	for (i = 0; i < nr_channels; i++) {
+		requests += channels[i].requests;
+		syscalls += channels[i].syscalls;
+	}
+
+	printf("%s: bs=%zu clients=%u channels=%u writes=%u%%: "
+	       "%.1f MB/s, %.0f IOPS, %.2f daemon syscalls per request\n",
+	       transport == TRANSPORT_RING ? "ring" : "rw", block_size,
+	       nr_clients, nr_channels, write_pct,
+	       ops * block_size / elapsed / 1e6, ops / elapsed,
+	       requests ? (double)syscalls / requests : 0.0);
+
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-m rw|ring] [-s size_mb] [-b block_size]\n"
+		"       [-t seconds] [-c clients] [-d channels]\n"
+		"       [-w write_pct] [-e ring_entries] [-a arena_mb]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char path[128];
+	int opt, fd, err, i;
+
+	while ((opt = getopt(argc, argv, "m:s:b:t:c:d:w:e:a:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "rw"))
+				transport = TRANSPORT_RW;
+			else if (!strcmp(optarg, "ring"))
+				transport = TRANSPORT_RING;
+			else
+				usage(argv[0]);
+			break;
+		case 's':
+			dev_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			nr_clients = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			nr_channels = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			ring_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			arena_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!dev_size || !block_size || block_size % 512 ||
+	    dev_size % (block_size * 16) || !nr_clients ||
+	    nr_clients > MAX_CLIENTS || !nr_channels ||
+	    nr_channels > MAX_CHANNELS || write_pct > 100)
+		usage(argv[0]);
+
+	if (geteuid()) {
+		fprintf(stderr, "must be run as root, skipping\n");
+		return KSFT_SKIP;
+	}
+
+	/* The largest bio is BIO_MAX_PAGES (256) pages */
+	max_io = 256 * sysconf(_SC_PAGESIZE);
+	backing = calloc(1, dev_size);
+	if (!backing)
+		return 1;
+
+	for (i = 0; i < MAX_CHANNELS; i++)
+		channels[i].fd = -1;
+
+	snprintf(name, sizeof(name), "dm-user-test-%d", getpid());
+	err = create_device();
+	if (err) {
+		fprintf(stderr, "cannot create %s: %s\n", name, strerror(-err));
+		remove_device();
+		return KSFT_SKIP;
+	}
+
+	snprintf(path, sizeof(path), "/dev/mapper/%s", name);
+	fd = open(path, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(path);
+		remove_device();
+		return 1;
+	}
+
+	err = check_device(fd);
+	close(fd);
+	if (err)
+		fprintf(stderr, "data check failed: %s\n", strerror(-err));
+	else
+		err = bench_device(path);
+
+	remove_device();
+
+	for (i = 0; i < nr_channels; i++) {
+		if (channels[i].error) {
+			fprintf(stderr, "daemon channel %d: %s\n", i,
+				strerror(-channels[i].error));
+			err = channels[i].error;
+		}
+	}
+
+	return err ? 1 : 0;
+}
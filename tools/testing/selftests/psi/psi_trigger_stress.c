@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Stress test for PSI triggers with short windows.
+ *
+ * Keeps the CPUs overcommitted so that the chosen resource is under
+ * constant pressure, while many threads poll their own trigger and others
+ * create and destroy triggers as fast as they can.  Every polling thread
+ * recreates its trigger every few events, so the trigger list keeps
+ * changing under the monitor while it is walking it.
+ *
+ * Under constant pressure a trigger fires once per window, so the time
+ * between two events of the same trigger minus the window is how late
+ * the event was delivered.  The distribution of that delay is reported.
+ * The test fails if a polling thread sees no event at all, or on any
+ * unexpected error.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KSFT_SKIP	4
+
+#define MAX_SAMPLES	4096
+
+static const char *resource = "cpu";
+static unsigned int nr_pollers = 64;
+static unsigned int nr_churners = 4;
+static unsigned int nr_loaders;
+static unsigned int window_us = 10000;
+static unsigned int threshold_us = 1000;
+static unsigned int seconds = 5;
+static unsigned int events_per_trigger = 16;
+
+static char path[64];
+static char trigger[64];
+static volatile bool stop;
+
+struct poller {
+	pthread_t thread;
+	unsigned long events;
+	unsigned long triggers;
+	unsigned int nr_samples;
+	uint64_t samples[MAX_SAMPLES];
+	int error;
+};
+
+struct churner {
+	pthread_t thread;
+	unsigned long triggers;
+	int error;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int trigger_open(void)
+{
+	int fd;
+
+	fd = open(path, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static void *loader_fn(void *arg)
+{
+	volatile unsigned long n = 0;
+
+	while (!stop)
+		n++;
+
+	return NULL;
+}
+
+static void *churner_fn(void *arg)
+{
+	struct churner *c = arg;
+	int fd;
+
+	while (!stop) {
+		fd = trigger_open();
+		if (fd < 0) {
+			c->error = -fd;
+			break;
+		}
+		close(fd);
+		c->triggers++;
+	}
+
+	return NULL;
+}
+
+static void *poller_fn(void *arg)
+{
+	struct poller *p = arg;
+	struct pollfd pfd = { .events = POLLPRI };
+	uint64_t last = 0, t;
+	unsigned int n = 0;
+	int ret;
+
+	pfd.fd = -1;
+	while (!stop) {
+		if (pfd.fd < 0) {
+			pfd.fd = trigger_open();
+			if (pfd.fd < 0) {
+				p->error = -pfd.fd;
+				break;
+			}
+			p->triggers++;
+			last = 0;
+			n = 0;
+		}
+
+		ret = poll(&pfd, 1, 1000);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			p->error = errno;
+			break;
+		}
+		if (!ret)
+			continue;
+		if (pfd.revents & (POLLERR | POLLNVAL)) {
+			p->error = EIO;
+			break;
+		}
+
+		t = now_ns();
+		p->events++;
+		if (last && p->nr_samples < MAX_SAMPLES)
+			p->samples[p->nr_samples++] = t - last;
+		last = t;
+
+		/* Replace the trigger now and then to churn the list */
+		if (++n == events_per_trigger) {
+			close(pfd.fd);
+			pfd.fd = -1;
+		}
+	}
+
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double delay_ms(uint64_t interval)
+{
+	uint64_t window = window_us * 1000ULL;
+
+	return interval > window ? (interval - window) / 1e6 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-r cpu|memory|io] [-p pollers] [-c churners]\n"
+		"       [-l loaders] [-w window_us] [-s stall_us] [-d seconds]\n"
+		"       [-e events per trigger]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct poller *pollers;
+	struct churner *churners;
+	pthread_t *loaders;
+	unsigned long events = 0, triggers = 0, churned = 0;
+	unsigned int i, j, nr = 0, silent = 0;
+	uint64_t *all;
+	int opt, fd, ret = 0;
+
+	nr_loaders = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "r:p:c:l:w:s:d:e:")) != -1) {
+		switch (opt) {
+		case 'r':
+			resource = optarg;
+			break;
+		case 'p':
+			nr_pollers = atoi(optarg);
+			break;
+		case 'c':
+			nr_churners = atoi(optarg);
+			break;
+		case 'l':
+			nr_loaders = atoi(optarg);
+			break;
+		case 'w':
+			window_us = atoi(optarg);
+			break;
+		case 's':
+			threshold_us = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'e':
+			events_per_trigger = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nr_pollers || !events_per_trigger || threshold_us >= window_us)
+		usage(argv[0]);
+
+	snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+	snprintf(trigger, sizeof(trigger), "some %u %u",
+		 threshold_us, window_us);
+
+	fd = trigger_open();
+	if (fd == -ENOENT || fd == -EPERM || fd == -EACCES) {
+		printf("%s: %s, skipping\n", path, strerror(-fd));
+		return KSFT_SKIP;
+	}
+	if (fd < 0) {
+		printf("%s: \"%s\": %s\n", path, trigger, strerror(-fd));
+		return 1;
+	}
+	close(fd);
+
+	pollers = calloc(nr_pollers, sizeof(*pollers));
+	churners = calloc(nr_churners, sizeof(*churners));
+	loaders = calloc(nr_loaders, sizeof(*loaders));
+	all = calloc((size_t)nr_pollers * MAX_SAMPLES, sizeof(*all));
+	if (!pollers || (nr_churners && !churners) ||
+	    (nr_loaders && !loaders) || !all) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < nr_loaders; i++)
+		pthread_create(&loaders[i], NULL, loader_fn, NULL);
+	for (i = 0; i < nr_pollers; i++)
+		pthread_create(&pollers[i].thread, NULL, poller_fn,
+			       &pollers[i]);
+	for (i = 0; i < nr_churners; i++)
+		pthread_create(&churners[i].thread, NULL, churner_fn,
+			       &churners[i]);
+
+	sleep(seconds);
+	stop = true;
+
+	for (i = 0; i < nr_churners; i++) {
+		pthread_join(churners[i].thread, NULL);
+		churned += churners[i].triggers;
+		if (churners[i].error) {
+			printf("churner %u: %s\n", i,
+			       strerror(churners[i].error));
+			ret = 1;
+		}
+	}
+	for (i = 0; i < nr_pollers; i++) {
+		struct poller *p = &pollers[i];
+
+		pthread_join(p->thread, NULL);
+		events += p->events;
+		triggers += p->triggers;
+		if (!p->events)
+			silent++;
+		if (p->error) {
+			printf("poller %u: %s\n", i, strerror(p->error));
+			ret = 1;
+		}
+		for (j = 0; j < p->nr_samples; j++)
+			all[nr++] = p->samples[j];
+	}
+	for (i = 0; i < nr_loaders; i++)
+		pthread_join(loaders[i], NULL);
+
+	printf("%s \"%s\": %u pollers, %u churners, %u loaders, %us\n",
+	       resource, trigger, nr_pollers, nr_churners, nr_loaders,
+	       seconds);
+	printf("triggers created: %lu polled, %lu churned (%.0f/s)\n",
+	       triggers, churned, (double)(triggers + churned) / seconds);
+	printf("events: %lu (%.1f/s per poller)\n", events,
+	       (double)events / nr_pollers / seconds);
+
+	if (nr) {
+		qsort(all, nr, sizeof(*all), cmp_u64);
+		printf("event delay past the window (ms): p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+		       delay_ms(all[nr / 2]), delay_ms(all[nr * 9 / 10]),
+		       delay_ms(all[nr * 99 / 100]), delay_ms(all[nr - 1]));
+	}
+
+	if (silent) {
+		printf("%u pollers saw no event\n", silent);
+		ret = 1;
+	}
+
+	printf("%s\n", ret ? "FAIL" : "PASS");
+	return ret;
+}